@@ -8,7 +8,9 @@
 #include <glm/gtx/string_cast.hpp>
 #include <camera.h>
 #include <model.h>
+#include <cube_map.h>
 #include <filesystem.h>
+#include <offscreen_framebuffer.h>
 #include <map>
 #include <imgui.h>
 #include <imgui_impl_opengl3.h>
@@ -44,8 +46,8 @@ CelestialBody blackhole(bh.position, glm::dvec3(0), bh.mass, "blackhole");
 
 
 GLuint FBO, texColorBuffer, rbo;
+bool framebufferResized = false;
 void createOffscreenFB(GLuint& FBO, GLuint& texColorBuffer, GLuint& rbo);
-GLuint loadCubeMap(std::vector<std::filesystem::path> faces, std::filesystem::path directory);
 
 struct PostEffect
 {
@@ -220,10 +222,8 @@ void framebuffer_size_callback(GLFWwindow* window, int newWidth, int newHeight)
 	width = newWidth;
 	height = newHeight;
 	glViewport(0, 0, width, height);
-	glDeleteFramebuffers(1, &FBO);
-	glDeleteTextures(1, &texColorBuffer);
-	glDeleteBuffers(1, &rbo);
-	createOffscreenFB(FBO, texColorBuffer, rbo);
+	// a drag sends many resize events, the attachments are resized once before the next frame
+	framebufferResized = true;
 	glfwSetCursorPos(window, width / 2, height / 2);
 }
 
@@ -311,43 +311,6 @@ void createOffscreenFB(GLuint& FBO, GLuint& texColorBuffer, GLuint& rbo)
 	}
 }
 
-GLuint loadCubeMap(std::vector<std::filesystem::path> faces, std::filesystem::path directory)
-{
-	GLuint texture;
-	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &texture);
-
-	int width, height, nrChannels;
-	std::filesystem::path fullPath;
-	fullPath = directory;
-	fullPath /= faces[0];
-	stbi_load(fullPath.string().c_str(), &width, &height, &nrChannels, 0);
-	glTextureStorage2D(texture, 1, GL_RGB8, width, height);
-
-	for (size_t i = 0; i < faces.size(); i++)
-	{
-		fullPath = directory;
-		fullPath /= faces[i];
-		unsigned char* data = stbi_load(fullPath.string().c_str(), &width, &height, &nrChannels, 0);
-		if (data)
-		{
-			GLenum format;
-			if (nrChannels == 1)
-				format = GL_RED;
-			else if (nrChannels == 3)
-				format = GL_RGB;
-			else if (nrChannels == 4)
-				format = GL_RGBA;
-			glTextureSubImage3D(texture, 0, 0, 0, i, width, height, 1, format, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-	}
-	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	return texture;
-}
-
 void drawOverlay()
 {
 	ImGui_ImplOpenGL3_NewFrame();
@@ -425,6 +388,18 @@ void run()
 
 	while (!glfwWindowShouldClose(window))
 	{
+		// edit skybox_shader.* while the simulation runs
+		if (skyboxShader.reloadIfChanged())
+		{
+			skyboxShader.use();
+			skyboxShader.setInt("skybox", 0);
+		}
+		if (framebufferResized)
+		{
+			resizeOffscreenFB(FBO, texColorBuffer, rbo, width, height);
+			framebufferResized = false;
+		}
+
 		processInput(window);
 
 		glClearColor(0.0, 0.0, 0.0, 1.f);
@@ -439,15 +414,14 @@ void run()
 		{
 			camera.Front = glm::normalize(bh.position - camera.Position);
 		}
-		glm::mat4 view = camera.GetViewMatrix();
+		glm::mat4 view = camera.GetRelativeViewMatrix();
 		glNamedBufferSubData(uboBuffer, 0, sizeof(glm::mat4), &projection);
 		glNamedBufferSubData(uboBuffer, sizeof(glm::mat4), sizeof(glm::mat4), &view);
 
 		/// draw skybox
 		glDepthMask(GL_FALSE);
 		skyboxShader.use();
-		skyboxShader.setVec3("bhPos", bh.position);
-		skyboxShader.setVec3("cameraPos", camera.Position);
+		skyboxShader.setVec3("bhRelPos", camera.ToCameraSpace(bh.position));
 		skyboxShader.setVec3("cameraFront", camera.Front);
 		skyboxShader.setFloat("r_s_km", bh.r_s_km);
 
@@ -479,7 +453,7 @@ void run()
 int main(int argc, char* argv[])
 {
 	camera.MovementSpeed = 1000000000.f;
-	camera.Position = glm::vec3(1.0, 1.0, cameraDistance);
+	camera.Position = glm::dvec3(1.0, 1.0, cameraDistance);
 	try
 	{
 		run();
@@ -4,8 +4,8 @@
 in vec3 TexCoord;
 
 uniform samplerCube skybox;
-uniform vec3 bhPos;
-uniform vec3 cameraPos;
+// black hole position relative to the camera, subtracted in double precision on the CPU
+uniform vec3 bhRelPos;
 uniform vec3 cameraFront;
 uniform float r_s_km;
 
@@ -15,7 +15,7 @@ void distort();
 
 void main()
 {
-	vec3 bhDir = bhPos - cameraPos;
+	vec3 bhDir = bhRelPos;
 	if(dot(bhDir, cameraFront) / (length(bhDir)) > 0) {
 		distort();
 	} else {
@@ -37,7 +37,7 @@ mat4 rotationMatrix(vec3 axis, float angle)
 }
 
 void distort() {
-	vec3 bhDir = bhPos - cameraPos;
+	vec3 bhDir = bhRelPos;
 	vec3 refractV = -(cross(cross(bhDir, TexCoord), TexCoord));
 	float cosTheta = dot(TexCoord, bhDir) / (length(TexCoord) * length(bhDir));
 	float bhDist = length(bhDir);
@@ -75,6 +75,19 @@ public:
 		return glm::lookAt(Position, Position + Front, Up);
 	}
 
+	// Returns the view matrix with the camera placed at the origin. Use it together with ToCameraSpace so that world
+	// positions are only ever narrowed to float after the (double precision) camera position has been subtracted
+	glm::mat4 GetRelativeViewMatrix()
+	{
+		return glm::lookAt(glm::dvec3(0.0), Front, Up);
+	}
+
+	// Returns the offset from the camera to a world space position
+	glm::vec3 ToCameraSpace(const glm::dvec3& worldPosition) const
+	{
+		return glm::vec3(worldPosition - Position);
+	}
+
 	// Processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
 	void ProcessKeyboard(Camera_Movement direction, float deltaTime)
 	{
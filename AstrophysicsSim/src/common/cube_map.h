@@ -0,0 +1,247 @@
+#pragma once
+#include <glad/glad.h>
+#include <stb_image.h>
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// S3TC is an extension the loader may not have been generated with, every desktop GL 4 driver supports it
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+/// Skybox loading. The six faces are decoded on a thread each, straight into one staging buffer that is uploaded with a
+/// single call. When every face has an up to date <face>.bc1.ctex next to it, cooked by the texture cooker of
+/// learnopengl.com, the blocks are read instead and nothing is decoded
+namespace cubemap
+{
+	// a copy of the layout in learnopengl.com/src/common/texture_cooker.h, the version must match the cooker's: files
+	// of any other version are not read, the faces are decoded instead
+	const uint32_t CompressedTextureMagic = 0x58455443; // "CTEX"
+	const uint32_t CompressedTextureVersion = 3;
+	const uint32_t BC1 = 1;
+
+	struct CompressedTextureHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceSize;
+		int64_t sourceWriteTime;
+		uint32_t format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t levelCount;
+		uint64_t dataSize;
+	};
+
+	struct CompressedLevel
+	{
+		uint32_t width;
+		uint32_t height;
+		uint64_t offset; // into the data
+		uint64_t size;
+	};
+
+	static_assert(sizeof(CompressedTextureHeader) == 48 && sizeof(CompressedLevel) == 24,
+	              "the cooked texture layout differs from the texture cooker's");
+
+	struct CompressedFace
+	{
+		CompressedTextureHeader header;
+		std::vector<CompressedLevel> levels;
+	};
+
+	inline std::filesystem::path getCompressedPath(const std::filesystem::path& sourcePath)
+	{
+		std::filesystem::path path = sourcePath;
+		path += ".bc1.ctex";
+		return path;
+	}
+
+	/// Runs body(face) for every face on its own thread
+	template <typename Function>
+	void forEachFace(size_t count, const Function& body)
+	{
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < count; i++)
+			threads.emplace_back(body, i);
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	/// Levels halve from the size in the header down to at most 1x1, each holds exactly the BC1 blocks of its size,
+	/// and they follow each other through the whole data, the same table the texture cooker writes
+	inline bool hasValidLevels(const CompressedTextureHeader& header, const std::vector<CompressedLevel>& levels)
+	{
+		if (header.width == 0 || header.height == 0 || levels.empty())
+			return false;
+		uint32_t width = header.width, height = header.height;
+		uint64_t offset = 0;
+		for (size_t i = 0; i < levels.size(); i++)
+		{
+			const CompressedLevel& level = levels[i];
+			const uint64_t size = (uint64_t(width) + 3) / 4 * ((uint64_t(height) + 3) / 4) * 8;
+			if (level.width != width || level.height != height || level.offset != offset || level.size != size)
+				return false;
+			offset += size;
+			if (width == 1 && height == 1 && i + 1 < levels.size())
+				return false;
+			width = std::max(1u, width / 2);
+			height = std::max(1u, height / 2);
+		}
+		return offset == header.dataSize;
+	}
+
+	/// Header and level table of a cooked face, false when it is missing, not BC1, older than its source or its level
+	/// table doesn't match its size
+	inline bool readCompressedFace(const std::filesystem::path& sourcePath, CompressedFace& face)
+	{
+		const std::filesystem::path path = getCompressedPath(sourcePath);
+		std::error_code error;
+		const uint64_t fileSize = std::filesystem::file_size(path, error);
+		if (error)
+			return false;
+		std::ifstream file(path, std::ios::binary);
+		CompressedTextureHeader& header = face.header;
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != CompressedTextureMagic)
+			return false;
+		if (header.version != CompressedTextureVersion)
+		{
+			std::cout << "Cooked face " << path.string() << " has version " << header.version << ", expected "
+			          << CompressedTextureVersion << std::endl;
+			return false;
+		}
+		if (header.format != BC1
+			|| fileSize != sizeof(header) + sizeof(CompressedLevel) * header.levelCount + header.dataSize)
+			return false;
+		if (std::filesystem::exists(sourcePath))
+		{
+			const uint64_t size = std::filesystem::file_size(sourcePath, error);
+			const int64_t writeTime = std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count();
+			if (size != header.sourceSize || writeTime != header.sourceWriteTime)
+				return false;
+		}
+		face.levels.resize(header.levelCount);
+		const std::streamsize levelsSize = std::streamsize(sizeof(CompressedLevel) * header.levelCount);
+		if (!file.read(reinterpret_cast<char*>(face.levels.data()), levelsSize))
+			return false;
+		if (!hasValidLevels(header, face.levels))
+		{
+			std::cout << "Cooked face " << path.string() << " is corrupt" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	/// The staging buffer holds the levels largest first and the six faces of a level next to each other, so a level
+	/// is a single upload
+	inline bool loadCompressed(GLuint texture, const std::vector<std::filesystem::path>& paths)
+	{
+		if (paths.empty())
+			return false;
+		std::vector<CompressedFace> faces(paths.size());
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			if (!readCompressedFace(paths[i], faces[i]))
+				return false;
+			const CompressedTextureHeader& header = faces[i].header;
+			if (header.width != faces[0].header.width || header.height != faces[0].header.height
+				|| header.levelCount != faces[0].header.levelCount || header.dataSize != faces[0].header.dataSize)
+				return false;
+		}
+		const std::vector<CompressedLevel>& levels = faces[0].levels;
+		const size_t faceCount = faces.size();
+
+		std::vector<char> staging(faces[0].header.dataSize * faceCount);
+		std::vector<char> loaded(faceCount, 0);
+		forEachFace(faceCount, [&](size_t i) {
+			std::ifstream file(getCompressedPath(paths[i]), std::ios::binary);
+			const uint64_t dataOffset = sizeof(CompressedTextureHeader) + sizeof(CompressedLevel) * levels.size();
+			for (const CompressedLevel& level : levels)
+			{
+				file.seekg(dataOffset + level.offset);
+				if (!file.read(staging.data() + level.offset * faceCount + level.size * i, level.size))
+					return;
+			}
+			loaded[i] = 1;
+		});
+		for (char faceLoaded : loaded)
+			if (!faceLoaded)
+				return false;
+
+		glTextureStorage2D(texture, GLsizei(levels.size()), GL_COMPRESSED_RGB_S3TC_DXT1_EXT, faces[0].header.width,
+		                   faces[0].header.height);
+		for (size_t j = 0; j < levels.size(); j++)
+			glCompressedTextureSubImage3D(texture, GLint(j), 0, 0, 0, levels[j].width, levels[j].height,
+			                              GLsizei(faceCount), GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+			                              GLsizei(levels[j].size * faceCount),
+			                              staging.data() + levels[j].offset * faceCount);
+		glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		return true;
+	}
+
+	/// Every face is decoded to RGB and must be the size of the first one
+	inline bool loadDecoded(GLuint texture, const std::vector<std::filesystem::path>& paths)
+	{
+		int width, height, components;
+		if (paths.empty() || !stbi_info(paths[0].string().c_str(), &width, &height, &components))
+		{
+			std::cout << "Cube map face failed to load at path: " << (paths.empty() ? "" : paths[0].string())
+			          << std::endl;
+			return false;
+		}
+		const size_t faceSize = size_t(width) * height * 3;
+
+		std::vector<unsigned char> staging(faceSize * paths.size());
+		std::vector<char> loaded(paths.size(), 0);
+		forEachFace(paths.size(), [&](size_t i) {
+			int faceWidth, faceHeight, faceComponents;
+			unsigned char* data = stbi_load(paths[i].string().c_str(), &faceWidth, &faceHeight, &faceComponents, 3);
+			if (data && faceWidth == width && faceHeight == height)
+			{
+				std::copy(data, data + faceSize, staging.begin() + faceSize * i);
+				loaded[i] = 1;
+			}
+			stbi_image_free(data);
+		});
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			if (!loaded[i])
+			{
+				std::cout << "Cube map face failed to load at path: " << paths[i].string() << std::endl;
+				return false;
+			}
+		}
+
+		glTextureStorage2D(texture, 1, GL_RGB8, width, height);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTextureSubImage3D(texture, 0, 0, 0, 0, width, height, GLsizei(paths.size()), GL_RGB, GL_UNSIGNED_BYTE,
+		                    staging.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		return true;
+	}
+}
+
+/// Faces in the order of the cube map layers, +X -X +Y -Y +Z -Z
+inline GLuint loadCubeMap(const std::vector<std::filesystem::path>& faces, const std::filesystem::path& directory)
+{
+	std::vector<std::filesystem::path> paths;
+	for (const std::filesystem::path& face : faces)
+		paths.push_back(directory / face);
+
+	GLuint texture;
+	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &texture);
+	if (!cubemap::loadCompressed(texture, paths))
+		cubemap::loadDecoded(texture, paths);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	return texture;
+}
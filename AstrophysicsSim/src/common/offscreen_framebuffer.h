@@ -0,0 +1,20 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstdint>
+
+/// Resizes the attachments of an offscreen framebuffer with an RGB8 color texture and a depth stencil renderbuffer.
+/// The framebuffer object and the renderbuffer are kept, only the immutable color texture is replaced. A minimized
+/// window has a zero size and keeps the old attachments
+inline void resizeOffscreenFB(GLuint FBO, GLuint& texColorBuffer, GLuint rbo, uint32_t width, uint32_t height)
+{
+	if (width == 0 || height == 0)
+	{
+		// minimized
+		return;
+	}
+	glDeleteTextures(1, &texColorBuffer);
+	glCreateTextures(GL_TEXTURE_2D, 1, &texColorBuffer);
+	glTextureStorage2D(texColorBuffer, 1, GL_RGB8, width, height);
+	glNamedFramebufferTexture(FBO, GL_COLOR_ATTACHMENT0, texColorBuffer, 0);
+	glNamedRenderbufferStorage(rbo, GL_DEPTH24_STENCIL8, width, height);
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include <glad/glad.h>
+#include <filesystem>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -11,48 +13,17 @@ class Shader
 public:
 	Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
 	{
-		GLuint vertex = compileShader(vertexPath, GL_VERTEX_SHADER);
-		GLuint fragment = compileShader(fragmentPath, GL_FRAGMENT_SHADER);
-
-		GLint success;
-		char infoLog[512];
-
-		// link shader program
-		programID = glCreateProgram();
-		glAttachShader(programID, vertex);
-		glAttachShader(programID, fragment);
-		glLinkProgram(programID);
-		// print error
-		glGetProgramiv(programID, GL_LINK_STATUS, &success);
-		if (!success)
-		{
-			glGetProgramInfoLog(programID, 512, nullptr, infoLog);
-			std::cout << "Failed to link shader program: " << infoLog << "\n";
-		}
+		addSource(vertexPath, GL_VERTEX_SHADER);
+		addSource(fragmentPath, GL_FRAGMENT_SHADER);
+		programID = buildProgram(false);
 	}
 
 	Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const GLchar* geometryPath)
 	{
-		GLuint vertex = compileShader(vertexPath, GL_VERTEX_SHADER);
-		GLuint geometry = compileShader(geometryPath, GL_GEOMETRY_SHADER);
-		GLuint fragment = compileShader(fragmentPath, GL_FRAGMENT_SHADER);
-
-		GLint success;
-		char infoLog[512];
-
-		// link shader program
-		programID = glCreateProgram();
-		glAttachShader(programID, vertex);
-		glAttachShader(programID, geometry);
-		glAttachShader(programID, fragment);
-		glLinkProgram(programID);
-		// print error
-		glGetProgramiv(programID, GL_LINK_STATUS, &success);
-		if (!success)
-		{
-			glGetProgramInfoLog(programID, 512, nullptr, infoLog);
-			std::cout << "Failed to link shader program: " << infoLog << "\n";
-		}
+		addSource(vertexPath, GL_VERTEX_SHADER);
+		addSource(geometryPath, GL_GEOMETRY_SHADER);
+		addSource(fragmentPath, GL_FRAGMENT_SHADER);
+		programID = buildProgram(false);
 	}
 
 	void use()
@@ -60,6 +31,39 @@ public:
 		glUseProgram(programID);
 	}
 
+	/// Build the program again when one of its source files was written since the last build, call it at the top of
+	/// the frame. The driver compiles on the thread that owns the context, a file that fails to compile or link keeps
+	/// the old program running. Returns true when the program was replaced, uniforms set before the render loop need
+	/// to be set again
+	bool reloadIfChanged()
+	{
+		bool changed = false;
+		for (Source& source : sources)
+		{
+			std::error_code error;
+			const auto writeTime = std::filesystem::last_write_time(source.path, error);
+			if (!error && writeTime != source.writeTime)
+			{
+				source.writeTime = writeTime;
+				changed = true;
+			}
+		}
+		if (!changed)
+		{
+			return false;
+		}
+
+		const GLuint program = buildProgram(true);
+		if (program == 0)
+		{
+			return false;
+		}
+		glDeleteProgram(programID);
+		programID = program;
+		std::cout << "Reloaded " << sources.back().path << "\n";
+		return true;
+	}
+
 	void setFloat(const std::string& name, float value)
 	{
 		GLint location = glGetUniformLocation(programID, name.c_str());
@@ -133,9 +137,75 @@ public:
 	GLuint programID;
 
 private:
-	GLuint compileShader(const GLchar* path, GLenum type)
+	struct Source
+	{
+		std::string path;
+		GLenum type;
+		std::filesystem::file_time_type writeTime;
+	};
+
+	std::vector<Source> sources;
+
+	void addSource(const GLchar* path, GLenum type)
+	{
+		std::error_code error;
+		sources.push_back({path, type, std::filesystem::last_write_time(path, error)});
+	}
+
+	/// 0 when a reloaded stage does not compile or the program does not link, a file missing at startup exits
+	GLuint buildProgram(bool reloading)
+	{
+		std::vector<GLuint> shaders;
+		bool compiled = true;
+		for (const Source& source : sources)
+		{
+			std::string code;
+			if (!readSource(source.path, code))
+			{
+				if (!reloading)
+				{
+					exit(-1);
+				}
+				compiled = false;
+				break;
+			}
+			shaders.push_back(compileShader(source.path, code, source.type, compiled));
+		}
+
+		GLint success = GL_FALSE;
+		char infoLog[512];
+
+		// link shader program
+		GLuint program = glCreateProgram();
+		for (GLuint shader : shaders)
+		{
+			glAttachShader(program, shader);
+		}
+		if (compiled)
+		{
+			glLinkProgram(program);
+			// print error
+			glGetProgramiv(program, GL_LINK_STATUS, &success);
+			if (!success)
+			{
+				glGetProgramInfoLog(program, 512, nullptr, infoLog);
+				std::cout << "Failed to link shader program: " << infoLog << "\n";
+			}
+		}
+		for (GLuint shader : shaders)
+		{
+			glDeleteShader(shader);
+		}
+		if (reloading && !success)
+		{
+			glDeleteProgram(program);
+			return 0;
+		}
+		return program;
+	}
+
+	static bool readSource(const std::string& path, std::string& code)
 	{
-		std::string code;
 		std::ifstream file;
 
 		file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
@@ -151,8 +221,13 @@ private:
 		catch (std::ifstream::failure e)
 		{
 			std::cout << "failed to read shader file: " << e.what() << "\n";
-			exit(-1);
+			return false;
 		}
+		return true;
+	}
+
+	GLuint compileShader(const std::string& path, const std::string& code, GLenum type, bool& compiled)
+	{
 		const char* shaderCode = code.c_str();
 
 		/// compile
@@ -169,7 +244,8 @@ private:
 		if (!success)
 		{
 			glGetShaderInfoLog(shader, 512, nullptr, infoLog);
-			std::cout << "Failed to compile vertex shader: " << infoLog << "\n";
+			std::cout << "Failed to compile " << path << ": " << infoLog << "\n";
+			compiled = false;
 		}
 
 		return shader;
@@ -35,7 +35,6 @@ static glm::vec3 lightDir = glm::vec3(0.1, 0.1, -1);
 
 GLuint FBO, texColorBuffer, rbo;
 void createOffscreenFB(GLuint& FBO, GLuint& texColorBuffer, GLuint& rbo);
-GLuint loadCubeMap(std::vector<std::filesystem::path> faces, std::filesystem::path directory);
 
 struct PostEffect
 {
@@ -133,6 +132,15 @@ void processInput(GLFWwindow* window)
 	{
 		glfwRestoreWindow(window);
 	}
+	// scale the flying speed so that both AU and km distances can be traveled
+	if (glfwGetKey(window, GLFW_KEY_PAGE_UP) == GLFW_PRESS)
+	{
+		camera.MovementSpeed *= 1.f + 2.f * deltaTime;
+	}
+	if (glfwGetKey(window, GLFW_KEY_PAGE_DOWN) == GLFW_PRESS)
+	{
+		camera.MovementSpeed /= 1.f + 2.f * deltaTime;
+	}
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int newWidth, int newHeight)
@@ -140,10 +148,6 @@ void framebuffer_size_callback(GLFWwindow* window, int newWidth, int newHeight)
 	width = newWidth;
 	height = newHeight;
 	glViewport(0, 0, width, height);
-	glDeleteFramebuffers(1, &FBO);
-	glDeleteTextures(1, &texColorBuffer);
-	glDeleteBuffers(1, &rbo);
-	createOffscreenFB(FBO, texColorBuffer, rbo);
 	glfwSetCursorPos(window, width / 2, height / 2);
 }
 
@@ -234,43 +238,6 @@ void createOffscreenFB(GLuint& FBO, GLuint& texColorBuffer, GLuint& rbo)
 	}
 }
 
-GLuint loadCubeMap(std::vector<std::filesystem::path> faces, std::filesystem::path directory)
-{
-	GLuint texture;
-	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &texture);
-
-	int width, height, nrChannels;
-	std::filesystem::path fullPath;
-	fullPath = directory;
-	fullPath /= faces[0];
-	stbi_load(fullPath.string().c_str(), &width, &height, &nrChannels, 0);
-	glTextureStorage2D(texture, 1, GL_RGB8, width, height);
-
-	for (size_t i = 0; i < faces.size(); i++)
-	{
-		fullPath = directory;
-		fullPath /= faces[i];
-		unsigned char* data = stbi_load(fullPath.string().c_str(), &width, &height, &nrChannels, 0);
-		if (data)
-		{
-			GLenum format;
-			if (nrChannels == 1)
-				format = GL_RED;
-			else if (nrChannels == 3)
-				format = GL_RGB;
-			else if (nrChannels == 4)
-				format = GL_RGBA;
-			glTextureSubImage3D(texture, 0, 0, 0, i, width, height, 1, format, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-	}
-	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	return texture;
-}
-
 static double yearCount = 0;
 
 void drawOverlay()
@@ -304,7 +271,7 @@ void setupState()
 }
 
 
-const double scale = 1 / 300000000000.f;
+const double AU = 149597870700.0;
 const uint32_t stepLength = 1; // 1 second per step
 const uint32_t steps = 100000; // steps per iter
 uint32_t iterCount = 0;
@@ -378,8 +345,9 @@ void run()
 
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)width / height, 0.1f, 1000.f);
-		glm::mat4 view = camera.GetViewMatrix();
+		// everything is drawn relative to the camera in meters, so there is no far plane to fit the solar system into
+		glm::mat4 projection = glm::infinitePerspective(glm::radians(camera.Zoom), (float)width / height, 1000.f);
+		glm::mat4 view = camera.GetRelativeViewMatrix();
 		glm::mat4 model = glm::mat4(1.f);
 		glNamedBufferSubData(uboBuffer, 0, sizeof(glm::mat4), &projection);
 		glNamedBufferSubData(uboBuffer, sizeof(glm::mat4), sizeof(glm::mat4), &view);
@@ -395,7 +363,7 @@ void run()
 
 		for (auto& body : bodies)
 		{
-			model = glm::translate(glm::dmat4(1.f), glm::dvec3(body->position * scale));
+			model = glm::translate(glm::mat4(1.f), camera.ToCameraSpace(body->position));
 			shader.setMat4("model", model);
 			glDrawArrays(GL_POINTS, 0, 1);
 		}
@@ -416,6 +384,8 @@ void run()
 
 int main(int argc, char* argv[])
 {
+	camera.MovementSpeed = 0.1 * AU;
+	camera.Position = glm::dvec3(0.0, 0.0, 3.0 * AU);
 	try
 	{
 		run();
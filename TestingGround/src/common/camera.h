@@ -33,11 +33,11 @@ public:
 
 
 	// Camera Attributes
-	glm::vec3 Position;
-	glm::vec3 Front;
-	glm::vec3 Up;
-	glm::vec3 Right;
-	glm::vec3 WorldUp;
+	glm::dvec3 Position;
+	glm::dvec3 Front;
+	glm::dvec3 Up;
+	glm::dvec3 Right;
+	glm::dvec3 WorldUp;
 	// Euler Angles
 	float Yaw;
 	float Pitch;
@@ -75,10 +75,23 @@ public:
 		return glm::lookAt(Position, Position + Front, Up);
 	}
 
+	// Returns the view matrix with the camera placed at the origin. Use it together with ToCameraSpace so that world
+	// positions are only ever narrowed to float after the (double precision) camera position has been subtracted
+	glm::mat4 GetRelativeViewMatrix()
+	{
+		return glm::lookAt(glm::dvec3(0.0), Front, Up);
+	}
+
+	// Returns the offset from the camera to a world space position
+	glm::vec3 ToCameraSpace(const glm::dvec3& worldPosition) const
+	{
+		return glm::vec3(worldPosition - Position);
+	}
+
 	// Processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
 	void ProcessKeyboard(Camera_Movement direction, float deltaTime)
 	{
-		float velocity = MovementSpeed * deltaTime;
+		double velocity = MovementSpeed * deltaTime;
 		if (direction == FORWARD)
 			Position += Front * velocity;
 		if (direction == BACKWARD)
@@ -10,8 +10,10 @@
 
 #include <array>
 #include <filesystem>
+#include <future>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <vector>
 
 
@@ -90,12 +92,12 @@ class Triangle : public VulkanBase
         VkBuffer buffer;
     } computeBuffer;
 
-
+    // host copy of computeBuffer, refreshed at the end of every dispatch
     struct
     {
         VmaAllocation memory;
         VkBuffer buffer;
-    } cameraBuffer;
+    } readbackBuffer;
 
     struct
     {
@@ -119,49 +121,106 @@ public:
     dhh::shader::Pipeline* cachePipe;
     std::vector<Body> bodies;
 
-    Triangle() : VulkanBase(false)
+    explicit Triangle(bool headless) : VulkanBase(false, headless)
     {
         init();
         fillBodyInitialStates();
-        createTrianglePipeline();
-        CreateComputePipeline();
-        CreateCameraBuffer();
-        WriteGraphicsDescriptorSet();
+        loadPipelines();
         createComputeBuffer();
         CreateVertexBuffer();
+        uploadManager.flush();
+
+        trianglePipe = trianglePipeTask.get();
+        WriteGraphicsDescriptorSet();
         buildCommandBuffers();
+
+        computePipe = computePipeTask.get();
+        cachePipe   = cachePipeTask.get();
         writeComputeDescriptorSet();
         BuildComputeCommandBuffers();
+        watchShaders();
         Compute();
     }
 
+    ~Triangle() override
+    {
+        vkDestroyFence(device, computeFence, nullptr);
+    }
+
+private:
+    std::future<dhh::shader::Pipeline*> trianglePipeTask;
+    std::future<dhh::shader::Pipeline*> computePipeTask;
+    std::future<dhh::shader::Pipeline*> cachePipeTask;
+
+    using ShaderTask = std::shared_future<std::shared_ptr<dhh::shader::Shader>>;
+
+    /// Compile every shader and build every pipeline on the thread pool. The shaders are queued before the pipelines,
+    /// so a pipeline task only ever waits for compilations that are already running
+    void loadPipelines()
+    {
+        const std::filesystem::path shadersDirectory = dhh::shader::findShaderDirectory();
+        const auto compile                           = [this, &shadersDirectory](const char* filename) -> ShaderTask {
+            std::filesystem::path path = shadersDirectory / filename;
+            return threadPool.submit([path] { return std::make_shared<dhh::shader::Shader>(path); }).share();
+        };
+
+        ShaderTask vertexShader   = compile("shader.vert");
+        ShaderTask fragmentShader = compile("shader.frag");
+        ShaderTask computeShader  = compile("nbody.comp");
+        ShaderTask cacheShader    = compile("cache.comp");
+
+        trianglePipeTask = threadPool.submit(
+            [=] { return createTrianglePipeline(vertexShader.get().get(), fragmentShader.get().get()); });
+        computePipeTask = threadPool.submit([=] { return createComputePipeline(computeShader.get().get()); });
+        cachePipeTask   = threadPool.submit([=] { return createComputePipeline(cacheShader.get().get()); });
+    }
+
+    /// Saving a shader rebuilds its pipeline in the background, the simulation keeps running on the old one meanwhile
+    void watchShaders()
+    {
+        pipelineReloader.add(
+            trianglePipe, {"shader.vert", "shader.frag"},
+            [this](const std::vector<dhh::shader::Shader*>& shaders) {
+                return createTrianglePipeline(shaders[0], shaders[1]);
+            },
+            [this] { WriteGraphicsDescriptorSet(); });
+
+        // the compute command buffer is not in flight between frames, it is recorded again right away
+        const auto rebuildCompute = [this] {
+            writeComputeDescriptorSet();
+            BuildComputeCommandBuffers();
+        };
+        pipelineReloader.add(
+            computePipe, {"nbody.comp"},
+            [this](const std::vector<dhh::shader::Shader*>& shaders) { return createComputePipeline(shaders[0]); },
+            rebuildCompute);
+        pipelineReloader.add(
+            cachePipe, {"cache.comp"},
+            [this](const std::vector<dhh::shader::Shader*>& shaders) { return createComputePipeline(shaders[0]); },
+            rebuildCompute);
+    }
+
+public:
+
     void updateTransform()
     {
         dhh::input::processKeyboard(window, camera);
 
-        void* data;
-        vmaMapMemory(allocator, cameraBuffer.memory, &data);
+        // must be the first allocation of the frame, the command buffers were recorded with that offset
         Transforms transforms{
             {glm::perspective(glm::radians(camera.Zoom), (float) windowWidth / windowHeight, 0.1f, 1000.f)},
             {camera.GetViewMatrix()}, {glm::mat4(1.f)}};
 
-        memcpy(data, &transforms, sizeof(transforms));
-        vmaUnmapMemory(allocator, cameraBuffer.memory);
-    }
-
-    void CreateCameraBuffer()
-    {
-        createBuffer(sizeof(glm::mat4) * 4, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
-            cameraBuffer.buffer, cameraBuffer.memory);
+        frameAllocator.push(transforms);
     }
 
     void WriteGraphicsDescriptorSet()
     {
         VkDescriptorBufferInfo bufferInfo =
-            dhh::vk::initializer::descriptorBufferInfo(cameraBuffer.buffer, 0, VK_WHOLE_SIZE);
+            dhh::vk::initializer::descriptorBufferInfo(frameAllocator.buffer, 0, sizeof(Transforms));
 
         VkWriteDescriptorSet write = dhh::vk::initializer::writeDescriptorSet(
-            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, 0, trianglePipe->descriptorSets[0], &bufferInfo);
+            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, 0, trianglePipe->descriptorSets[0], &bufferInfo);
 
         vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
     }
@@ -225,45 +284,52 @@ public:
 
     void Compute()
     {
-        VkFence completeFence;
-
-        VkFenceCreateInfo fenceCreateInfo = dhh::vk::initializer::fenceCreateInfo();
-        vkCreateFence(device, &fenceCreateInfo, nullptr, &completeFence);
-
         VkSubmitInfo submitInfo       = {};
         submitInfo.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers    = &computeCmdBuf;
 
-        auto now = std::chrono::high_resolution_clock::now();
-        vkQueueSubmit(graphicsQueue, 1, &submitInfo, completeFence);
-        vkWaitForFences(device, 1, &completeFence, true, UINT64_MAX);
-        vkResetFences(device, 1, &completeFence);
-
-        // std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(
-        //	std::chrono::high_resolution_clock::now() - now).count() << std::endl;
+        vkQueueSubmit(graphicsQueue, 1, &submitInfo, computeFence);
+        gpuProfiler.submitted(computeProfilerSlot);
+        {
+            dhh::trace::Zone zone(frameTrace, "wait compute fence");
+            vkWaitForFences(device, 1, &computeFence, true, UINT64_MAX);
+        }
+        vkResetFences(device, 1, &computeFence);
+        gpuProfiler.collect(computeProfilerSlot);
 
         void* data;
-        vmaMapMemory(allocator, computeBuffer.memory, &data);
+        vmaMapMemory(allocator, readbackBuffer.memory, &data);
+        vmaInvalidateAllocation(allocator, readbackBuffer.memory, 0, VK_WHOLE_SIZE);
         std::vector<Body> fuck(bodies.size());
         memcpy(fuck.data(), data, sizeof(Body) * bodies.size());
-        vmaUnmapMemory(allocator, computeBuffer.memory);
+        vmaUnmapMemory(allocator, readbackBuffer.memory);
 
         std::cout << glm::to_string(fuck[0].position) << "\n";
         std::cout << glm::to_string(fuck[1].position) << "\n";
         std::cout << glm::to_string(fuck[2].position) << "\n";
     }
 
-    VkCommandBuffer computeCmdBuf;
+    VkCommandBuffer computeCmdBuf = VK_NULL_HANDLE;
+    VkFence computeFence          = VK_NULL_HANDLE;  // Compute() waits on it, so it is never in flight after
+    uint32_t computeProfilerSlot;
 
+    // recorded again when a compute shader is reloaded
     void BuildComputeCommandBuffers()
     {
-        VkCommandBufferAllocateInfo info =
-            dhh::vk::initializer::commandBufferAllocateInfo(commandPool, 1, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
-        vkAllocateCommandBuffers(device, &info, &computeCmdBuf);
+        if (computeCmdBuf == VK_NULL_HANDLE)
+        {
+            computeProfilerSlot = gpuProfiler.allocateSlots(1);
+            VkCommandBufferAllocateInfo info =
+                dhh::vk::initializer::commandBufferAllocateInfo(commandPool, 1, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+            vkAllocateCommandBuffers(device, &info, &computeCmdBuf);
+            VkFenceCreateInfo fenceCreateInfo = dhh::vk::initializer::fenceCreateInfo();
+            vkCreateFence(device, &fenceCreateInfo, nullptr, &computeFence);
+        }
         VkCommandBufferBeginInfo beginInfo =
             dhh::vk::initializer::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
         vkBeginCommandBuffer(computeCmdBuf, &beginInfo);
+        gpuProfiler.reset(computeCmdBuf, computeProfilerSlot);
 
         // calculate
         for (int i = 0; i < 1; ++i)
@@ -271,7 +337,10 @@ public:
             vkCmdBindPipeline(computeCmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, computePipe->pipeline);
             vkCmdBindDescriptorSets(computeCmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, computePipe->pipelineLayout, 0, 1,
                 computePipe->descriptorSets.data(), 0, nullptr);
-            vkCmdDispatch(computeCmdBuf, 1, 1, 1);
+            {
+                dhh::vk::GpuProfiler::Scope scope(gpuProfiler, computeCmdBuf, "nbody.comp", computeProfilerSlot);
+                vkCmdDispatch(computeCmdBuf, 1, 1, 1);
+            }
 
             VkBufferMemoryBarrier barrier = {};
             barrier.buffer                = computeBuffer.buffer;
@@ -292,18 +361,39 @@ public:
             //	VK_NULL_HANDLE, 0, nullptr,
             //	1, &barrier, VK_NULL_HANDLE, nullptr);
         }
+
+        // the bodies stay in device local memory, the host reads a copy
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType                 = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.buffer                = computeBuffer.buffer;
+        barrier.size                  = VK_WHOLE_SIZE;
+        barrier.srcAccessMask         = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask         = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(computeCmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_NULL_HANDLE, 0, nullptr, 1, &barrier, VK_NULL_HANDLE, nullptr);
+
+        VkBufferCopy region = {};
+        region.size         = sizeof(Body) * bodies.size();
+        vkCmdCopyBuffer(computeCmdBuf, computeBuffer.buffer, readbackBuffer.buffer, 1, &region);
+
+        barrier.buffer        = readbackBuffer.buffer;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(computeCmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+            VK_NULL_HANDLE, 0, nullptr, 1, &barrier, VK_NULL_HANDLE, nullptr);
         vkEndCommandBuffer(computeCmdBuf);
     }
 
 
     void createComputeBuffer()
     {
-        createBuffer(sizeof(Body) * bodies.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
-            computeBuffer.buffer, computeBuffer.memory);
-        void* data;
-        vmaMapMemory(allocator, computeBuffer.memory, &data);
-        memcpy(data, bodies.data(), sizeof(Body) * bodies.size());
-        vmaUnmapMemory(allocator, computeBuffer.memory);
+        const VkDeviceSize size = sizeof(Body) * bodies.size();
+        createBuffer(size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY, computeBuffer.buffer, computeBuffer.memory);
+        uploadManager.uploadBuffer(computeBuffer.buffer, bodies.data(), size);
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU, readbackBuffer.buffer,
+            readbackBuffer.memory);
     }
 
     void CreateVertexBuffer()
@@ -315,25 +405,17 @@ public:
         trajectories.resize(100000);
     }
 
-    void CreateComputePipeline()
+    dhh::shader::Pipeline* createComputePipeline(dhh::shader::Shader* computeShader)
     {
-        std::filesystem::path shaders_directory = dhh::shader::findShaderDirectory();
-
-        dhh::shader::Shader computeShader(shaders_directory / "nbody.comp");
-        computePipe = new dhh::shader::Pipeline(device, {&computeShader}, descriptorPool);
-
-        dhh::shader::Shader cacheShader(shaders_directory / "cache.comp");
-        cachePipe = new dhh::shader::Pipeline(device, {&cacheShader}, descriptorPool);
+        return new dhh::shader::Pipeline(
+            device, computeShader, descriptorAllocator, pipelineCache, {}, descriptorIndexingFeatures);
     }
 
-    void createTrianglePipeline()
+    dhh::shader::Pipeline* createTrianglePipeline(
+        dhh::shader::Shader* vertexShader, dhh::shader::Shader* fragmentShader)
     {
-        std::filesystem::path shaders_directory = dhh::shader::findShaderDirectory();
-
-        dhh::shader::Shader vertexShader(shaders_directory / "shader.vert");
-        dhh::shader::Shader fragmentShader(shaders_directory / "shader.frag");
-
-        trianglePipe = new dhh::shader::Pipeline(device, {&vertexShader, &fragmentShader}, descriptorPool, renderPass,
+        vertexShader->setDynamic(0);  // transforms live in the frame allocator
+        return new dhh::shader::Pipeline(device, {vertexShader, fragmentShader}, descriptorAllocator, renderPass,
             dhh::vk::initializer::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT),
             {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR},
             dhh::vk::initializer::pipelineRasterizationStateCreateInfo(
@@ -344,87 +426,45 @@ public:
                                                                         | VK_COLOR_COMPONENT_B_BIT
                                                                         | VK_COLOR_COMPONENT_A_BIT,
                 false),
-            dhh::vk::initializer::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_POINT_LIST));
+            dhh::vk::initializer::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_POINT_LIST),
+            pipelineCache, {}, descriptorIndexingFeatures);
     }
 
 
+    // bodies and trajectories are separate draw groups, recorded in parallel
     void buildCommandBuffers()
     {
-        VkCommandBufferBeginInfo cmdBufInfo = dhh::vk::initializer::commandBufferBeginInfo();
-
-        // Set clear values for all framebuffer attachments with loadOp set to clear
-        // We use two attachments (color and depth) that are cleared at the start of the subpass and as such we need to
-        // set clear values for both
-        std::vector<VkClearValue> clearValues(2);
-        clearValues[0].color        = {{0.0f, 0.0f, 0.2f, 1.0f}};
-        clearValues[1].depthStencil = {1.0f, 0};
-
-        for (int32_t i = 0; i < commandBuffers.size(); ++i)
-        {
-            VkRenderPassBeginInfo renderPassBeginInfo = dhh::vk::initializer::renderPassBeginInfo(
-                clearValues, framebuffers[i], renderPass, windowWidth, windowHeight);
-
-            vkBeginCommandBuffer(commandBuffers[i], &cmdBufInfo);
-
-            // Start the first sub pass specified in our default render pass setup by the base class
-            // This will clear the color and depth attachment
-            vkCmdBeginRenderPass(commandBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-            // Update dynamic viewport state
-            VkViewport viewport = {};
-            viewport.height     = -static_cast<float>(windowHeight);
-            viewport.width      = static_cast<float>(windowWidth);
-            viewport.minDepth   = static_cast<float>(0.0f);
-            viewport.maxDepth   = static_cast<float>(1.0f);
-            viewport.x          = 0;
-            viewport.y          = windowHeight;
-            vkCmdSetViewport(commandBuffers[i], 0, 1, &viewport);
-
-            // Update dynamic scissor state
-            VkRect2D scissor      = {};
-            scissor.extent.width  = windowWidth;
-            scissor.extent.height = windowHeight;
-            scissor.offset.x      = 0;
-            scissor.offset.y      = 0;
-            vkCmdSetScissor(commandBuffers[i], 0, 1, &scissor);
-
-            // Bind descriptor sets describing shader binding points
-            vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipe->pipelineLayout, 0,
-                1, &trianglePipe->descriptorSets[0], 0, nullptr);
-
-            // Bind the rendering pipeline
-            // The pipeline (state object) contains all states of the rendering pipeline, binding it will set all the
-            // states specified at pipeline creation time
-            vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipe->pipeline);
-
-            // Bind triangle vertex buffer (contains position and colors)
+        auto bindPipeline = [this](VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+            const uint32_t transformOffset = frameAllocator.getRegionOffset(imageIndex);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipe->pipelineLayout, 0, 1,
+                &trianglePipe->descriptorSets[0], 1, &transformOffset);
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipe->pipeline);
+        };
+
+        addDrawGroup([this, bindPipeline](VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+            bindPipeline(commandBuffer, imageIndex);
             VkDeviceSize offsets[1] = {0};
-            vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, &vertices.buffer, offsets);
-
-            // Draw indexed triangle
-            vkCmdDraw(commandBuffers[i], bodies.size(), 1, 0, 0);
-
-            // draw trajectory
-            vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, &trajectoryBuffer.buffer, offsets);
-            vkCmdDraw(commandBuffers[i], trajectories.size(), 1, 0, 0);
-
-            vkCmdEndRenderPass(commandBuffers[i]);
-
-            // Ending the render pass will add an implicit barrier transitioning the frame buffer color attachment to
-            // VK_IMAGE_LAYOUT_PRESENT_SRC_KHR for presenting it to the windowing system
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
+            vkCmdDraw(commandBuffer, bodies.size(), 1, 0, 0);
+        });
 
-            vkEndCommandBuffer(commandBuffers[i]);
-        }
+        addDrawGroup([this, bindPipeline](VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+            bindPipeline(commandBuffer, imageIndex);
+            VkDeviceSize offsets[1] = {0};
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &trajectoryBuffer.buffer, offsets);
+            vkCmdDraw(commandBuffer, trajectories.size(), 1, 0, 0);
+        });
     }
 
     void UpdateVertexBuffer()
     {
         const double scale = 1 / 300000000000.f;
         void* data;
-        vmaMapMemory(allocator, computeBuffer.memory, &data);
+        vmaMapMemory(allocator, readbackBuffer.memory, &data);
+        vmaInvalidateAllocation(allocator, readbackBuffer.memory, 0, VK_WHOLE_SIZE);
         std::vector<Body> fuck(bodies.size());
         memcpy(fuck.data(), data, sizeof(Body) * bodies.size());
-        vmaUnmapMemory(allocator, computeBuffer.memory);
+        vmaUnmapMemory(allocator, readbackBuffer.memory);
 
         std::vector<glm::vec3> positions(bodies.size());
         for (int i = 0; i < bodies.size(); ++i)
@@ -450,17 +490,49 @@ int main(int argc, char* argv[])
 {
     try
     {
-        Triangle app;
+        // --headless [frame count] renders offscreen and writes the last frame to nbody.ppm
+        const bool headless = argc > 1 && std::string(argv[1]) == "--headless";
+        Triangle app(headless);
+        if (headless && argc > 2)
+        {
+            app.headlessFrameCount = std::stoul(argv[2]);
+        }
 
         int anchor   = 0;
         double years = 0;
-        while (glfwWindowShouldClose(app.window) != GLFW_TRUE)
+        dhh::trace::FrameTrace& trace = app.frameTrace;
+        while (app.running())
+        {
+            dhh::trace::Zone frame(trace, "frame");
+            {
+                dhh::trace::Zone zone(trace, "beginFrame");
+                app.beginFrame();
+            }
+            {
+                dhh::trace::Zone zone(trace, "updateTransform");
+                app.updateTransform();
+            }
+            {
+                dhh::trace::Zone zone(trace, "UpdateVertexBuffer");
+                app.UpdateVertexBuffer();
+            }
+            {
+                dhh::trace::Zone zone(trace, "endFrame");
+                app.endFrame();
+            }
+            {
+                dhh::trace::Zone zone(trace, "Compute");
+                app.Compute();
+            }
+        }
+
+        // open in chrome://tracing or ui.perfetto.dev
+        trace.exportChromeTrace("nbody_trace.json");
+        app.gpuProfiler.report(std::cout);
+        if (headless)
         {
-            app.updateTransform();
-            app.UpdateVertexBuffer();
-            app.drawFrame();
-            app.Compute();
-            glfwPollEvents();
+            app.saveFrame("nbody.ppm");
+            app.gpuProfiler.appendCsv("nbody_gpu_times.csv");
         }
     }
     catch (std::exception& e)
@@ -8,16 +8,65 @@
 
 #define VMA_IMPLEMENTATION
 #include "VulkanInitializer.hpp"
+#include "VulkanTools.hpp"
 #include "vk_mem_alloc.h"
 
 #include <algorithm>
 #include <array>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <set>
 
+namespace
+{
+    /// Prefix of the pipeline cache file. The driver validates its own header too, but it only knows about the
+    /// cache UUID, so we additionally reject data written by another driver version
+    struct PipelineCacheFileHeader
+    {
+        uint32_t magic;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+    };
+
+    const uint32_t PipelineCacheFileMagic = 0x43505644;  // "DVPC"
+}
+
+VulkanBase::~VulkanBase()
+{
+    vkDeviceWaitIdle(device);
+    // retired pipelines free their descriptor sets, so the reloader goes before the allocators
+    pipelineReloader.destroy();
+    commandRecorder.destroy();
+    gpuProfiler.destroy();
+    uploadManager.destroy();
+    frameAllocator.destroy();
+    for (auto& frameDescriptorAllocator : frameDescriptorAllocators)
+    {
+        frameDescriptorAllocator.destroy();
+    }
+    descriptorAllocator.destroy();
+    if (pipelineCache != VK_NULL_HANDLE)
+    {
+        savePipelineCache();
+        vkDestroyPipelineCache(device, pipelineCache, nullptr);
+    }
+}
+
 void VulkanBase::init()
 {
-    initWindow();
+    initStartTime = std::chrono::high_resolution_clock::now();
+    if (!headless)
+    {
+        initWindow();
+    }
+    else
+    {
+        window = nullptr;
+    }
     initVulkan();
 }
 
@@ -25,9 +74,11 @@ void VulkanBase::initWindow()
 {
     glfwInit();
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
     window = glfwCreateWindow(windowWidth, windowHeight, windowTitle.c_str(), nullptr, nullptr);
+    glfwSetWindowUserPointer(window, this);
+    glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwSetCursorPos(window, windowWidth / 2, windowHeight / 2);
     dhh::input::camera = &camera;
@@ -47,15 +98,28 @@ void VulkanBase::initVulkan()
     findQueueFamilyIndex();
     createLogicalDevice();
     createMemoryAllocator();
-    createSwapchain();
+    createPipelineCache();
+    if (headless)
+    {
+        createOffscreenImages();
+    }
+    else
+    {
+        createSwapchain();
+    }
     createSwapchainImageViews();
     createRenderPass();
     createDepthResources();
     createFramebuffers();
     createCommandPool();
     createSyncObjects();
-    createDescriptorPool();
+    createDescriptorAllocators();
     allocateCommandbuffers();
+    createFrameAllocator();
+    createUploadManager();
+    createGpuProfiler();
+    createCommandRecorder();
+    createPipelineReloader();
 }
 
 void VulkanBase::createInstance()
@@ -169,17 +233,40 @@ void VulkanBase::createLogicalDevice()
     VkPhysicalDeviceFeatures features = {};
     features.shaderFloat64            = VK_FALSE;
     features.fillModeNonSolid         = VK_FALSE;
+
+    std::vector<const char*> extensions;
+    if (!headless)
+    {
+        extensions = deviceExtensions;
+    }
+
+    // bindless tables, the runtime arrays of reflected shaders, need descriptor indexing. Every feature the device
+    // has is enabled
+    descriptorIndexingFeatures       = {};
+    descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+    const bool descriptorIndexingSupported = isDeviceExtensionSupported(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    if (descriptorIndexingSupported)
+    {
+        VkPhysicalDeviceFeatures2 supportedFeatures = {};
+        supportedFeatures.sType                     = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures.pNext                     = &descriptorIndexingFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
+        descriptorIndexingFeatures.pNext = nullptr;
+        extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    }
+
     VkDeviceCreateInfo deviceCreateInfo;
     deviceCreateInfo.sType                   = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.enabledExtensionCount   = static_cast<uint32_t>(deviceExtensions.size());
-    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    deviceCreateInfo.enabledExtensionCount   = static_cast<uint32_t>(extensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = extensions.data();
     deviceCreateInfo.enabledLayerCount       = 0;
     deviceCreateInfo.ppEnabledLayerNames     = nullptr;
     deviceCreateInfo.flags                   = VK_NULL_HANDLE;
     deviceCreateInfo.queueCreateInfoCount    = static_cast<uint32_t>(queueCreateInfos.size());
     deviceCreateInfo.pQueueCreateInfos       = queueCreateInfos.data();
     deviceCreateInfo.pEnabledFeatures        = &features;
-    deviceCreateInfo.pNext                   = nullptr;
+    deviceCreateInfo.pNext                   = descriptorIndexingSupported ? &descriptorIndexingFeatures : nullptr;
 
     vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device);
 
@@ -197,11 +284,96 @@ void VulkanBase::createMemoryAllocator()
     vmaCreateAllocator(&allocatorInfo, &allocator);
 }
 
+void VulkanBase::createPipelineCache()
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    std::vector<char> initialData;
+    if (std::filesystem::exists(pipelineCacheFile))
+    {
+        std::vector<char> file = dhh::filesystem::loadFile(pipelineCacheFile, true);
+        PipelineCacheFileHeader header;
+        if (file.size() >= sizeof(header))
+        {
+            std::memcpy(&header, file.data(), sizeof(header));
+            if (header.magic == PipelineCacheFileMagic && header.vendorID == properties.vendorID
+                && header.deviceID == properties.deviceID && header.driverVersion == properties.driverVersion
+                && std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0
+                && header.dataSize == file.size() - sizeof(header))
+            {
+                initialData.assign(file.begin() + sizeof(header), file.end());
+            }
+            else
+            {
+                std::cout << "Pipeline cache is stale, starting with an empty one\n";
+            }
+        }
+    }
+
+    VkPipelineCacheCreateInfo info = {};
+    info.sType                     = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    info.initialDataSize           = initialData.size();
+    info.pInitialData              = initialData.empty() ? nullptr : initialData.data();
+
+    if (vkCreatePipelineCache(device, &info, nullptr, &pipelineCache) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+    std::cout << "Pipeline cache loaded: " << initialData.size() << " bytes\n";
+}
+
+void VulkanBase::savePipelineCache()
+{
+    size_t dataSize = 0;
+    vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    PipelineCacheFileHeader header = {};
+    header.magic                   = PipelineCacheFileMagic;
+    header.vendorID                = properties.vendorID;
+    header.deviceID                = properties.deviceID;
+    header.driverVersion           = properties.driverVersion;
+    header.dataSize                = dataSize;
+    std::memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+    std::vector<char> file(sizeof(header) + dataSize);
+    vkGetPipelineCacheData(device, pipelineCache, &dataSize, file.data() + sizeof(header));
+    header.dataSize = dataSize;
+    std::memcpy(file.data(), &header, sizeof(header));
+    file.resize(sizeof(header) + dataSize);
+
+    try
+    {
+        dhh::filesystem::writeFile(pipelineCacheFile, file.data(), file.size());
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Failed to save pipeline cache: " << e.what() << "\n";
+    }
+}
+
 void VulkanBase::createSwapchain()
 {
     vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
     surfaceFormat = chooseSurfaceFormat();
 
+    // the surface may leave the size to the swapchain, then it follows the framebuffer
+    VkExtent2D extent = surfaceCapabilities.currentExtent;
+    if (extent.width == UINT32_MAX)
+    {
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        extent.width  = std::clamp(static_cast<uint32_t>(width), surfaceCapabilities.minImageExtent.width,
+            surfaceCapabilities.maxImageExtent.width);
+        extent.height = std::clamp(static_cast<uint32_t>(height), surfaceCapabilities.minImageExtent.height,
+            surfaceCapabilities.maxImageExtent.height);
+    }
+    windowWidth  = extent.width;
+    windowHeight = extent.height;
+
     VkSwapchainCreateInfoKHR swapchainCreateInfo;
     swapchainCreateInfo.sType                 = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
     swapchainCreateInfo.pNext                 = nullptr;
@@ -210,7 +382,7 @@ void VulkanBase::createSwapchain()
     swapchainCreateInfo.minImageCount         = 3;
     swapchainCreateInfo.imageFormat           = surfaceFormat.format;
     swapchainCreateInfo.imageColorSpace       = surfaceFormat.colorSpace;
-    swapchainCreateInfo.imageExtent           = surfaceCapabilities.currentExtent;
+    swapchainCreateInfo.imageExtent           = extent;
     swapchainCreateInfo.imageArrayLayers      = 1;
     swapchainCreateInfo.imageUsage            = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
     swapchainCreateInfo.imageSharingMode      = VK_SHARING_MODE_EXCLUSIVE;
@@ -220,16 +392,36 @@ void VulkanBase::createSwapchain()
     swapchainCreateInfo.compositeAlpha        = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     swapchainCreateInfo.presentMode           = choosePresentMode();
     swapchainCreateInfo.clipped               = VK_TRUE;
-    swapchainCreateInfo.oldSwapchain          = nullptr;
+    swapchainCreateInfo.oldSwapchain          = swapchain;
 
     vkCreateSwapchainKHR(device, &swapchainCreateInfo, nullptr, &swapchain);
 
     uint32_t imageCount;
     vkGetSwapchainImagesKHR(device, swapchain, &imageCount, nullptr);
+    if (imageCount > MAX_SWAPCHAIN_IMAGES)
+    {
+        throw std::runtime_error("Swapchain has more than MAX_SWAPCHAIN_IMAGES images");
+    }
     swapchainImages.resize(imageCount);
     vkGetSwapchainImagesKHR(device, swapchain, &imageCount, swapchainImages.data());
 }
 
+// Stand-ins for the swapchain images in headless mode, so framebuffers and command buffers are built the same way
+void VulkanBase::createOffscreenImages()
+{
+    surfaceFormat = chooseSurfaceFormat();
+
+    const uint32_t imageCount = 3;
+    swapchainImages.resize(imageCount);
+    offscreenImageAllocations.resize(imageCount);
+    for (uint32_t i = 0; i < imageCount; i++)
+    {
+        createImage(windowWidth, windowHeight, 1, VK_SAMPLE_COUNT_1_BIT, surfaceFormat.format, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
+            swapchainImages[i], offscreenImageAllocations[i]);
+    }
+}
+
 void VulkanBase::createSwapchainImageViews()
 {
     swapchainImageViews.resize(swapchainImages.size());
@@ -245,7 +437,7 @@ void VulkanBase::createRenderPass()
     VkAttachmentDescription colorAttachment;
     colorAttachment.format         = surfaceFormat.format;
     colorAttachment.initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout    = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    colorAttachment.finalLayout    = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
     colorAttachment.flags          = VK_NULL_HANDLE;
     colorAttachment.samples        = VK_SAMPLE_COUNT_1_BIT;
     colorAttachment.loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
@@ -339,6 +531,7 @@ void VulkanBase::createCommandPool()
 {
     VkCommandPoolCreateInfo poolInfo = {};
     poolInfo.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags                   = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
     poolInfo.queueFamilyIndex        = queueFamilyIndex.graphicsFamily.value();
 
     if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
@@ -352,6 +545,7 @@ void VulkanBase::createSyncObjects()
     imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    imagesInFlight.resize(swapchainImages.size(), VK_NULL_HANDLE);
 
     VkSemaphoreCreateInfo semaphoreInfo = {};
     semaphoreInfo.sType                 = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -372,30 +566,22 @@ void VulkanBase::createSyncObjects()
 }
 
 
-void VulkanBase::createDescriptorPool()
+void VulkanBase::createDescriptorAllocators()
 {
-    std::vector<VkDescriptorPoolSize> poolSizes = {
-        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
-        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1},
-    };
-
-    VkDescriptorPoolCreateInfo poolCreateInfo;
-    poolCreateInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolCreateInfo.pNext         = nullptr;
-    poolCreateInfo.flags         = VK_NULL_HANDLE;
-    poolCreateInfo.maxSets       = static_cast<uint32_t>(swapchainImages.size());
-    poolCreateInfo.poolSizeCount = poolSizes.size();
-    poolCreateInfo.pPoolSizes    = poolSizes.data();
-
-    vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool);
+    descriptorAllocator.create(device);
+    frameDescriptorAllocators = std::vector<dhh::vk::DescriptorAllocator>(swapchainImages.size());
+    for (auto& frameDescriptorAllocator : frameDescriptorAllocators)
+    {
+        frameDescriptorAllocator.create(device, 16);
+    }
 }
 
 void VulkanBase::allocateCommandbuffers()
 {
-    commandBuffers.resize(3);
+    commandBuffers.resize(swapchainImages.size());
 
-    VkCommandBufferAllocateInfo info =
-        dhh::vk::initializer::commandBufferAllocateInfo(commandPool, 3, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+    VkCommandBufferAllocateInfo info = dhh::vk::initializer::commandBufferAllocateInfo(
+        commandPool, static_cast<uint32_t>(commandBuffers.size()), VK_COMMAND_BUFFER_LEVEL_PRIMARY);
     vkAllocateCommandBuffers(device, &info, commandBuffers.data());
 }
 
@@ -420,57 +606,453 @@ VkPresentModeKHR VulkanBase::choosePresentMode()
     }
 }
 
-void VulkanBase::createUniformBuffer(VkDeviceSize bufferSize)
+void VulkanBase::createFrameAllocator()
 {
-    uniformBuffers.resize(swapchainImages.size());
-    uniformBufferAllocation.resize(swapchainImages.size());
-    for (size_t i = 0; i < swapchainImages.size(); i++)
+    frameAllocator.create(allocator, physicalDevice, frameAllocatorRegionSize, MAX_SWAPCHAIN_IMAGES);
+}
+
+void VulkanBase::createUploadManager()
+{
+    uploadManager.create(device, allocator, transferQueue, queueFamilyIndex.transferFamily.value(), graphicsQueue,
+        queueFamilyIndex.graphicsFamily.value());
+}
+
+void VulkanBase::createGpuProfiler()
+{
+    gpuProfiler.create(device, physicalDevice, queueFamilyIndex.graphicsFamily.value());
+    frameProfilerSlot = gpuProfiler.allocateSlots(MAX_SWAPCHAIN_IMAGES);
+    // GPU times arrive a few frames late, they show up as counters at the time they were read
+    gpuProfiler.setSampleCallback(
+        [this](const std::string& scope, double milliseconds) { frameTrace.counter(scope.c_str(), milliseconds); });
+}
+
+void VulkanBase::createCommandRecorder()
+{
+    commandRecorder.create(device, queueFamilyIndex.graphicsFamily.value(),
+        static_cast<uint32_t>(swapchainImages.size()), threadPool);
+}
+
+// Hot reload is for tuning shaders while the window is open, headless runs keep the shaders they started with
+void VulkanBase::createPipelineReloader()
+{
+    if (!headless)
     {
-        createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, uniformBuffers[i],
-            uniformBufferAllocation[i]);
+        pipelineReloader.create(dhh::shader::findShaderDirectory());
     }
 }
 
-void VulkanBase::drawFrame()
+// The secondary command buffer comes with the viewport and scissor set, dynamic state is not inherited from the
+// primary
+uint32_t VulkanBase::addDrawGroup(dhh::vk::CommandRecorder::RecordFunction record)
 {
-    vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
-    vkResetFences(device, 1, &inFlightFences[currentFrame]);
+    return commandRecorder.addDrawGroup([this, record](VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+        VkViewport viewport = {};
+        viewport.height     = -static_cast<float>(windowHeight);
+        viewport.width      = static_cast<float>(windowWidth);
+        viewport.minDepth   = 0.0f;
+        viewport.maxDepth   = 1.0f;
+        viewport.x          = 0;
+        viewport.y          = static_cast<float>(windowHeight);
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+        VkRect2D scissor      = {};
+        scissor.extent.width  = windowWidth;
+        scissor.extent.height = windowHeight;
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+        record(commandBuffer, imageIndex);
+    });
+}
+
+// Re-record the dirty draw groups of the image and the primary that executes them, a no-op when nothing changed
+void VulkanBase::recordFrame(uint32_t imageIndex)
+{
+    if (!commandRecorder.isDirty(imageIndex))
+    {
+        return;
+    }
+
+    VkCommandBufferInheritanceInfo inheritance = {};
+    inheritance.sType                          = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance.renderPass                     = renderPass;
+    inheritance.subpass                        = 0;
+    inheritance.framebuffer                    = framebuffers[imageIndex];
+    commandRecorder.record(imageIndex, inheritance);
+
+    std::vector<VkClearValue> clearValues(2);
+    clearValues[0].color        = clearColor;
+    clearValues[1].depthStencil = {1.0f, 0};
+
+    VkRenderPassBeginInfo renderPassBeginInfo = dhh::vk::initializer::renderPassBeginInfo(
+        clearValues, framebuffers[imageIndex], renderPass, windowWidth, windowHeight);
+
+    VkCommandBuffer commandBuffer      = commandBuffers[imageIndex];
+    VkCommandBufferBeginInfo beginInfo = dhh::vk::initializer::commandBufferBeginInfo();
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    // the primary is submitted again until a group gets dirty, it resets its own queries every time
+    gpuProfiler.reset(commandBuffer, frameProfilerSlot + imageIndex);
+    {
+        dhh::vk::GpuProfiler::Scope scope(gpuProfiler, commandBuffer, "render pass", frameProfilerSlot + imageIndex);
+        vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        const std::vector<VkCommandBuffer>& secondaries = commandRecorder.getCommandBuffers(imageIndex);
+        if (!secondaries.empty())
+        {
+            vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+        }
+        vkCmdEndRenderPass(commandBuffer);
+    }
+    vkEndCommandBuffer(commandBuffer);
+}
+
+void VulkanBase::framebufferResizeCallback(GLFWwindow* window, int width, int height)
+{
+    static_cast<VulkanBase*>(glfwGetWindowUserPointer(window))->framebufferResized = true;
+}
 
-    uint32_t imageIndex;
-    vkAcquireNextImageKHR(
-        device, swapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+// Build the new swapchain from the old one, together with the attachments that depend on its size. The frames in flight
+// may still use the old objects, so they are retired instead of destroyed. Pipelines are kept, their viewport is
+// dynamic, and only the command buffers are recorded again
+void VulkanBase::recreateSwapchain()
+{
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(window, &width, &height);
+    while (width == 0 || height == 0)
+    {
+        // minimized, there is nothing to present to
+        glfwWaitEvents();
+        glfwGetFramebufferSize(window, &width, &height);
+    }
+
+    RetiredSwapchain retired;
+    retired.frameNumber          = frameNumber;
+    retired.swapchain            = swapchain;
+    retired.imageViews           = swapchainImageViews;
+    retired.framebuffers         = framebuffers;
+    retired.depthImage           = depthImage;
+    retired.depthImageAllocation = depthImageAllocation;
+    retired.depthImageView       = depthImageView;
+    retiredSwapchains.push_back(retired);
+
+    const size_t imageCount = swapchainImages.size();
+    createSwapchain();
+    createSwapchainImageViews();
+    createDepthResources();
+    createFramebuffers();
+    if (swapchainImages.size() != imageCount)
+    {
+        resizePerImageState();
+    }
+    commandRecorder.markAllDirty();
+    framebufferResized = false;
+}
+
+// The driver may return another image count for the new swapchain. Everything indexed by image index follows it, the
+// frame allocator and the profiler have room for MAX_SWAPCHAIN_IMAGES from the start
+void VulkanBase::resizePerImageState()
+{
+    vkDeviceWaitIdle(device);
+    const uint32_t imageCount = static_cast<uint32_t>(swapchainImages.size());
+
+    vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+    allocateCommandbuffers();
+    imagesInFlight.assign(imageCount, VK_NULL_HANDLE);
+    for (auto& frameDescriptorAllocator : frameDescriptorAllocators)
+    {
+        frameDescriptorAllocator.destroy();
+    }
+    frameDescriptorAllocators = std::vector<dhh::vk::DescriptorAllocator>(imageCount);
+    for (auto& frameDescriptorAllocator : frameDescriptorAllocators)
+    {
+        frameDescriptorAllocator.create(device, 16);
+    }
+    commandRecorder.resize(imageCount);
+}
+
+void VulkanBase::destroyRetiredSwapchains()
+{
+    // frames finish in order, and frame frameNumber - MAX_FRAMES_IN_FLIGHT is done once beginFrame waited its fence
+    auto finished = [this](const RetiredSwapchain& retired) {
+        return frameNumber + 1 >= retired.frameNumber + MAX_FRAMES_IN_FLIGHT;
+    };
+    for (const RetiredSwapchain& retired : retiredSwapchains)
+    {
+        if (!finished(retired))
+        {
+            continue;
+        }
+        for (VkFramebuffer framebuffer : retired.framebuffers)
+        {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+        for (VkImageView imageView : retired.imageViews)
+        {
+            vkDestroyImageView(device, imageView, nullptr);
+        }
+        vkDestroyImageView(device, retired.depthImageView, nullptr);
+        vmaDestroyImage(allocator, retired.depthImage, retired.depthImageAllocation);
+        vkDestroySwapchainKHR(device, retired.swapchain, nullptr);
+    }
+    retiredSwapchains.erase(std::remove_if(retiredSwapchains.begin(), retiredSwapchains.end(), finished),
+        retiredSwapchains.end());
+}
+
+// An image is recorded again only after the fence of its last submission signaled. Once no image is dirty, every
+// frame that used a replaced pipeline has finished
+void VulkanBase::destroyRetiredPipelines()
+{
+    if (!pipelineReloader.hasRetired())
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < swapchainImages.size(); i++)
+    {
+        if (commandRecorder.isDirty(i))
+        {
+            return;
+        }
+    }
+    pipelineReloader.destroyRetired();
+}
+
+bool VulkanBase::running()
+{
+    if (headless)
+    {
+        return frameNumber < headlessFrameCount;
+    }
+    glfwPollEvents();
+    return glfwWindowShouldClose(window) != GLFW_TRUE;
+}
+
+// Wait until the image and its command buffer and frame allocator region are no longer used by the GPU. Per frame
+// uniform data goes through frameAllocator between beginFrame and endFrame
+uint32_t VulkanBase::beginFrame()
+{
+    frameTrace.setFrame(frameNumber);
+    {
+        dhh::trace::Zone zone(frameTrace, "wait frame fence");
+        vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    }
+
+    // offscreen images are used round robin
+    uint32_t imageIndex = static_cast<uint32_t>(frameNumber % swapchainImages.size());
+    if (!headless)
+    {
+        destroyRetiredSwapchains();
+        dhh::trace::Zone zone(frameTrace, "acquire");
+        while (vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame],
+                   VK_NULL_HANDLE, &imageIndex)
+               == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            recreateSwapchain();
+        }
+    }
+
+    // the acquired image may still be rendered by an earlier frame than the one the fence above belongs to
+    if (imagesInFlight[imageIndex] != VK_NULL_HANDLE)
+    {
+        dhh::trace::Zone zone(frameTrace, "wait image fence");
+        vkWaitForFences(device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+    }
+    imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+    gpuProfiler.collect(frameProfilerSlot + imageIndex);
+
+    // nothing is recorded for this frame yet, the draw groups pick up the new pipelines when they are recorded again
+    if (pipelineReloader.update())
+    {
+        commandRecorder.markAllDirty();
+    }
+
+    frameAllocator.beginFrame(imageIndex);
+    frameDescriptorAllocators[imageIndex].reset();
+    currentImageIndex = imageIndex;
+    return imageIndex;
+}
+
+void VulkanBase::endFrame()
+{
+    const uint32_t imageIndex = currentImageIndex;
+    frameAllocator.flush();
+    {
+        // uploads queued since the last frame are acquired on the graphics queue before this frame's work
+        dhh::trace::Zone zone(frameTrace, "flush uploads");
+        uploadManager.flush();
+    }
+    {
+        dhh::trace::Zone zone(frameTrace, "record");
+        recordFrame(imageIndex);
+    }
+    destroyRetiredPipelines();
+    vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
     VkSubmitInfo submitInfo = {};
     submitInfo.sType        = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
     VkSemaphore waitSemaphores[]      = {imageAvailableSemaphores[currentFrame]};
     VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount     = 1;
+    submitInfo.waitSemaphoreCount     = headless ? 0 : 1;
     submitInfo.pWaitSemaphores        = waitSemaphores;
     submitInfo.pWaitDstStageMask      = waitStages;
     submitInfo.commandBufferCount     = 1;
     submitInfo.pCommandBuffers        = &commandBuffers[imageIndex];
 
     VkSemaphore signalSemaphores[]  = {renderFinishedSemaphores[currentFrame]};
-    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.signalSemaphoreCount = headless ? 0 : 1;
     submitInfo.pSignalSemaphores    = signalSemaphores;
 
-    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
     {
-        throw std::runtime_error("failed to submit draw command buffer!");
+        dhh::trace::Zone zone(frameTrace, "submit");
+        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to submit draw command buffer!");
+        }
     }
+    gpuProfiler.submitted(frameProfilerSlot + imageIndex);
 
-    VkPresentInfoKHR presentInfo   = {};
-    presentInfo.sType              = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores    = signalSemaphores;
-    presentInfo.swapchainCount     = 1;
-    presentInfo.pSwapchains        = &swapchain;
-    presentInfo.pImageIndices      = &imageIndex;
+    if (!headless)
+    {
+        VkPresentInfoKHR presentInfo   = {};
+        presentInfo.sType              = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        presentInfo.waitSemaphoreCount = 1;
+        presentInfo.pWaitSemaphores    = signalSemaphores;
+        presentInfo.swapchainCount     = 1;
+        presentInfo.pSwapchains        = &swapchain;
+        presentInfo.pImageIndices      = &imageIndex;
+
+        dhh::trace::Zone zone(frameTrace, "present");
+        const VkResult result = vkQueuePresentKHR(presentQueue, &presentInfo);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+        {
+            framebufferResized = true;
+        }
+    }
+    lastImageIndex = imageIndex;
+    frameNumber++;
 
-    vkQueuePresentKHR(presentQueue, &presentInfo);
+    if (!startupTimeReported)
+    {
+        // delete pipelineCacheFile to measure a cold start
+        std::cout << "Startup time: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::high_resolution_clock::now() - initStartTime)
+                         .count()
+                  << " ms\n";
+        startupTimeReported = true;
+    }
 
     currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+
+    // after frameNumber moved on, the frame just submitted is the last one to use the old swapchain
+    if (framebufferResized)
+    {
+        recreateSwapchain();
+    }
+}
+
+void VulkanBase::drawFrame()
+{
+    beginFrame();
+    endFrame();
+}
+
+// Copy the most recently rendered offscreen image to host memory, tightly packed in surfaceFormat (BGRA8)
+std::vector<uint8_t> VulkanBase::readbackFrame()
+{
+    if (!headless)
+    {
+        throw std::runtime_error("Frame readback needs headless mode");
+    }
+    if (frameNumber == 0)
+    {
+        throw std::runtime_error("No frame has been rendered yet");
+    }
+
+    const VkDeviceSize size = static_cast<VkDeviceSize>(windowWidth) * windowHeight * 4;
+    VkBuffer buffer;
+    VmaAllocation allocation;
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU, buffer, allocation);
+
+    VkCommandBuffer commandBuffer;
+    VkCommandBufferAllocateInfo allocateInfo =
+        dhh::vk::initializer::commandBufferAllocateInfo(commandPool, 1, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+    vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer);
+    VkCommandBufferBeginInfo beginInfo =
+        dhh::vk::initializer::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    // the render pass already left the image in TRANSFER_SRC_OPTIMAL, only the color writes need to be made visible
+    VkImageMemoryBarrier imageBarrier            = {};
+    imageBarrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask                   = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    imageBarrier.dstAccessMask                   = VK_ACCESS_TRANSFER_READ_BIT;
+    imageBarrier.oldLayout                       = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.newLayout                       = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image                           = swapchainImages[lastImageIndex];
+    imageBarrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageBarrier.subresourceRange.baseMipLevel   = 0;
+    imageBarrier.subresourceRange.levelCount     = 1;
+    imageBarrier.subresourceRange.baseArrayLayer = 0;
+    imageBarrier.subresourceRange.layerCount     = 1;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+    VkBufferImageCopy region           = {};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent                 = {windowWidth, windowHeight, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, swapchainImages[lastImageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        buffer, 1, &region);
+
+    VkBufferMemoryBarrier bufferBarrier = {};
+    bufferBarrier.sType                 = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    bufferBarrier.srcAccessMask         = VK_ACCESS_TRANSFER_WRITE_BIT;
+    bufferBarrier.dstAccessMask         = VK_ACCESS_HOST_READ_BIT;
+    bufferBarrier.srcQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.dstQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.buffer                = buffer;
+    bufferBarrier.size                  = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+        &bufferBarrier, 0, nullptr);
+    vkEndCommandBuffer(commandBuffer);
+
+    VkSubmitInfo submitInfo       = {};
+    submitInfo.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers    = &commandBuffer;
+    VK_CHECK_RESULT(vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));
+    vkQueueWaitIdle(graphicsQueue);
+
+    std::vector<uint8_t> pixels(size);
+    void* data;
+    vmaMapMemory(allocator, allocation, &data);
+    vmaInvalidateAllocation(allocator, allocation, 0, VK_WHOLE_SIZE);
+    std::memcpy(pixels.data(), data, size);
+    vmaUnmapMemory(allocator, allocation);
+
+    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    vmaDestroyBuffer(allocator, buffer, allocation);
+    return pixels;
+}
+
+// Write the last frame as a binary PPM, easy to diff against a reference image
+void VulkanBase::saveFrame(const std::string& filename)
+{
+    const std::vector<uint8_t> pixels = readbackFrame();
+
+    std::ofstream file(filename, std::ios::out | std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open " + filename);
+    }
+    file << "P6\n" << windowWidth << " " << windowHeight << "\n255\n";
+    for (size_t i = 0; i < pixels.size(); i += 4)
+    {
+        const char rgb[3] = {static_cast<char>(pixels[i + 2]), static_cast<char>(pixels[i + 1]),
+            static_cast<char>(pixels[i])};
+        file.write(rgb, 3);
+    }
 }
 
 VkBool32 VulkanBase::debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -481,11 +1063,31 @@ VkBool32 VulkanBase::debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messag
     return VK_FALSE;
 }
 
+bool VulkanBase::isDeviceExtensionSupported(const char* extension)
+{
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> properties(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, properties.data());
+    for (const auto& property : properties)
+    {
+        if (std::strcmp(property.extensionName, extension) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 std::vector<const char*> VulkanBase::getRequiredExtensions()
 {
-    uint32_t extensionCount             = 0;
-    const char** glfwRequiredExtensions = glfwGetRequiredInstanceExtensions(&extensionCount);
-    std::vector<const char*> requiredExtensions(glfwRequiredExtensions, glfwRequiredExtensions + extensionCount);
+    std::vector<const char*> requiredExtensions;
+    if (!headless)
+    {
+        uint32_t extensionCount             = 0;
+        const char** glfwRequiredExtensions = glfwGetRequiredInstanceExtensions(&extensionCount);
+        requiredExtensions.assign(glfwRequiredExtensions, glfwRequiredExtensions + extensionCount);
+    }
 
     if (enableValidation)
     {
@@ -496,7 +1098,12 @@ std::vector<const char*> VulkanBase::getRequiredExtensions()
 
 std::vector<const char*> VulkanBase::getRequiredLayers()
 {
-    std::vector<const char*> requiredLayers(extraLayers);
+    // the monitor layer draws into the window title, and is usually not installed on headless machines
+    std::vector<const char*> requiredLayers;
+    if (!headless)
+    {
+        requiredLayers = extraLayers;
+    }
     if (enableValidation)
     {
         requiredLayers.push_back("VK_LAYER_KHRONOS_validation");
@@ -521,30 +1128,50 @@ void VulkanBase::findQueueFamilyIndex()
         }
     }
 
-    // Get window surface from GLFW
-    glfwCreateWindowSurface(instance, window, nullptr, &surface);
-
-    /// Find queue family that support presentation
-    VkBool32 presentSupport;
-    for (size_t i = 0; i < queueFamilyProperties.size(); i++)
+    if (headless)
+    {
+        // nothing is presented, the graphics queue stands in so the rest of the setup stays the same
+        queueFamilyIndex.presentFamily = queueFamilyIndex.graphicsFamily;
+    }
+    else
     {
-        vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, static_cast<uint32_t>(i), surface, &presentSupport);
-        if (presentSupport)
+        // Get window surface from GLFW
+        glfwCreateWindowSurface(instance, window, nullptr, &surface);
+
+        /// Find queue family that support presentation
+        VkBool32 presentSupport;
+        for (size_t i = 0; i < queueFamilyProperties.size(); i++)
         {
-            queueFamilyIndex.presentFamily = i;
-            break;
+            vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, static_cast<uint32_t>(i), surface, &presentSupport);
+            if (presentSupport)
+            {
+                queueFamilyIndex.presentFamily = i;
+                break;
+            }
         }
     }
 
-    /// Find Transfer queue family index
+    /// Find Transfer queue family index, prefer a dedicated one (usually the DMA engine)
     for (size_t i = 0; i < queueFamilyProperties.size(); i++)
     {
-        if (queueFamilyProperties[i].queueFlags & VK_QUEUE_TRANSFER_BIT)
+        const VkQueueFlags flags = queueFamilyProperties[i].queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
         {
             queueFamilyIndex.transferFamily = i;
             break;
         }
     }
+    if (!queueFamilyIndex.transferFamily.has_value())
+    {
+        for (size_t i = 0; i < queueFamilyProperties.size(); i++)
+        {
+            if (queueFamilyProperties[i].queueFlags & VK_QUEUE_TRANSFER_BIT)
+            {
+                queueFamilyIndex.transferFamily = i;
+                break;
+            }
+        }
+    }
 
     if (!queueFamilyIndex.isComplete())
     {
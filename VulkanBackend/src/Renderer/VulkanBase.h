@@ -1,10 +1,19 @@
 #pragma once
 
 #include <Camera.hpp>
+#include <CommandRecorder.hpp>
+#include <DescriptorAllocator.hpp>
+#include <FrameAllocator.hpp>
+#include <FrameTrace.hpp>
+#include <GpuProfiler.hpp>
+#include <PipelineReloader.hpp>
+#include <ThreadPool.hpp>
+#include <UploadManager.hpp>
 #define GLFW_INCLUDE_NONE
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <vk_mem_alloc.h>
+#include <chrono>
 #include <string>
 #include <vector>
 #include <optional>
@@ -30,6 +39,8 @@ const std::vector<const char*> extraLayers = {
 };
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
+// frame allocator regions and profiler slots are bound by the apps, so they are reserved for this many images up front
+const uint32_t MAX_SWAPCHAIN_IMAGES = 8;
 
 class VulkanBase
 {
@@ -42,6 +53,9 @@ public:
 	const uint32_t appVersion = VK_MAKE_VERSION(0, 0, 1);
 	const uint32_t engineVersion = VK_MAKE_VERSION(0, 0, 1);
 	bool enableValidation = true;
+	// render into offscreen images instead of a window, for machines without a display (lavapipe on CI)
+	bool headless = false;
+	uint32_t headlessFrameCount = 100;
 	QueueFamilyIndex queueFamilyIndex;
 
 private:
@@ -53,7 +67,7 @@ public:
 	VkPhysicalDevice physicalDevice;
 	VkDevice device;
 	VkSurfaceKHR surface;
-	VkSwapchainKHR swapchain;
+	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
 	std::vector<VkImage> swapchainImages;
 	std::vector<VkImageView> swapchainImageViews;
 	VkRenderPass renderPass;
@@ -72,30 +86,56 @@ public:
 	std::vector<VkSemaphore> imageAvailableSemaphores;
 	std::vector<VkSemaphore> renderFinishedSemaphores;
 	std::vector<VkFence> inFlightFences;
+	std::vector<VkFence> imagesInFlight;
 	VkPipeline pipeline;
 	VkPipelineLayout pipelineLayout;
 	std::vector<VkCommandBuffer> commandBuffers;
+	// draw groups recorded into secondaries, the primaries are recorded again when a group is dirty
+	dhh::vk::CommandRecorder commandRecorder;
+	dhh::thread::ThreadPool threadPool;
+	// pipelines rebuilt on the thread pool when their shaders are saved, swapped in beginFrame
+	dhh::shader::PipelineReloader pipelineReloader;
+	VkClearColorValue clearColor = {{0.0f, 0.0f, 0.2f, 1.0f}};
 	VkQueue graphicsQueue;
 	VkQueue transferQueue;
 	VkQueue presentQueue;
 	VkDescriptorSetLayout descriptorSetLayout;
-	VkDescriptorPool descriptorPool;
+	dhh::vk::DescriptorAllocator descriptorAllocator;
+	// transient sets, one allocator per swapchain image, reset in beginFrame
+	std::vector<dhh::vk::DescriptorAllocator> frameDescriptorAllocators;
 	std::vector<VkDescriptorSet> descriptorSets;
-	std::vector<VkBuffer> uniformBuffers;
-	std::vector<VmaAllocation> uniformBufferAllocation;
+	// transient per frame uniform data, one region per swapchain image
+	dhh::vk::FrameAllocator frameAllocator;
+	VkDeviceSize frameAllocatorRegionSize = 64 * 1024;
+	// static data goes to DEVICE_LOCAL memory through staging on the transfer queue
+	dhh::vk::UploadManager uploadManager;
+	// GPU time of the render pass and of the passes the apps scope, one profiler slot per swapchain image
+	dhh::vk::GpuProfiler gpuProfiler;
+	uint32_t frameProfilerSlot = 0;
+	// CPU stages, fence waits, acquire/present and GPU times of every frame, exported as a Chrome trace
+	dhh::trace::FrameTrace frameTrace;
 	size_t currentFrame = 0;
+	uint32_t currentImageIndex = 0;
+	uint64_t frameNumber = 0;
 	dhh::camera::Camera camera;
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+	std::string pipelineCacheFile = "pipeline_cache.bin";
+	// enabled descriptor indexing features, passed to pipelines so bindless tables are only built where supported
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
 	
 
 public:
 
 
-	explicit VulkanBase(bool enableValidation)
-		: enableValidation(enableValidation)
+	explicit VulkanBase(bool enableValidation, bool headless = false)
+		: enableValidation(enableValidation), headless(headless)
 	{
 	}
 
+	virtual ~VulkanBase();
+
 	void init();
+	void savePipelineCache();
 
 private:
 	void initWindow();
@@ -108,20 +148,58 @@ private:
 	void findQueueFamilyIndex();
 	void createLogicalDevice();
 	void createMemoryAllocator();
+	void createPipelineCache();
 	void createSwapchain();
+	void createOffscreenImages();
 	void createSwapchainImageViews();
 	void createRenderPass();
 	void createDepthResources();
 	void createFramebuffers();
 	void createCommandPool();
 	void createSyncObjects();
-	void createDescriptorPool();
+	void createDescriptorAllocators();
 	void allocateCommandbuffers();
+	void createFrameAllocator();
+	void createUploadManager();
+	void createGpuProfiler();
+	void createCommandRecorder();
+	void createPipelineReloader();
+	void recordFrame(uint32_t imageIndex);
+	void destroyRetiredPipelines();
 	VkPresentModeKHR choosePresentMode();
 
+	std::chrono::high_resolution_clock::time_point initStartTime;
+	bool startupTimeReported = false;
+	std::vector<VmaAllocation> offscreenImageAllocations;
+	uint32_t lastImageIndex = 0;
+
+	// what a replaced swapchain leaves behind, destroyed once the frames that used it have finished
+	struct RetiredSwapchain
+	{
+		uint64_t frameNumber;  // first frame that no longer uses it
+		VkSwapchainKHR swapchain;
+		std::vector<VkImageView> imageViews;
+		std::vector<VkFramebuffer> framebuffers;
+		VkImage depthImage;
+		VmaAllocation depthImageAllocation;
+		VkImageView depthImageView;
+	};
+	std::vector<RetiredSwapchain> retiredSwapchains;
+	bool framebufferResized = false;
+
+	static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
+	void recreateSwapchain();
+	void resizePerImageState();
+	void destroyRetiredSwapchains();
+
 public:
+	bool running();
+	uint32_t beginFrame();
+	void endFrame();
 	void drawFrame();
-	void createUniformBuffer(VkDeviceSize bufferSize);
+	std::vector<uint8_t> readbackFrame();
+	void saveFrame(const std::string& filename);
+	uint32_t addDrawGroup(dhh::vk::CommandRecorder::RecordFunction record);
 
 protected:
 	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
@@ -130,6 +208,7 @@ protected:
 		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
 		void* pUserData);
 	std::vector<const char*> getRequiredExtensions();
+	bool isDeviceExtensionSupported(const char* extension);
 	std::vector<const char*> getRequiredLayers();
 	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlagBits aspectFlags, uint32_t mipLevels);
 	VkSurfaceFormatKHR chooseSurfaceFormat();
@@ -45,12 +45,6 @@ class Triangle : public VulkanBase
         VkBuffer buffer;
     } computeBuffer;
 
-    struct
-    {
-        VmaAllocation memory;
-        VkBuffer buffer;
-    } cameraBuffer;
-
 public:
     dhh::shader::Pipeline* trianglePipe;
     dhh::shader::Pipeline* computePipe;
@@ -58,7 +52,7 @@ public:
     dhh::camera::Camera camera;
 
 
-    Triangle() : VulkanBase(true)
+    explicit Triangle(bool headless) : VulkanBase(true, headless)
     {
         dhh::input::camera = &camera;
         init();
@@ -67,7 +61,7 @@ public:
         CreateVertexBuffer();
         createIndexBuffer();
         createComputeBuffer();
-        CreateCameraBuffer();
+        uploadManager.flush();
         WriteGraphicsDescriptorSet();
         buildCommandBuffers();
         writeComputeDescriptorSet();
@@ -78,20 +72,14 @@ public:
     void WriteGraphicsDescriptorSet()
     {
         VkDescriptorBufferInfo bufferInfo =
-            dhh::vk::initializer::descriptorBufferInfo(cameraBuffer.buffer, 0, VK_WHOLE_SIZE);
+            dhh::vk::initializer::descriptorBufferInfo(frameAllocator.buffer, 0, sizeof(Transforms));
 
         VkWriteDescriptorSet write = dhh::vk::initializer::writeDescriptorSet(
-            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, 0, trianglePipe->descriptorSets[0], &bufferInfo);
+            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, 0, trianglePipe->descriptorSets[0], &bufferInfo);
 
         vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
     }
 
-    void CreateCameraBuffer()
-    {
-        createBuffer(sizeof(glm::mat4) * 4, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
-            cameraBuffer.buffer, cameraBuffer.memory);
-    }
-
     void writeComputeDescriptorSet()
     {
         VkDescriptorBufferInfo bufferInfo =
@@ -173,24 +161,19 @@ public:
 
     void CreateVertexBuffer()
     {
-        createBuffer(sizeof(Vertex) * vertexData.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
+        createBuffer(sizeof(Vertex) * vertexData.size(),
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
             vertices.buffer, vertices.memory);
-        void* data;
-        vmaMapMemory(allocator, vertices.memory, &data);
-        memcpy(data, vertexData.data(), sizeof(vertexData) * vertexData.size());
-        vmaUnmapMemory(allocator, vertices.memory);
+        uploadManager.uploadBuffer(vertices.buffer, vertexData.data(), sizeof(Vertex) * vertexData.size());
     }
 
     void createIndexBuffer()
     {
         uint32_t index[] = {0, 1, 2};
 
-        createBuffer(sizeof(Vertex), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_ONLY, indices.buffer,
-            indices.memory);
-        void* data;
-        vmaMapMemory(allocator, indices.memory, &data);
-        memcpy(data, index, sizeof(index));
-        vmaUnmapMemory(allocator, indices.memory);
+        createBuffer(sizeof(index), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY, indices.buffer, indices.memory);
+        uploadManager.uploadBuffer(indices.buffer, index, sizeof(index));
         indices.count = 3;
     }
 
@@ -199,7 +182,8 @@ public:
         std::filesystem::path shaders_directory = dhh::shader::findShaderDirectory();
 
         dhh::shader::Shader computeShader(shaders_directory / "shader.comp");
-        computePipe = new dhh::shader::Pipeline(device, {&computeShader}, descriptorPool);
+        computePipe = new dhh::shader::Pipeline(
+            device, {&computeShader}, descriptorAllocator, pipelineCache, {}, descriptorIndexingFeatures);
     }
 
     void createTrianglePipeline()
@@ -207,10 +191,11 @@ public:
         std::filesystem::path shaders_directory = dhh::shader::findShaderDirectory();
 
         dhh::shader::Shader vertexShader(shaders_directory / "shader.vert");
+        vertexShader.setDynamic(0);  // transforms live in the frame allocator
         dhh::shader::Shader fragmentShader(shaders_directory / "shader.frag");
 
-        trianglePipe = new dhh::shader::Pipeline(device, {&vertexShader, &fragmentShader}, descriptorPool, renderPass,
-            dhh::vk::initializer::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT),
+        trianglePipe = new dhh::shader::Pipeline(device, {&vertexShader, &fragmentShader}, descriptorAllocator,
+            renderPass, dhh::vk::initializer::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT),
             {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR},
             dhh::vk::initializer::pipelineRasterizationStateCreateInfo(
                 VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE),
@@ -220,90 +205,46 @@ public:
                                                                         | VK_COLOR_COMPONENT_B_BIT
                                                                         | VK_COLOR_COMPONENT_A_BIT,
                 false),
-            dhh::vk::initializer::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST));
+            dhh::vk::initializer::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST),
+            pipelineCache, {}, descriptorIndexingFeatures);
     }
 
 
     void buildCommandBuffers()
     {
-        VkCommandBufferBeginInfo cmdBufInfo = dhh::vk::initializer::commandBufferBeginInfo();
-
-        // Set clear values for all framebuffer attachments with loadOp set to clear
-        // We use two attachments (color and depth) that are cleared at the start of the subpass and as such we need to
-        // set clear values for both
-        std::vector<VkClearValue> clearValues(2);
-        clearValues[0].color        = {{0.0f, 0.0f, 0.2f, 1.0f}};
-        clearValues[1].depthStencil = {1.0f, 0};
-
-        for (int32_t i = 0; i < commandBuffers.size(); ++i)
-        {
-            VkRenderPassBeginInfo renderPassBeginInfo = dhh::vk::initializer::renderPassBeginInfo(
-                clearValues, framebuffers[i], renderPass, windowWidth, windowHeight);
-
-            vkBeginCommandBuffer(commandBuffers[i], &cmdBufInfo);
-
-            // Start the first sub pass specified in our default render pass setup by the base class
-            // This will clear the color and depth attachment
-            vkCmdBeginRenderPass(commandBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-            // Update dynamic viewport state
-            VkViewport viewport = {};
-            viewport.height     = -static_cast<float>(windowHeight);
-            viewport.width      = static_cast<float>(windowWidth);
-            viewport.minDepth   = static_cast<float>(0.0f);
-            viewport.maxDepth   = static_cast<float>(1.0f);
-            viewport.x          = 0;
-            viewport.y          = windowHeight;
-            vkCmdSetViewport(commandBuffers[i], 0, 1, &viewport);
-
-            // Update dynamic scissor state
-            VkRect2D scissor      = {};
-            scissor.extent.width  = windowWidth;
-            scissor.extent.height = windowHeight;
-            scissor.offset.x      = 0;
-            scissor.offset.y      = 0;
-            vkCmdSetScissor(commandBuffers[i], 0, 1, &scissor);
-
+        addDrawGroup([this](VkCommandBuffer commandBuffer, uint32_t imageIndex) {
             // Bind descriptor sets describing shader binding points
-            vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipe->pipelineLayout, 0,
-                1, &trianglePipe->descriptorSets[0], 0, nullptr);
+            const uint32_t transformOffset = frameAllocator.getRegionOffset(imageIndex);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipe->pipelineLayout, 0, 1,
+                &trianglePipe->descriptorSets[0], 1, &transformOffset);
 
             // Bind the rendering pipeline
             // The pipeline (state object) contains all states of the rendering pipeline, binding it will set all the
             // states specified at pipeline creation time
-            vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipe->pipeline);
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipe->pipeline);
 
             // Bind triangle vertex buffer (contains position and colors)
             VkDeviceSize offsets[1] = {0};
-            vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, &vertices.buffer, offsets);
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
 
             // Bind triangle index buffer
-            vkCmdBindIndexBuffer(commandBuffers[i], indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+            vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 
             // Draw indexed triangle
-            vkCmdDrawIndexed(commandBuffers[i], indices.count, 1, 0, 0, 1);
-
-            vkCmdEndRenderPass(commandBuffers[i]);
-
-            // Ending the render pass will add an implicit barrier transitioning the frame buffer color attachment to
-            // VK_IMAGE_LAYOUT_PRESENT_SRC_KHR for presenting it to the windowing system
-
-            vkEndCommandBuffer(commandBuffers[i]);
-        }
+            vkCmdDrawIndexed(commandBuffer, indices.count, 1, 0, 0, 1);
+        });
     }
 
     void updateTransform()
     {
         dhh::input::processKeyboard(window, camera);
 
-        void* data;
-        vmaMapMemory(allocator, cameraBuffer.memory, &data);
+        // must be the first allocation of the frame, the command buffers were recorded with that offset
         Transforms transforms{
             {glm::perspective(glm::radians(camera.Zoom), (float) windowWidth / windowHeight, 0.1f, 1000.f)},
             {camera.GetViewMatrix()}, {glm::mat4(1.f)}};
 
-        memcpy(data, &transforms, sizeof(transforms));
-        vmaUnmapMemory(allocator, cameraBuffer.memory);
+        frameAllocator.push(transforms);
     }
 };
 
@@ -312,14 +253,27 @@ int main(int argc, char* argv[])
 {
     try
     {
-        Triangle app;
+        // --headless [frame count] renders offscreen and writes the last frame to triangle.ppm
+        const bool headless = argc > 1 && std::string(argv[1]) == "--headless";
+        Triangle app(headless);
+        if (headless && argc > 2)
+        {
+            app.headlessFrameCount = std::stoul(argv[2]);
+        }
 
 
-        while (!glfwWindowShouldClose(app.window))
+        while (app.running())
         {
+            app.beginFrame();
             app.updateTransform();
-            app.drawFrame();
-            glfwPollEvents();
+            app.endFrame();
+        }
+
+        app.gpuProfiler.report(std::cout);
+        if (headless)
+        {
+            app.saveFrame("triangle.ppm");
+            app.gpuProfiler.appendCsv("triangle_gpu_times.csv");
         }
     }
     catch (std::exception& e)
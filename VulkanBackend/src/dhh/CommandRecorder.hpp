@@ -0,0 +1,220 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace dhh::vk
+{
+    /// Records draw groups into secondary command buffers, one per group and swapchain image. Groups are spread over
+    /// the workers of a thread pool and every worker records into command pools of its own, so recording needs no
+    /// locking. Only groups marked dirty are recorded again, the others keep their command buffers from earlier frames
+    class CommandRecorder
+    {
+    public:
+        using RecordFunction = std::function<void(VkCommandBuffer commandBuffer, uint32_t imageIndex)>;
+
+        void create(VkDevice device, uint32_t queueFamily, uint32_t imageCount, dhh::thread::ThreadPool& threadPool)
+        {
+            this->device      = device;
+            this->queueFamily = queueFamily;
+            this->threadPool  = &threadPool;
+            pools.resize(threadPool.size());
+            createPools(imageCount);
+        }
+
+        /// Follow a swapchain that came back with another image count. The device must be idle, every group keeps
+        /// its record function and is recorded again for every image
+        void resize(uint32_t imageCount)
+        {
+            destroyPools();
+            createPools(imageCount);
+            for (auto& group : groups)
+            {
+                allocateCommandBuffers(group);
+            }
+        }
+
+        void destroy()
+        {
+            destroyPools();
+            pools.clear();
+            groups.clear();
+        }
+
+        /// The group is recorded for every image on its next frame
+        uint32_t addDrawGroup(RecordFunction record)
+        {
+            Group group;
+            group.record = std::move(record);
+            group.worker = static_cast<uint32_t>(groups.size() % pools.size());
+            allocateCommandBuffers(group);
+            groups.push_back(std::move(group));
+            return static_cast<uint32_t>(groups.size() - 1);
+        }
+
+        /// Record the group again for every image, e.g. after the buffers or pipeline it binds changed
+        void markDirty(uint32_t group)
+        {
+            groups[group].dirty.assign(imageCount, true);
+        }
+
+        void markAllDirty()
+        {
+            for (auto& group : groups)
+            {
+                group.dirty.assign(imageCount, true);
+            }
+        }
+
+        bool isDirty(uint32_t imageIndex) const
+        {
+            if (!recorded[imageIndex])
+            {
+                return true;
+            }
+            for (const auto& group : groups)
+            {
+                if (group.dirty[imageIndex])
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /// Record the dirty groups of an image in parallel and wait for them. The image must not be in flight
+        void record(uint32_t imageIndex, const VkCommandBufferInheritanceInfo& inheritance)
+        {
+            std::vector<std::vector<uint32_t>> work(pools.size());
+            for (uint32_t i = 0; i < groups.size(); i++)
+            {
+                if (groups[i].dirty[imageIndex])
+                {
+                    work[groups[i].worker].push_back(i);
+                }
+            }
+
+            std::vector<std::future<void>> tasks;
+            for (const auto& workerGroups : work)
+            {
+                if (workerGroups.empty())
+                {
+                    continue;
+                }
+                tasks.push_back(threadPool->submit([this, &workerGroups, imageIndex, &inheritance] {
+                    for (uint32_t group : workerGroups)
+                    {
+                        recordGroup(groups[group], imageIndex, inheritance);
+                    }
+                }));
+            }
+            for (auto& task : tasks)
+            {
+                task.get();
+            }
+
+            commandBuffers[imageIndex].clear();
+            for (const auto& group : groups)
+            {
+                commandBuffers[imageIndex].push_back(group.commandBuffers[imageIndex]);
+            }
+            recorded[imageIndex] = true;
+        }
+
+        /// Secondary command buffers of an image in the order the groups were added
+        const std::vector<VkCommandBuffer>& getCommandBuffers(uint32_t imageIndex) const
+        {
+            return commandBuffers[imageIndex];
+        }
+
+    private:
+        struct Group
+        {
+            RecordFunction record;
+            uint32_t worker;
+            std::vector<VkCommandBuffer> commandBuffers;  // per image
+            std::vector<bool> dirty;                      // per image
+        };
+
+        VkDevice device;
+        uint32_t queueFamily;
+        uint32_t imageCount;
+        dhh::thread::ThreadPool* threadPool;
+        std::vector<std::vector<VkCommandPool>> pools;
+        std::vector<Group> groups;
+        std::vector<std::vector<VkCommandBuffer>> commandBuffers;  // per image, last recorded
+        std::vector<bool> recorded;                                // per image
+
+        void createPools(uint32_t imageCount)
+        {
+            this->imageCount = imageCount;
+            // pools[worker][image], an image's pools are only touched while that image is not in flight
+            for (auto& workerPools : pools)
+            {
+                workerPools.resize(imageCount);
+                for (auto& pool : workerPools)
+                {
+                    VkCommandPoolCreateInfo poolInfo = {};
+                    poolInfo.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                    poolInfo.flags                   = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+                    poolInfo.queueFamilyIndex        = queueFamily;
+                    if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+                    {
+                        throw std::runtime_error("Failed to create secondary command pool");
+                    }
+                }
+            }
+            commandBuffers.assign(imageCount, {});
+            recorded.assign(imageCount, false);
+        }
+
+        // the command buffers of the groups go with their pools
+        void destroyPools()
+        {
+            for (auto& workerPools : pools)
+            {
+                for (VkCommandPool pool : workerPools)
+                {
+                    vkDestroyCommandPool(device, pool, nullptr);
+                }
+                workerPools.clear();
+            }
+        }
+
+        void allocateCommandBuffers(Group& group)
+        {
+            group.dirty.assign(imageCount, true);
+            group.commandBuffers.resize(imageCount);
+            for (uint32_t i = 0; i < imageCount; i++)
+            {
+                VkCommandBufferAllocateInfo info = {};
+                info.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                info.commandPool                 = pools[group.worker][i];
+                info.level                       = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+                info.commandBufferCount          = 1;
+                vkAllocateCommandBuffers(device, &info, &group.commandBuffers[i]);
+            }
+        }
+
+        void recordGroup(Group& group, uint32_t imageIndex, const VkCommandBufferInheritanceInfo& inheritance)
+        {
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags                    = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            beginInfo.pInheritanceInfo         = &inheritance;
+
+            VkCommandBuffer commandBuffer = group.commandBuffers[imageIndex];
+            vkBeginCommandBuffer(commandBuffer, &beginInfo);
+            group.record(commandBuffer, imageIndex);
+            vkEndCommandBuffer(commandBuffer);
+            group.dirty[imageIndex] = false;
+        }
+    };
+}
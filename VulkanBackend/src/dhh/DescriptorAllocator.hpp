@@ -0,0 +1,289 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace dhh::vk
+{
+    /// Allocates descriptor sets from a chain of pools. When the current pool is exhausted another one is created,
+    /// sized from the average descriptor counts of the sets allocated so far, so the pools follow what the reflected
+    /// shaders actually use. reset() returns every set at once and keeps the pools for reuse, which makes an
+    /// allocator per frame a cheap home for transient sets. Allocation is thread safe. Bindless sets, the ones with a
+    /// variable descriptor count, are large and few, each gets an UPDATE_AFTER_BIND pool of its own
+    class DescriptorAllocator
+    {
+    public:
+        void create(VkDevice device, uint32_t setsPerPool = 64, uint32_t maxSetsPerPool = 4096)
+        {
+            this->device         = device;
+            this->setsPerPool    = setsPerPool;
+            this->maxSetsPerPool = maxSetsPerPool;
+        }
+
+        void destroy()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const Pool& pool : usedPools)
+            {
+                vkDestroyDescriptorPool(device, pool.pool, nullptr);
+            }
+            for (const Pool& pool : freePools)
+            {
+                vkDestroyDescriptorPool(device, pool.pool, nullptr);
+            }
+            usedPools.clear();
+            freePools.clear();
+            owners.clear();
+            currentPool = VK_NULL_HANDLE;
+        }
+
+        /// bindings are the ones the layout was created from, they feed the pool size statistics. A variable descriptor
+        /// count is the size of the runtime array in the layout's last binding
+        VkDescriptorSet allocate(VkDescriptorSetLayout layout,
+            const std::vector<VkDescriptorSetLayoutBinding>& bindings, uint32_t variableDescriptorCount = 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (variableDescriptorCount != 0)
+            {
+                return allocateBindless(layout, bindings, variableDescriptorCount);
+            }
+
+            for (const auto& binding : bindings)
+            {
+                descriptorCounts[binding.descriptorType] += binding.descriptorCount;
+            }
+            setCount++;
+
+            if (currentPool == VK_NULL_HANDLE)
+            {
+                currentPool = acquirePool(bindings);
+            }
+
+            VkDescriptorSet set;
+            VkResult result = tryAllocate(currentPool, layout, 0, set);
+            if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+            {
+                currentPool = acquirePool(bindings);
+                result      = tryAllocate(currentPool, layout, 0, set);
+            }
+            if (result != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to allocate descriptor set");
+            }
+            track(set, currentPool);
+            return set;
+        }
+
+        /// Return one set, e.g. of a pipeline that was replaced. The caller makes sure the GPU no longer uses it. A
+        /// pool every set of which was freed is reset and reused like after reset()
+        void free(VkDescriptorSet set)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto owner = owners.find(set);
+            if (owner == owners.end())
+            {
+                throw std::runtime_error("Descriptor set was not allocated from this allocator");
+            }
+            const VkDescriptorPool pool = owner->second;
+            owners.erase(owner);
+            vkFreeDescriptorSets(device, pool, 1, &set);
+
+            auto used = std::find_if(
+                usedPools.begin(), usedPools.end(), [pool](const Pool& usedPool) { return usedPool.pool == pool; });
+            if (--used->liveSets == 0 && pool != currentPool)
+            {
+                vkResetDescriptorPool(device, pool, 0);
+                freePools.push_back(*used);
+                usedPools.erase(used);
+            }
+        }
+
+        /// Free every set allocated so far, the caller makes sure none of them is still in use by the GPU
+        void reset()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (Pool& pool : usedPools)
+            {
+                vkResetDescriptorPool(device, pool.pool, 0);
+                pool.liveSets = 0;
+                freePools.push_back(pool);
+            }
+            usedPools.clear();
+            owners.clear();
+            currentPool = VK_NULL_HANDLE;
+        }
+
+    private:
+        struct Pool
+        {
+            VkDescriptorPool pool;
+            std::map<VkDescriptorType, uint32_t> counts;  // descriptors of each type the pool was created with
+            bool updateAfterBind;
+            uint32_t liveSets = 0;  // allocated and not freed yet
+        };
+
+        VkDevice device;
+        uint32_t setsPerPool;
+        uint32_t maxSetsPerPool;
+        VkDescriptorPool currentPool = VK_NULL_HANDLE;
+        std::vector<Pool> usedPools;
+        std::vector<Pool> freePools;
+        std::map<VkDescriptorType, uint64_t> descriptorCounts;  // over every set ever allocated
+        uint64_t setCount = 0;
+        std::map<VkDescriptorSet, VkDescriptorPool> owners;  // pool of every live set, for free()
+        std::mutex mutex;
+
+        void track(VkDescriptorSet set, VkDescriptorPool pool)
+        {
+            owners[set] = pool;
+            std::find_if(usedPools.begin(), usedPools.end(), [pool](const Pool& usedPool) {
+                return usedPool.pool == pool;
+            })->liveSets++;
+        }
+
+        VkResult tryAllocate(VkDescriptorPool pool, VkDescriptorSetLayout layout, uint32_t variableDescriptorCount,
+            VkDescriptorSet& set)
+        {
+            VkDescriptorSetVariableDescriptorCountAllocateInfoEXT variableCountInfo = {};
+            variableCountInfo.sType =
+                VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT;
+            variableCountInfo.descriptorSetCount = 1;
+            variableCountInfo.pDescriptorCounts  = &variableDescriptorCount;
+
+            VkDescriptorSetAllocateInfo allocateInfo = {};
+            allocateInfo.sType                       = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocateInfo.pNext                       = variableDescriptorCount != 0 ? &variableCountInfo : nullptr;
+            allocateInfo.descriptorPool              = pool;
+            allocateInfo.descriptorSetCount          = 1;
+            allocateInfo.pSetLayouts                 = &layout;
+            return vkAllocateDescriptorSets(device, &allocateInfo, &set);
+        }
+
+        VkDescriptorSet allocateBindless(VkDescriptorSetLayout layout,
+            const std::vector<VkDescriptorSetLayoutBinding>& bindings, uint32_t variableDescriptorCount)
+        {
+            VkDescriptorPool pool = findFreePool(bindings, true);
+            if (pool == VK_NULL_HANDLE)
+            {
+                pool = createPool(countDescriptors(bindings), 1, true);
+            }
+
+            VkDescriptorSet set;
+            if (tryAllocate(pool, layout, variableDescriptorCount, set) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to allocate bindless descriptor set");
+            }
+            track(set, pool);
+            return set;
+        }
+
+        /// Move a reset pool the set fits in to the used pools
+        VkDescriptorPool findFreePool(const std::vector<VkDescriptorSetLayoutBinding>& bindings, bool updateAfterBind)
+        {
+            for (auto pool = freePools.begin(); pool != freePools.end(); ++pool)
+            {
+                if (pool->updateAfterBind == updateAfterBind && fits(*pool, bindings))
+                {
+                    usedPools.push_back(*pool);
+                    freePools.erase(pool);
+                    return usedPools.back().pool;
+                }
+            }
+            return VK_NULL_HANDLE;
+        }
+
+        /// A reset pool the set fits in if there is one, otherwise a new pool twice the size of the last
+        VkDescriptorPool acquirePool(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+        {
+            VkDescriptorPool freePool = findFreePool(bindings, false);
+            if (freePool != VK_NULL_HANDLE)
+            {
+                return freePool;
+            }
+
+            // common types get a floor so the first pools do not only fit the first pipeline
+            std::map<VkDescriptorType, uint32_t> counts = {
+                {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, setsPerPool},
+                {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, setsPerPool / 2},
+                {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, setsPerPool},
+                {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setsPerPool},
+            };
+            for (const auto& count : descriptorCounts)
+            {
+                const double perSet = static_cast<double>(count.second) / static_cast<double>(setCount);
+                counts[count.first] =
+                    std::max(counts[count.first], static_cast<uint32_t>(std::ceil(perSet * setsPerPool)));
+            }
+            // the set that did not fit must fit now, even when it is far bigger than the average
+            for (const auto& count : countDescriptors(bindings))
+            {
+                counts[count.first] = std::max(counts[count.first], count.second);
+            }
+
+            VkDescriptorPool pool = createPool(counts, setsPerPool, false);
+            setsPerPool           = std::min(setsPerPool * 2, maxSetsPerPool);
+            return pool;
+        }
+
+        VkDescriptorPool createPool(
+            const std::map<VkDescriptorType, uint32_t>& counts, uint32_t maxSets, bool updateAfterBind)
+        {
+            Pool pool;
+            pool.counts          = counts;
+            pool.updateAfterBind = updateAfterBind;
+
+            std::vector<VkDescriptorPoolSize> poolSizes;
+            for (const auto& count : pool.counts)
+            {
+                poolSizes.push_back({count.first, count.second});
+            }
+
+            VkDescriptorPoolCreateInfo poolCreateInfo = {};
+            poolCreateInfo.sType                      = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolCreateInfo.maxSets                    = maxSets;
+            poolCreateInfo.poolSizeCount              = static_cast<uint32_t>(poolSizes.size());
+            poolCreateInfo.pPoolSizes                 = poolSizes.data();
+            poolCreateInfo.flags                      = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+            if (updateAfterBind)
+            {
+                poolCreateInfo.flags |= VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+            }
+            if (vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &pool.pool) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create descriptor pool");
+            }
+            usedPools.push_back(pool);
+            return pool.pool;
+        }
+
+        static std::map<VkDescriptorType, uint32_t> countDescriptors(
+            const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+        {
+            std::map<VkDescriptorType, uint32_t> counts;
+            for (const auto& binding : bindings)
+            {
+                counts[binding.descriptorType] += binding.descriptorCount;
+            }
+            return counts;
+        }
+
+        static bool fits(const Pool& pool, const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+        {
+            for (const auto& count : countDescriptors(bindings))
+            {
+                auto available = pool.counts.find(count.first);
+                if (available == pool.counts.end() || available->second < count.second)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+}
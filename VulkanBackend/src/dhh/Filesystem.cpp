@@ -0,0 +1,108 @@
+#include "Filesystem.hpp"
+
+#include <functional>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace dhh::filesystem
+{
+	void writeFile(const std::filesystem::path& filename, const void* data, size_t size)
+	{
+		if (filename.has_parent_path())
+		{
+			std::filesystem::create_directories(filename.parent_path());
+		}
+#ifdef _WIN32
+		const unsigned long processId = GetCurrentProcessId();
+#else
+		const unsigned long processId = static_cast<unsigned long>(getpid());
+#endif
+		std::filesystem::path temporary = filename;
+		temporary += "." + std::to_string(processId) + "."
+			+ std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!file)
+			{
+				throw std::runtime_error("Failed to open " + temporary.string() + " for writing");
+			}
+			file.write(static_cast<const char*>(data), size);
+		}
+		std::error_code error;
+		std::filesystem::rename(temporary, filename, error);
+		if (error)
+		{
+			std::filesystem::remove(temporary, error);
+			throw std::runtime_error("Failed to move " + temporary.string() + " to " + filename.string());
+		}
+	}
+
+	MappedFile::MappedFile(const std::filesystem::path& filename)
+	{
+#ifdef _WIN32
+		HANDLE handle = CreateFileW(filename.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+		file = handle;
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(handle, &fileSize);
+		fileSize_ = static_cast<size_t>(fileSize.QuadPart);
+		if (fileSize_ == 0)
+		{
+			return;
+		}
+		mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr)
+		{
+			data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+#else
+		descriptor = open(filename.c_str(), O_RDONLY);
+		if (descriptor == -1)
+		{
+			return;
+		}
+		struct stat status;
+		fstat(descriptor, &status);
+		fileSize_ = static_cast<size_t>(status.st_size);
+		if (fileSize_ == 0)
+		{
+			return;
+		}
+		void* address = mmap(nullptr, fileSize_, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		data_         = address == MAP_FAILED ? nullptr : address;
+#endif
+	}
+
+	MappedFile::~MappedFile()
+	{
+#ifdef _WIN32
+		if (data_ != nullptr)
+			UnmapViewOfFile(data_);
+		if (mapping != nullptr)
+			CloseHandle(mapping);
+		if (file != nullptr)
+			CloseHandle(file);
+#else
+		if (data_ != nullptr)
+			munmap(data_, fileSize_);
+		if (descriptor != -1)
+			close(descriptor);
+#endif
+	}
+}
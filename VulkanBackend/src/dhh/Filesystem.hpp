@@ -4,6 +4,7 @@
 
 #include <vector>
 #include <fstream>
+#include <stdexcept>
 
 namespace dhh::filesystem
 {
@@ -17,4 +18,44 @@ namespace dhh::filesystem
 		file.close();
 		return buffer;
 	}
+
+	/// Write the whole buffer to a temporary file and move it over the target, so a reader never sees a partial file.
+	/// The temporary name is unique per process and thread, writers racing on the same target each move a whole file
+	void writeFile(const std::filesystem::path& filename, const void* data, size_t size);
+
+	/// Read-only memory mapping of a whole file
+	class MappedFile
+	{
+	public:
+		explicit MappedFile(const std::filesystem::path& filename);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool isValid() const
+		{
+			return data_ != nullptr;
+		}
+
+		const void* data() const
+		{
+			return data_;
+		}
+
+		size_t size() const
+		{
+			return fileSize_;
+		}
+
+	private:
+		void* data_      = nullptr;
+		size_t fileSize_ = 0;
+#ifdef _WIN32
+		void* file    = nullptr;  // HANDLE, the platform headers stay in Filesystem.cpp
+		void* mapping = nullptr;
+#else
+		int descriptor = -1;
+#endif
+	};
 }
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace dhh::vk
+{
+    /// One persistently mapped buffer split into a region per frame. Allocations inside a region are pointer bumps,
+    /// and a region is rewound when its frame starts again, so it must only be reused once the GPU is done with it.
+    /// Bind the buffer with a *_DYNAMIC descriptor and pass Allocation::offset as the dynamic offset
+    class FrameAllocator
+    {
+    public:
+        struct Allocation
+        {
+            void* data;
+            uint32_t offset;  // from the start of the buffer
+        };
+
+        void create(VmaAllocator allocator, VkPhysicalDevice physicalDevice, VkDeviceSize regionSize,
+            uint32_t regionCount, VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+        {
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+            alignment = std::max(properties.limits.minUniformBufferOffsetAlignment,
+                properties.limits.minStorageBufferOffsetAlignment);
+
+            this->allocator   = allocator;
+            this->regionSize  = (regionSize + alignment - 1) / alignment * alignment;
+            this->regionCount = regionCount;
+
+            VkBufferCreateInfo bufferInfo = {};
+            bufferInfo.sType              = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size               = this->regionSize * regionCount;
+            bufferInfo.usage              = usage;
+            bufferInfo.sharingMode        = VK_SHARING_MODE_EXCLUSIVE;
+
+            VmaAllocationCreateInfo allocationInfo = {};
+            allocationInfo.usage                   = VMA_MEMORY_USAGE_CPU_TO_GPU;
+            allocationInfo.flags                   = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+            VmaAllocationInfo info;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocationInfo, &buffer, &allocation, &info) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create frame allocator buffer");
+            }
+            mappedData = static_cast<char*>(info.pMappedData);
+        }
+
+        void destroy()
+        {
+            if (buffer != VK_NULL_HANDLE)
+            {
+                vmaDestroyBuffer(allocator, buffer, allocation);
+                buffer = VK_NULL_HANDLE;
+            }
+        }
+
+        /// Start writing into the region of the given frame
+        void beginFrame(uint32_t region)
+        {
+            if (region >= regionCount)
+            {
+                throw std::runtime_error("Frame allocator region out of range");
+            }
+            regionBegin = region * regionSize;
+            head        = regionBegin;
+        }
+
+        /// Make this frame's writes visible to the device, a no-op on host coherent memory
+        void flush()
+        {
+            if (head > regionBegin)
+            {
+                vmaFlushAllocation(allocator, allocation, regionBegin, head - regionBegin);
+            }
+        }
+
+        Allocation allocate(VkDeviceSize size)
+        {
+            const VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+            if (offset + size > regionBegin + regionSize)
+            {
+                throw std::runtime_error("Frame allocator region exhausted");
+            }
+            head = offset + size;
+            return {mappedData + offset, static_cast<uint32_t>(offset)};
+        }
+
+        template <typename T>
+        uint32_t push(const T& value)
+        {
+            Allocation slot = allocate(sizeof(T));
+            std::memcpy(slot.data, &value, sizeof(T));
+            return slot.offset;
+        }
+
+        /// Offset of the first allocation made in a region, for command buffers that are recorded ahead of time
+        uint32_t getRegionOffset(uint32_t region) const
+        {
+            return static_cast<uint32_t>(region * regionSize);
+        }
+
+        VkBuffer buffer = VK_NULL_HANDLE;
+
+    private:
+        VmaAllocator allocator;
+        VmaAllocation allocation;
+        char* mappedData         = nullptr;
+        VkDeviceSize alignment   = 1;
+        VkDeviceSize regionSize  = 0;
+        uint32_t regionCount     = 0;
+        VkDeviceSize regionBegin = 0;
+        VkDeviceSize head        = 0;
+    };
+}
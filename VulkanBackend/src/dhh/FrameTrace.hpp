@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace dhh::trace
+{
+    /// Fixed size ring of timed events, written from any thread without locks. Once the ring is full the oldest events
+    /// are overwritten, and a reader skips the slots that are being written. Names are not copied and must outlive
+    /// the trace, e.g. string literals
+    class FrameTrace
+    {
+    public:
+        enum class Type : uint8_t
+        {
+            Zone,
+            Counter
+        };
+
+        struct Event
+        {
+            const char* name;
+            Type type;
+            uint32_t thread;
+            uint64_t frame;
+            int64_t start;     // nanoseconds since the trace was created
+            int64_t duration;  // nanoseconds, zones only
+            double value;      // counters only
+        };
+
+        explicit FrameTrace(size_t capacity = 1 << 16) : slots(capacity), startTime(Clock::now())
+        {
+        }
+
+        int64_t now() const
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - startTime).count();
+        }
+
+        /// Events recorded from now on belong to the frame
+        void setFrame(uint64_t frame)
+        {
+            currentFrame.store(frame, std::memory_order_relaxed);
+        }
+
+        void zone(const char* name, int64_t start, int64_t end)
+        {
+            push({name, Type::Zone, threadId(), currentFrame.load(std::memory_order_relaxed), start, end - start, 0});
+        }
+
+        void counter(const char* name, double value)
+        {
+            push({name, Type::Counter, threadId(), currentFrame.load(std::memory_order_relaxed), now(), 0, value});
+        }
+
+        /// Copy of the events still in the ring, oldest first
+        std::vector<Event> snapshot() const
+        {
+            const uint64_t end   = head.load(std::memory_order_acquire);
+            const uint64_t begin = end > slots.size() ? end - slots.size() : 0;
+
+            std::vector<Event> events;
+            events.reserve(end - begin);
+            for (uint64_t i = begin; i < end; i++)
+            {
+                const Slot& slot = slots[i % slots.size()];
+                if (slot.sequence.load(std::memory_order_acquire) != i + 1)
+                {
+                    continue;
+                }
+                const Event event = slot.event;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.sequence.load(std::memory_order_relaxed) == i + 1)
+                {
+                    events.push_back(event);
+                }
+            }
+            return events;
+        }
+
+        /// Trace event format, open in chrome://tracing or ui.perfetto.dev. Zones are complete events on the thread
+        /// that recorded them, counters become a track of their own
+        void exportChromeTrace(const std::filesystem::path& path) const
+        {
+            std::ofstream file(path);
+            if (!file)
+            {
+                throw std::runtime_error("Failed to open " + path.string());
+            }
+
+            file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+            bool first = true;
+            for (const Event& event : snapshot())
+            {
+                file << (first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"pid\":0,\"tid\":" << event.thread
+                     << ",\"ts\":" << event.start / 1000.0;
+                if (event.type == Type::Zone)
+                {
+                    file << ",\"ph\":\"X\",\"dur\":" << event.duration / 1000.0
+                         << ",\"args\":{\"frame\":" << event.frame << "}}";
+                }
+                else
+                {
+                    file << ",\"ph\":\"C\",\"args\":{\"ms\":" << event.value << "}}";
+                }
+                first = false;
+            }
+            file << "\n]}\n";
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        /// sequence is the event index + 1 once the event is complete, 0 while it is written
+        struct Slot
+        {
+            std::atomic<uint64_t> sequence{0};
+            Event event;
+        };
+
+        std::vector<Slot> slots;
+        std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> currentFrame{0};
+        Clock::time_point startTime;
+
+        void push(const Event& event)
+        {
+            const uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+            Slot& slot           = slots[index % slots.size()];
+            slot.sequence.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.event = event;
+            slot.sequence.store(index + 1, std::memory_order_release);
+        }
+
+        static uint32_t threadId()
+        {
+            static std::atomic<uint32_t> nextThread{0};
+            thread_local const uint32_t thread = nextThread.fetch_add(1);
+            return thread;
+        }
+    };
+
+    /// Records the time from construction to destruction as a zone
+    class Zone
+    {
+    public:
+        Zone(FrameTrace& trace, const char* name) : trace(trace), name(name), start(trace.now())
+        {
+        }
+
+        ~Zone()
+        {
+            trace.zone(name, start, trace.now());
+        }
+
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+
+    private:
+        FrameTrace& trace;
+        const char* name;
+        int64_t start;
+    };
+}
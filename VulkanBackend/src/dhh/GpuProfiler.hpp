@@ -0,0 +1,299 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dhh::vk
+{
+    /// GPU timers on timestamp queries. The pool is split into slots, one per command buffer that is timed, and each
+    /// slot holds a begin/end pair for every named scope. A command buffer resets its slot before writing into it, so
+    /// pre-recorded command buffers can be submitted again and again. Results are read without waiting once the
+    /// submission's fence has signaled, scopes the GPU has not finished yet are simply skipped. Record from one thread
+    class GpuProfiler
+    {
+    public:
+        struct Stats
+        {
+            size_t count;
+            double min;  // milliseconds
+            double avg;
+            double p99;
+        };
+
+        using SampleCallback = std::function<void(const std::string& scope, double milliseconds)>;
+
+        /// Begins a scope on construction and ends it on destruction
+        class Scope
+        {
+        public:
+            Scope(GpuProfiler& profiler, VkCommandBuffer commandBuffer, const std::string& name, uint32_t slot)
+                : profiler(profiler), commandBuffer(commandBuffer), scope(profiler.getScope(name)), slot(slot)
+            {
+                profiler.begin(commandBuffer, scope, slot);
+            }
+
+            ~Scope()
+            {
+                profiler.end(commandBuffer, scope, slot);
+            }
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            GpuProfiler& profiler;
+            VkCommandBuffer commandBuffer;
+            uint32_t scope;
+            uint32_t slot;
+        };
+
+        void create(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t slotCount = 16,
+            uint32_t scopeCount = 16)
+        {
+            this->device     = device;
+            this->slotCount  = slotCount;
+            this->scopeCount = scopeCount;
+
+            uint32_t familyCount = 0;
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+            std::vector<VkQueueFamilyProperties> families(familyCount);
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+            const uint32_t validBits = families[queueFamily].timestampValidBits;
+            if (validBits == 0)
+            {
+                return;
+            }
+            timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+            timestampPeriod = properties.limits.timestampPeriod;
+
+            VkQueryPoolCreateInfo poolInfo = {};
+            poolInfo.sType                 = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            poolInfo.queryType             = VK_QUERY_TYPE_TIMESTAMP;
+            poolInfo.queryCount            = slotCount * scopeCount * 2;
+            if (vkCreateQueryPool(device, &poolInfo, nullptr, &queryPool) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create timestamp query pool");
+            }
+            written.assign(slotCount, std::vector<bool>(scopeCount, false));
+            pending.assign(slotCount, false);
+        }
+
+        void destroy()
+        {
+            if (queryPool != VK_NULL_HANDLE)
+            {
+                vkDestroyQueryPool(device, queryPool, nullptr);
+                queryPool = VK_NULL_HANDLE;
+            }
+        }
+
+        /// The queue family has no timestamps, every call is a no-op then
+        bool isSupported() const
+        {
+            return queryPool != VK_NULL_HANDLE;
+        }
+
+        /// Reserve slots for command buffers, e.g. one per swapchain image
+        uint32_t allocateSlots(uint32_t count)
+        {
+            if (nextSlot + count > slotCount)
+            {
+                throw std::runtime_error("Out of GPU profiler slots");
+            }
+            nextSlot += count;
+            return nextSlot - count;
+        }
+
+        uint32_t getScope(const std::string& name)
+        {
+            auto scope = scopes.find(name);
+            if (scope != scopes.end())
+            {
+                return scope->second;
+            }
+            if (scopes.size() == scopeCount)
+            {
+                throw std::runtime_error("Out of GPU profiler scopes");
+            }
+            const uint32_t id = static_cast<uint32_t>(scopes.size());
+            scopeNames.push_back(&scopes.emplace(name, id).first->first);
+            samples.emplace_back();
+            return id;
+        }
+
+        /// Called from collect with every new sample, e.g. to put GPU times on a frame trace
+        void setSampleCallback(SampleCallback callback)
+        {
+            onSample = std::move(callback);
+        }
+
+        /// Record at the start of the command buffer, outside of a render pass
+        void reset(VkCommandBuffer commandBuffer, uint32_t slot)
+        {
+            if (isSupported())
+            {
+                vkCmdResetQueryPool(commandBuffer, queryPool, slot * scopeCount * 2, scopeCount * 2);
+            }
+        }
+
+        void begin(VkCommandBuffer commandBuffer, uint32_t scope, uint32_t slot,
+            VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT)
+        {
+            if (isSupported())
+            {
+                vkCmdWriteTimestamp(commandBuffer, stage, queryPool, getQuery(scope, slot));
+                written[slot][scope] = true;
+            }
+        }
+
+        void end(VkCommandBuffer commandBuffer, uint32_t scope, uint32_t slot,
+            VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT)
+        {
+            if (isSupported())
+            {
+                vkCmdWriteTimestamp(commandBuffer, stage, queryPool, getQuery(scope, slot) + 1);
+            }
+        }
+
+        /// Call after the command buffer of the slot was submitted
+        void submitted(uint32_t slot)
+        {
+            if (isSupported())
+            {
+                pending[slot] = true;
+            }
+        }
+
+        /// Read the slot's timestamps once the fence of its submission has signaled, never blocks
+        void collect(uint32_t slot)
+        {
+            if (!isSupported() || !pending[slot])
+            {
+                return;
+            }
+            pending[slot] = false;
+
+            for (uint32_t scope = 0; scope < samples.size(); scope++)
+            {
+                if (!written[slot][scope])
+                {
+                    continue;
+                }
+                uint64_t results[4];  // begin, availability, end, availability
+                vkGetQueryPoolResults(device, queryPool, getQuery(scope, slot), 2, sizeof(results), results,
+                    2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+                if (results[1] == 0 || results[3] == 0)
+                {
+                    continue;
+                }
+                const uint64_t ticks = ((results[2] & timestampMask) - (results[0] & timestampMask)) & timestampMask;
+                addSample(scope, static_cast<double>(ticks) * timestampPeriod / 1e6);
+            }
+        }
+
+        std::map<std::string, Stats> getStats() const
+        {
+            std::map<std::string, Stats> stats;
+            for (const auto& scope : scopes)
+            {
+                std::vector<double> sorted(samples[scope.second].begin(), samples[scope.second].end());
+                if (sorted.empty())
+                {
+                    continue;
+                }
+                std::sort(sorted.begin(), sorted.end());
+                double sum = 0;
+                for (double sample : sorted)
+                {
+                    sum += sample;
+                }
+                const size_t p99 = std::min(sorted.size() - 1, static_cast<size_t>(sorted.size() * 0.99));
+                stats[scope.first] = {sorted.size(), sorted.front(), sum / sorted.size(), sorted[p99]};
+            }
+            return stats;
+        }
+
+        void report(std::ostream& out) const
+        {
+            out << "GPU times (ms)\n";
+            for (const auto& stats : getStats())
+            {
+                out << "  " << std::left << std::setw(20) << stats.first << std::right << std::fixed
+                    << std::setprecision(3) << " min " << stats.second.min << "  avg " << stats.second.avg
+                    << "  p99 " << stats.second.p99 << "  (" << stats.second.count << " samples)\n";
+            }
+        }
+
+        /// One row per scope and run, so regressions show up when the file grows over time
+        void appendCsv(const std::filesystem::path& path) const
+        {
+            const bool exists = std::filesystem::exists(path);
+            std::ofstream file(path, std::ios::app);
+            if (!file)
+            {
+                throw std::runtime_error("Failed to open " + path.string());
+            }
+            if (!exists)
+            {
+                file << "time,scope,samples,min_ms,avg_ms,p99_ms\n";
+            }
+            const std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            for (const auto& stats : getStats())
+            {
+                file << now << "," << stats.first << "," << stats.second.count << "," << stats.second.min << ","
+                     << stats.second.avg << "," << stats.second.p99 << "\n";
+            }
+        }
+
+    private:
+        VkDevice device;
+        VkQueryPool queryPool  = VK_NULL_HANDLE;
+        uint32_t slotCount     = 0;
+        uint32_t scopeCount    = 0;
+        uint32_t nextSlot      = 0;
+        float timestampPeriod  = 1;  // nanoseconds per tick
+        uint64_t timestampMask = ~0ull;
+        size_t maxSamples      = 10000;  // per scope, the oldest are dropped
+        std::map<std::string, uint32_t> scopes;
+        std::vector<const std::string*> scopeNames;  // per scope, the keys of scopes
+        SampleCallback onSample;
+        std::vector<std::deque<double>> samples;  // per scope
+        std::vector<std::vector<bool>> written;   // [slot][scope], the command buffer writes the scope
+        std::vector<bool> pending;                // per slot, submitted and not collected yet
+
+        uint32_t getQuery(uint32_t scope, uint32_t slot) const
+        {
+            return (slot * scopeCount + scope) * 2;
+        }
+
+        void addSample(uint32_t scope, double milliseconds)
+        {
+            samples[scope].push_back(milliseconds);
+            if (onSample)
+            {
+                onSample(*scopeNames[scope], milliseconds);
+            }
+            if (samples[scope].size() > maxSamples)
+            {
+                samples[scope].pop_front();
+            }
+        }
+    };
+}
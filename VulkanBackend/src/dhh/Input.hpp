@@ -31,6 +31,11 @@ namespace dhh::input
 
 	inline void processKeyboard(GLFWwindow* window, dhh::camera::Camera& camera)
 	{
+		if (window == nullptr)
+		{
+			// headless, there is no keyboard
+			return;
+		}
 		static float lastTime = glfwGetTime();
 		const float currentTime = glfwGetTime();
 		const float deltaTime = currentTime - lastTime;
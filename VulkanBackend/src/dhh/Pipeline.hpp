@@ -1,21 +1,82 @@
 #pragma once
 
+#include "DescriptorAllocator.hpp"
 #include "Shader.hpp"
 #include "VulkanInitializer.hpp"
 #include "VulkanTools.hpp"
 
+#include <cstring>
+#include <iterator>
+#include <set>
+#include <type_traits>
 #include <vector>
 
 
 namespace dhh::shader
 {
+    /// Values for specialization constants, looked up by their GLSL name (local_size_x/y/z for work group sizes).
+    /// The same map can be applied to every stage of a pipeline; each stage picks the constants it declares
+    class SpecializationMap
+    {
+    public:
+        template <typename T>
+        SpecializationMap& set(const std::string& name, T value)
+        {
+            static_assert(std::is_arithmetic_v<T>, "Specialization constants must be scalars");
+            Value entry = {};
+            if constexpr (std::is_same_v<T, bool>)
+            {
+                entry.kind  = Value::Bool;
+                entry.size  = sizeof(VkBool32);
+                entry.value = value ? VK_TRUE : VK_FALSE;
+            }
+            else
+            {
+                static_assert(sizeof(T) == 4 || sizeof(T) == 8, "Specialization constants must be 32 or 64 bit");
+                entry.kind = std::is_floating_point_v<T> ? Value::Float : Value::Integer;
+                entry.size = sizeof(T);
+                std::memcpy(&entry.value, &value, sizeof(T));
+            }
+            values[name] = entry;
+            return *this;
+        }
+
+        bool empty() const
+        {
+            return values.empty();
+        }
+
+    private:
+        friend class Pipeline;
+
+        struct Value
+        {
+            enum Kind
+            {
+                Bool,
+                Integer,
+                Float,
+            } kind;
+            uint32_t size;
+            uint64_t value;  // raw bits, little endian
+        };
+
+        std::map<std::string, Value> values;
+    };
+
+    /// The descriptor indexing features the device was created with. Left zeroed, runtime arrays are rejected
+    using DescriptorIndexingFeatures = VkPhysicalDeviceDescriptorIndexingFeaturesEXT;
+
     class Pipeline
     {
     public:
         std::vector<Shader*> shaders;
 
-        explicit Pipeline(VkDevice device, Shader* shader, VkDescriptorPool pool)
-            : device(device), shaders({shader}), descriptorPool(pool)
+        explicit Pipeline(VkDevice device, Shader* shader, dhh::vk::DescriptorAllocator& descriptorAllocator,
+            VkPipelineCache pipelineCache = VK_NULL_HANDLE, const SpecializationMap& specialization = {},
+            const DescriptorIndexingFeatures& descriptorIndexing = {})
+            : device(device), shaders({shader}), descriptorAllocator(&descriptorAllocator),
+              pipelineCache(pipelineCache), specialization(specialization), descriptorIndexing(descriptorIndexing)
         {
             isComputePipeline = true;
             createShaderModules();
@@ -28,16 +89,19 @@ namespace dhh::shader
         }
 
 
-        explicit Pipeline(VkDevice device, const std::vector<Shader*>& shaders, VkDescriptorPool pool,
-            VkRenderPass renderPass, VkPipelineMultisampleStateCreateInfo multisampleState,
+        explicit Pipeline(VkDevice device, const std::vector<Shader*>& shaders,
+            dhh::vk::DescriptorAllocator& descriptorAllocator, VkRenderPass renderPass,
+            VkPipelineMultisampleStateCreateInfo multisampleState,
             std::vector<VkDynamicState> dynamicStates, VkPipelineRasterizationStateCreateInfo rasterizationState,
             VkPipelineDepthStencilStateCreateInfo depthStencilState, VkPipelineViewportStateCreateInfo viewportState,
             VkPipelineColorBlendAttachmentState colorBlendAttachmentState,
-            VkPipelineInputAssemblyStateCreateInfo inputAssemblyState)
-            : device(device), shaders(shaders), descriptorPool(pool), renderPass(renderPass),
+            VkPipelineInputAssemblyStateCreateInfo inputAssemblyState, VkPipelineCache pipelineCache = VK_NULL_HANDLE,
+            const SpecializationMap& specialization = {}, const DescriptorIndexingFeatures& descriptorIndexing = {})
+            : device(device), shaders(shaders), descriptorAllocator(&descriptorAllocator), renderPass(renderPass),
               multisampleState(multisampleState), dynamicStates(dynamicStates), rasterizationState(rasterizationState),
               depthStencilState(depthStencilState), viewportState(viewportState),
-              colorBlendAttachmentState(colorBlendAttachmentState), inputAssemblyState(inputAssemblyState)
+              colorBlendAttachmentState(colorBlendAttachmentState), inputAssemblyState(inputAssemblyState),
+              pipelineCache(pipelineCache), specialization(specialization), descriptorIndexing(descriptorIndexing)
 
         {
             isComputePipeline = false;
@@ -64,7 +128,7 @@ namespace dhh::shader
         {
             VkComputePipelineCreateInfo pipelineInfo =
                 dhh::vk::initializer::computePipelineCreateInfo(shaderStageCreateInfos[0], pipelineLayout);
-            vkCreateComputePipelines(device, 0, 1, &pipelineInfo, nullptr, &pipeline);
+            vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
         }
 
         void createGraphicsPipeline()
@@ -90,7 +154,7 @@ namespace dhh::shader
             pipelineInfo.pDepthStencilState  = &depthStencilState;
             pipelineInfo.pInputAssemblyState = &inputAssemblyState;
             pipelineInfo.pVertexInputState   = &vertexInputInfo;
-            vkCreateGraphicsPipelines(device, 0, 1, &pipelineInfo, NULL, &pipeline);
+            vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &pipeline);
         }
 
         void getVertexInputInfos()
@@ -107,9 +171,79 @@ namespace dhh::shader
 
         void createShaderStageCreateInfos()
         {
-            for (const auto& shader : shaders)
+            // sized up front, the create infos point into these
+            specializationInfos.resize(shaders.size());
+            specializationEntries.resize(shaders.size());
+            specializationData.resize(shaders.size());
+
+            std::set<std::string> usedConstants;
+            for (size_t i = 0; i < shaders.size(); i++)
             {
-                shaderStageCreateInfos.push_back(shader->getPipelineShaderStageCreateInfo(shaderModules[shader->type]));
+                VkPipelineShaderStageCreateInfo info =
+                    shaders[i]->getPipelineShaderStageCreateInfo(shaderModules[shaders[i]->type]);
+                if (createSpecializationInfo(i, usedConstants))
+                {
+                    info.pSpecializationInfo = &specializationInfos[i];
+                }
+                shaderStageCreateInfos.push_back(info);
+            }
+
+            for (const auto& value : specialization.values)
+            {
+                if (usedConstants.count(value.first) == 0)
+                {
+                    throw std::runtime_error("Unknown specialization constant " + value.first);
+                }
+            }
+        }
+
+        bool createSpecializationInfo(size_t shaderIndex, std::set<std::string>& usedConstants)
+        {
+            std::vector<VkSpecializationMapEntry>& entries = specializationEntries[shaderIndex];
+            std::vector<char>& data                        = specializationData[shaderIndex];
+            for (const auto& constant : shaders[shaderIndex]->specializationConstants)
+            {
+                auto value = specialization.values.find(constant.first);
+                if (value == specialization.values.end())
+                {
+                    continue;
+                }
+                if (value->second.size != constant.second.size
+                    || value->second.kind != getSpecializationKind(constant.second.baseType))
+                {
+                    throw std::runtime_error("Type mismatch for specialization constant " + constant.first);
+                }
+
+                VkSpecializationMapEntry entry = {};
+                entry.constantID               = constant.second.constantId;
+                entry.offset                   = static_cast<uint32_t>(data.size());
+                entry.size                     = value->second.size;
+                entries.push_back(entry);
+                data.resize(data.size() + entry.size);
+                std::memcpy(data.data() + entry.offset, &value->second.value, entry.size);
+                usedConstants.insert(constant.first);
+            }
+
+            VkSpecializationInfo& info = specializationInfos[shaderIndex];
+            info.mapEntryCount         = static_cast<uint32_t>(entries.size());
+            info.pMapEntries           = entries.data();
+            info.dataSize              = data.size();
+            info.pData                 = data.data();
+            return !entries.empty();
+        }
+
+        static SpecializationMap::Value::Kind getSpecializationKind(spirv_cross::SPIRType::BaseType type)
+        {
+            switch (type)
+            {
+            case spirv_cross::SPIRType::Boolean:
+                return SpecializationMap::Value::Bool;
+            case spirv_cross::SPIRType::Half:
+            case spirv_cross::SPIRType::Float:
+            case spirv_cross::SPIRType::Double:
+                return SpecializationMap::Value::Float;
+            default:
+                return SpecializationMap::Value::Integer;
             }
         }
 
@@ -127,31 +261,111 @@ namespace dhh::shader
             info.sType                      = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
             info.setLayoutCount             = descriptorSetLayouts.size();
             info.pSetLayouts                = descriptorSetLayouts.data();
+            info.pushConstantRangeCount     = static_cast<uint32_t>(pushConstantRanges.size());
+            info.pPushConstantRanges        = pushConstantRanges.data();
 
             vkCreatePipelineLayout(device, &info, nullptr, &pipelineLayout);
         }
 
-        // descriptor sets index by swapchain id
+        // descriptor sets index by set id, they live as long as the allocator
         void allocateDescriptorSets()
         {
-            descriptorSets.resize(descriptorSetLayouts.size());
-            VkDescriptorSetAllocateInfo allocateInfo = {};
-            allocateInfo.sType                       = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-            allocateInfo.descriptorPool              = descriptorPool;
-            allocateInfo.descriptorSetCount          = descriptorSetLayouts.size();
-            allocateInfo.pSetLayouts                 = descriptorSetLayouts.data();
-            VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocateInfo, descriptorSets.data()));
+            descriptorSets.clear();
+            for (size_t i = 0; i < descriptorSetLayouts.size(); i++)
+            {
+                descriptorSets.push_back(allocateDescriptorSet(*descriptorAllocator, i));
+            }
+        }
+
+        /// Another set with the layout of set setIndex, e.g. a transient one from a per frame allocator
+        VkDescriptorSet allocateDescriptorSet(dhh::vk::DescriptorAllocator& allocator, size_t setIndex)
+        {
+            const uint32_t set = static_cast<uint32_t>(setIndex);
+            auto variableCount = variableDescriptorCounts.find(set);
+            return allocator.allocate(descriptorSetLayouts[set], bindings.at(set),
+                variableCount != variableDescriptorCounts.end() ? variableCount->second : 0);
+        }
+
+        /// Destroy the Vulkan objects of the pipeline and free its descriptor sets back to the allocator, so hot
+        /// reloads do not use up the pools. Sets from allocateDescriptorSet belong to the caller
+        void destroy()
+        {
+            for (VkDescriptorSet set : descriptorSets)
+            {
+                descriptorAllocator->free(set);
+            }
+            descriptorSets.clear();
+            vkDestroyPipeline(device, pipeline, nullptr);
+            vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+            for (VkDescriptorSetLayout setLayout : descriptorSetLayouts)
+            {
+                vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+            }
+            for (const auto& shaderModule : shaderModules)
+            {
+                vkDestroyShaderModule(device, shaderModule.second, nullptr);
+            }
+        }
+
+        /// Push constants for every stage whose range overlaps [offset, offset + size). Every byte must be pushed with
+        /// exactly the stages whose ranges hold it, so the span is split at the range bounds and each piece is pushed
+        /// with its own stages; bytes outside every range are skipped
+        void pushConstants(VkCommandBuffer commandBuffer, const void* data, uint32_t size, uint32_t offset = 0) const
+        {
+            const uint32_t end = offset + size;
+            std::set<uint32_t> bounds = {offset, end};
+            for (const auto& range : pushConstantRanges)
+            {
+                for (uint32_t bound : {range.offset, range.offset + range.size})
+                {
+                    if (bound > offset && bound < end)
+                    {
+                        bounds.insert(bound);
+                    }
+                }
+            }
+
+            for (auto begin = bounds.begin(), next = std::next(begin); next != bounds.end(); begin = next++)
+            {
+                VkShaderStageFlags stages = 0;
+                for (const auto& range : pushConstantRanges)
+                {
+                    if (range.offset <= *begin && *next <= range.offset + range.size)
+                    {
+                        stages |= range.stageFlags;
+                    }
+                }
+                if (stages != 0)
+                {
+                    vkCmdPushConstants(commandBuffer, pipelineLayout, stages, *begin, *next - *begin,
+                        static_cast<const char*>(data) + (*begin - offset));
+                }
+            }
         }
 
         void createDescriptorSetLayouts()
         {
-            // iterate descriptor group in one set, create decriptor set layout
-            for (const auto& bindingsInSet : bindings)
+            // sets no shader uses get an empty layout, so layouts and descriptor sets index by set id
+            const uint32_t setCount = bindings.empty() ? 0 : bindings.rbegin()->first + 1;
+            for (uint32_t set = 0; set < setCount; set++)
             {
+                const std::vector<VkDescriptorSetLayoutBinding>& bindingsInSet = bindings[set];
+                const std::vector<VkDescriptorBindingFlagsEXT>& flags          = bindingFlags[set];
+
+                VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo = {};
+                flagsInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+                flagsInfo.bindingCount  = static_cast<uint32_t>(flags.size());
+                flagsInfo.pBindingFlags = flags.data();
+
                 VkDescriptorSetLayoutCreateInfo info = {};
                 info.sType                           = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-                info.bindingCount                    = bindingsInSet.second.size();
-                info.pBindings                       = bindingsInSet.second.data();
+                info.bindingCount                    = bindingsInSet.size();
+                info.pBindings                       = bindingsInSet.data();
+                if (variableDescriptorCounts.count(set) != 0)
+                {
+                    info.pNext = &flagsInfo;
+                    info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+                }
                 VkDescriptorSetLayout setLayout;
 
                 vkCreateDescriptorSetLayout(device, &info, nullptr, &setLayout);
@@ -161,8 +375,9 @@ namespace dhh::shader
         }
 
     public:
-        std::vector<VkDescriptorSetLayout> descriptorSetLayouts;
-        std::vector<VkDescriptorSet> descriptorSets;
+        std::vector<VkDescriptorSetLayout> descriptorSetLayouts;  // per set id
+        std::vector<VkDescriptorSet> descriptorSets;              // per set id
+        std::vector<VkPushConstantRange> pushConstantRanges;      // one per stage that declares push constants
         VkPipelineLayout pipelineLayout;
         std::map<ShaderType, VkShaderModule> shaderModules;
         std::vector<VkPipelineShaderStageCreateInfo> shaderStageCreateInfos;
@@ -174,9 +389,17 @@ namespace dhh::shader
 
     private:
         std::map<uint32_t, std::vector<VkDescriptorSetLayoutBinding>> bindings;  // map<set id, bindings group>
+        std::map<uint32_t, std::vector<VkDescriptorBindingFlagsEXT>> bindingFlags;  // map<set id, flags per binding>
+        std::map<uint32_t, uint32_t> variableDescriptorCounts;  // map<set id, size of its runtime array>
         VkDevice device;
-        VkDescriptorPool descriptorPool;
+        dhh::vk::DescriptorAllocator* descriptorAllocator;
         VkRenderPass renderPass;
+        VkPipelineCache pipelineCache;  // shared with other pipelines, owned by the caller
+        SpecializationMap specialization;
+        DescriptorIndexingFeatures descriptorIndexing;  // what the device enabled, all false without the extension
+        std::vector<VkSpecializationInfo> specializationInfos;  // one per shader
+        std::vector<std::vector<VkSpecializationMapEntry>> specializationEntries;
+        std::vector<std::vector<char>> specializationData;
 
         /// A pipeline can only have at most one vertex shader or fragment shader, etc.
         void validateGraphicsPipelineShaders()
@@ -195,33 +418,114 @@ namespace dhh::shader
             }
         }
 
+        /// Merge the descriptors of all stages by set and binding. A runtime array becomes a partially bound,
+        /// update after bind binding with a variable count, which Vulkan only allows as the last binding of its set,
+        /// only in a set without dynamic buffers and only when the device supports it for the descriptor type
         void gatherDescriptorInfo()
         {
-            // merge binding infos from different shaders
-            std::map<uint32_t, DescriptorInfo> infoMerged;  // map<binding, info>
+            std::map<DescriptorKey, DescriptorInfo> infoMerged;  // map<{set, binding}, info>
             for (const auto& shader : shaders)
             {
                 for (const auto& info : shader->descriptorInfos)
                 {
-                    if (infoMerged.find(info.first) != infoMerged.end())
+                    auto merged = infoMerged.find(info.first);
+                    if (merged == infoMerged.end())
                     {
-                        infoMerged[info.first].stages = (infoMerged[info.first].stages | info.second.stages);
+                        infoMerged.insert(info);
+                        continue;
                     }
-                    else
+                    if (merged->second.vkDescriptorType != info.second.vkDescriptorType
+                        || merged->second.count != info.second.count)
                     {
-                        infoMerged.insert({info.second.binding, info.second});
+                        throw std::runtime_error("Stages disagree on set " + std::to_string(info.second.set)
+                                                 + " binding " + std::to_string(info.second.binding));
                     }
+                    merged->second.stages |= info.second.stages;
                 }
             }
 
             for (const auto& info : infoMerged)
             {
+                const uint32_t set = info.second.set;
+                if (variableDescriptorCounts.count(set) != 0)
+                {
+                    throw std::runtime_error("Runtime array must be the last binding of set " + std::to_string(set));
+                }
+
                 VkDescriptorSetLayoutBinding binding = {};
                 binding.binding                      = info.second.binding;
                 binding.descriptorCount              = info.second.count;
                 binding.descriptorType               = info.second.vkDescriptorType;
                 binding.stageFlags                   = info.second.stages;
-                bindings[info.second.set].push_back(binding);
+                bindings[set].push_back(binding);
+
+                VkDescriptorBindingFlagsEXT flags = 0;
+                if (info.second.runtimeArray)
+                {
+                    if (!isRuntimeArraySupported(info.second.vkDescriptorType))
+                    {
+                        throw std::runtime_error("Runtime array at set " + std::to_string(set) + " binding "
+                                                 + std::to_string(info.second.binding)
+                                                 + " needs descriptor indexing with update after bind for its type");
+                    }
+                    flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT
+                            | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT
+                            | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT;
+                    variableDescriptorCounts[set] = info.second.count;
+                }
+                bindingFlags[set].push_back(flags);
+            }
+
+            // an update after bind set can't hold dynamic buffers
+            for (const auto& count : variableDescriptorCounts)
+            {
+                for (const VkDescriptorSetLayoutBinding& binding : bindings[count.first])
+                {
+                    if (binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+                        || binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC)
+                    {
+                        throw std::runtime_error("Dynamic buffer at set " + std::to_string(count.first) + " binding "
+                                                 + std::to_string(binding.binding)
+                                                 + " can't share its set with a runtime array");
+                    }
+                }
+            }
+
+            for (const auto& shader : shaders)
+            {
+                if (shader->pushConstantRange)
+                {
+                    pushConstantRanges.push_back(*shader->pushConstantRange);
+                }
+            }
+        }
+
+        bool isRuntimeArraySupported(VkDescriptorType type) const
+        {
+            if (!descriptorIndexing.runtimeDescriptorArray || !descriptorIndexing.descriptorBindingPartiallyBound
+                || !descriptorIndexing.descriptorBindingVariableDescriptorCount)
+            {
+                return false;
+            }
+            switch (type)
+            {
+            case VK_DESCRIPTOR_TYPE_SAMPLER:
+            case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+            case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+                return descriptorIndexing.descriptorBindingSampledImageUpdateAfterBind;
+            case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+                return descriptorIndexing.descriptorBindingStorageImageUpdateAfterBind;
+            case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+                return descriptorIndexing.descriptorBindingUniformBufferUpdateAfterBind;
+            case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+                return descriptorIndexing.descriptorBindingStorageBufferUpdateAfterBind;
+            case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+                return descriptorIndexing.descriptorBindingUniformTexelBufferUpdateAfterBind;
+            case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+                return descriptorIndexing.descriptorBindingStorageTexelBufferUpdateAfterBind;
+            default:
+                // dynamic buffers and input attachments can't be updated after bind
+                return false;
             }
         }
     };
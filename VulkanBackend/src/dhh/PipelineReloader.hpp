@@ -0,0 +1,180 @@
+#pragma once
+
+#include "Pipeline.hpp"
+#include "ShaderWatcher.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dhh::shader
+{
+    /// Rebuilds pipelines whose shader files changed. Shaders are compiled and the pipeline is created on a worker of
+    /// the reloader's own, never on the pool that records the frames, while the old pipeline keeps running. update() swaps finished pipelines in at a frame boundary, and the
+    /// old ones are retired until no command buffer in flight uses them. A shader that fails to compile keeps the old
+    /// pipeline and prints the error. A shader directory that can't be watched only turns hot reload off
+    class PipelineReloader
+    {
+    public:
+        using BuildFunction = std::function<Pipeline*(const std::vector<Shader*>& shaders)>;
+        using SwapFunction  = std::function<void()>;
+
+        void create(const std::filesystem::path& shadersDirectory)
+        {
+            this->shadersDirectory = shadersDirectory;
+            std::error_code error;
+            if (!watcher.start(shadersDirectory, error))
+            {
+                std::cerr << "Shader hot reload disabled, failed to watch " << shadersDirectory.string() << ": "
+                          << error.message() << "\n";
+                return;
+            }
+            // a single worker, a rebuild queued behind frame recording would stall the frame it was queued in
+            worker = std::make_unique<dhh::thread::ThreadPool>(1);
+        }
+
+        void destroy()
+        {
+            watcher.stop();
+            for (auto& entry : entries)
+            {
+                if (entry.task.valid())
+                {
+                    entry.task.wait();
+                }
+            }
+            destroyRetired();
+            worker.reset();
+        }
+
+        /// pipeline is replaced whenever one of the files changes, build gets the compiled shaders in the order of
+        /// files. onSwap runs after the swap, e.g. to write the new descriptor sets and record command buffers again
+        void add(Pipeline*& pipeline, std::vector<std::string> files, BuildFunction build, SwapFunction onSwap = {})
+        {
+            Entry entry;
+            entry.pipeline = &pipeline;
+            entry.files    = std::move(files);
+            entry.build    = std::move(build);
+            entry.onSwap   = std::move(onSwap);
+            entries.push_back(std::move(entry));
+        }
+
+        /// Start rebuilds for changed files and swap in the pipelines that are done. Call at a frame boundary, when
+        /// nothing is being recorded. Returns true when a pipeline was swapped
+        bool update()
+        {
+            if (entries.empty() || !worker)
+            {
+                return false;
+            }
+            for (const std::string& file : watcher.takeChanged())
+            {
+                for (auto& entry : entries)
+                {
+                    if (std::find(entry.files.begin(), entry.files.end(), file) != entry.files.end())
+                    {
+                        entry.stale = true;
+                    }
+                }
+            }
+
+            bool swapped = false;
+            for (auto& entry : entries)
+            {
+                if (entry.task.valid() && entry.task.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                {
+                    swapped |= swap(entry);
+                }
+                // a file saved again during a rebuild starts another one once the first is done
+                if (entry.stale && !entry.task.valid())
+                {
+                    entry.stale = false;
+                    entry.task  = worker->submit(
+                        [directory = shadersDirectory, files = entry.files, build = entry.build] {
+                            Build result;
+                            std::vector<Shader*> shaders;
+                            for (const std::string& file : files)
+                            {
+                                result.shaders.push_back(std::make_shared<Shader>(directory / file));
+                                shaders.push_back(result.shaders.back().get());
+                            }
+                            result.pipeline = build(shaders);
+                            return result;
+                        });
+                }
+            }
+            return swapped;
+        }
+
+        bool hasRetired() const
+        {
+            return !retired.empty();
+        }
+
+        /// Destroy the replaced pipelines, the caller makes sure none of them is still in use by the GPU
+        void destroyRetired()
+        {
+            for (Pipeline* pipeline : retired)
+            {
+                pipeline->destroy();
+                delete pipeline;
+            }
+            retired.clear();
+        }
+
+    private:
+        /// The pipeline keeps raw pointers to its shaders, they live as long as the pipeline is current
+        struct Build
+        {
+            Pipeline* pipeline;
+            std::vector<std::shared_ptr<Shader>> shaders;
+        };
+
+        struct Entry
+        {
+            Pipeline** pipeline;
+            std::vector<std::string> files;
+            BuildFunction build;
+            SwapFunction onSwap;
+            std::vector<std::shared_ptr<Shader>> shaders;
+            std::future<Build> task;
+            bool stale = false;
+        };
+
+        std::filesystem::path shadersDirectory;
+        std::unique_ptr<dhh::thread::ThreadPool> worker;  // only while the shader directory is watched
+        ShaderWatcher watcher;
+        std::vector<Entry> entries;
+        std::vector<Pipeline*> retired;
+
+        bool swap(Entry& entry)
+        {
+            try
+            {
+                Build result = entry.task.get();
+                retired.push_back(*entry.pipeline);
+                *entry.pipeline = result.pipeline;
+                entry.shaders   = std::move(result.shaders);
+                if (entry.onSwap)
+                {
+                    entry.onSwap();
+                }
+                std::cout << "Reloaded " << entry.files.front() << "\n";
+                return true;
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Failed to reload " << entry.files.front() << ": " << e.what() << "\n";
+                return false;
+            }
+        }
+    };
+}
@@ -4,10 +4,17 @@
 #include <shaderc/shaderc.hpp>
 #include <spirv_cross/spirv_reflect.hpp>
 #include <vulkan/vulkan.h>
+#if __has_include(<glslang/build_info.h>)
+#include <glslang/build_info.h>
+#endif
 
+#include <cstring>
 #include <filesystem>
+#include <iostream>
 #include <map>
 #include <optional>
+#include <string>
+#include <utility>
 
 namespace dhh::shader
 {
@@ -22,10 +29,22 @@ namespace dhh::shader
     struct DescriptorInfo
     {
         uint32_t binding;
-        uint32_t count;
+        uint32_t count;  // array elements, the upper bound for a runtime array
         uint32_t set;
         VkDescriptorType vkDescriptorType;
         VkShaderStageFlags stages;
+        bool runtimeArray;  // declared without a size, bound with descriptor indexing
+    };
+
+    /// Descriptors are keyed by {set, binding}
+    using DescriptorKey = std::pair<uint32_t, uint32_t>;
+
+    struct SpecializationConstantInfo
+    {
+        uint32_t constantId;
+        uint32_t size;  // in bytes, booleans are VkBool32
+        spirv_cross::SPIRType::BaseType baseType;
+        uint64_t defaultValue;
     };
 
     inline VkShaderStageFlagBits getVulkanShaderType(ShaderType Type)
@@ -99,7 +118,7 @@ namespace dhh::shader
         {
             glslText = dhh::filesystem::loadFile(glslPath, false);
             type     = getShaderType(glslPath);
-            spirv    = compile();
+            spirv    = loadOrCompile();
             reflect();
         }
 
@@ -136,6 +155,36 @@ namespace dhh::shader
             return info;
         }
 
+        /// Use the dynamic descriptor type for a reflected uniform or storage buffer, for buffers that are suballocated
+        /// per frame and selected with a dynamic offset at bind time
+        void setDynamic(uint32_t binding, uint32_t set = 0)
+        {
+            auto info = findDescriptorInfo(binding, set);
+            switch (info->second.vkDescriptorType)
+            {
+            case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+                info->second.vkDescriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+                break;
+            case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+                info->second.vkDescriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+                break;
+            default:
+                throw std::runtime_error("Only buffers can be dynamic");
+            }
+        }
+
+        /// Upper bound of a runtime array such as `uniform sampler2D textures[]`, the whole bindless table is allocated
+        /// with this many descriptors
+        void setRuntimeArrayCount(uint32_t binding, uint32_t count, uint32_t set = 0)
+        {
+            auto info = findDescriptorInfo(binding, set);
+            if (!info->second.runtimeArray)
+            {
+                throw std::runtime_error("No runtime array at binding " + std::to_string(binding));
+            }
+            info->second.count = count;
+        }
+
         VkShaderModule createVulkanShaderModule(VkDevice device)
         {
             VkShaderModuleCreateInfo createInfo = {};
@@ -154,7 +203,9 @@ namespace dhh::shader
 
     public:
         ShaderType type;
-        std::map<uint32_t, DescriptorInfo> descriptorInfos;  // multimap<Descriptor binding, DescriptorInfo>
+        std::map<DescriptorKey, DescriptorInfo> descriptorInfos;  // map<{set, binding}, DescriptorInfo>
+        std::optional<VkPushConstantRange> pushConstantRange;    // the push constant block the stage declares
+        std::map<std::string, SpecializationConstantInfo> specializationConstants;  // map<GLSL name, info>
         std::filesystem::path glslPath;
 
     private:
@@ -163,16 +214,113 @@ namespace dhh::shader
         std::vector<VkVertexInputAttributeDescription> vertexInputAttributeDescriptions;
         size_t stageInputSize;
 
-        std::vector<uint32_t> compile(bool optimize = false)
+        bool optimize = false;
+
+        static constexpr uint32_t DefaultRuntimeArrayCount = 1024;
+
+        /// Header in front of the SPIR-V words of a cache file
+        struct SpirvCacheHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t key;
+        };
+
+        static constexpr uint32_t SpirvCacheMagic   = 0x56505344;  // "DSPV"
+        static constexpr uint32_t SpirvCacheVersion = 1;
+
+        /// Use the SPIR-V from the on-disk cache when its key matches the current source and options, so shaderc is
+        /// only invoked for shaders that changed
+        std::vector<uint32_t> loadOrCompile()
+        {
+            const std::filesystem::path cachePath = getSpirvCachePath();
+            const uint64_t key                    = getSpirvCacheKey();
+
+            {
+                dhh::filesystem::MappedFile cached(cachePath);
+                const size_t headerSize = sizeof(SpirvCacheHeader);
+                if (cached.isValid() && cached.size() > headerSize
+                    && (cached.size() - headerSize) % sizeof(uint32_t) == 0)
+                {
+                    SpirvCacheHeader header;
+                    std::memcpy(&header, cached.data(), headerSize);
+                    if (header.magic == SpirvCacheMagic && header.version == SpirvCacheVersion && header.key == key)
+                    {
+                        std::vector<uint32_t> code((cached.size() - headerSize) / sizeof(uint32_t));
+                        std::memcpy(code.data(), static_cast<const char*>(cached.data()) + headerSize,
+                            code.size() * sizeof(uint32_t));
+                        if (code[0] == spv::MagicNumber)
+                        {
+                            return code;
+                        }
+                    }
+                }
+            }
+
+            std::vector<uint32_t> code = compile();
+
+            SpirvCacheHeader header = {SpirvCacheMagic, SpirvCacheVersion, key};
+            std::vector<char> blob(sizeof(header) + code.size() * sizeof(uint32_t));
+            std::memcpy(blob.data(), &header, sizeof(header));
+            std::memcpy(blob.data() + sizeof(header), code.data(), code.size() * sizeof(uint32_t));
+            try
+            {
+                dhh::filesystem::writeFile(cachePath, blob.data(), blob.size());
+            }
+            catch (const std::exception& e)
+            {
+                // a read-only shader directory only costs us the cache
+                std::cerr << "Failed to write SPIR-V cache: " << e.what() << "\n";
+            }
+            return code;
+        }
+
+        std::filesystem::path getSpirvCachePath() const
+        {
+            return glslPath.parent_path() / "spirv_cache" / (glslPath.filename().string() + ".spv");
+        }
+
+        /// FNV-1a over everything that affects the compiled module. The shaders have no #include and no macro
+        /// definitions are passed to shaderc, so the source text, stage and optimization level cover it, together
+        /// with the compiler version so an upgraded toolchain compiles everything again
+        uint64_t getSpirvCacheKey() const
         {
-            shaderc::Compiler compiler;
+            uint64_t hash     = 14695981039346656037ull;
+            const auto append = [&hash](const void* data, size_t size) {
+                const unsigned char* bytes = static_cast<const unsigned char*>(data);
+                for (size_t i = 0; i < size; i++)
+                {
+                    hash = (hash ^ bytes[i]) * 1099511628211ull;
+                }
+            };
+            const uint32_t kind = getShadercShaderType(type);
+            append(glslText.data(), glslText.size());
+            append(&kind, sizeof(kind));
+            append(&optimize, sizeof(optimize));
+
+            // the SPIR-V version shaderc targets, and the glslang front end it was built with where its headers say
+            unsigned int spirvVersion = 0, spirvRevision = 0;
+            shaderc_get_spv_version(&spirvVersion, &spirvRevision);
+            append(&spirvVersion, sizeof(spirvVersion));
+            append(&spirvRevision, sizeof(spirvRevision));
+#ifdef GLSLANG_VERSION_MAJOR
+            const int glslangVersion[] = {GLSLANG_VERSION_MAJOR, GLSLANG_VERSION_MINOR, GLSLANG_VERSION_PATCH};
+            append(glslangVersion, sizeof(glslangVersion));
+#endif
+            return hash;
+        }
+
+        std::vector<uint32_t> compile()
+        {
+            // shaderc::Compiler is expensive to construct, keep one per thread
+            thread_local shaderc::Compiler compiler;
             shaderc::CompileOptions options;
             if (optimize)
             {
                 options.SetOptimizationLevel(shaderc_optimization_level_performance);
             }
-            shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(
-                glslText.data(), getShadercShaderType(type), glslPath.filename().string().c_str(), options);
+            shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(glslText.data(), glslText.size(),
+                getShadercShaderType(type), glslPath.filename().string().c_str(), options);
             if (module.GetCompilationStatus() != shaderc_compilation_status_success)
             {
                 throw std::runtime_error(module.GetErrorMessage().c_str());
@@ -203,31 +351,97 @@ namespace dhh::shader
                 stageInputSize += InputType.width * InputType.vecsize / 8;
             }
 
-            // Uniform buffer descriptor info
-            for (const spirv_cross::Resource& resource : shaderResources.uniform_buffers)
+            // samplerBuffer, textureBuffer and imageBuffer show up as images with a buffer dimension
+            reflectDescriptors(compiler, shaderResources.uniform_buffers, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+            reflectDescriptors(compiler, shaderResources.storage_buffers, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+            reflectDescriptors(compiler, shaderResources.sampled_images, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER);
+            reflectDescriptors(compiler, shaderResources.separate_images, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+                VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER);
+            reflectDescriptors(compiler, shaderResources.separate_samplers, VK_DESCRIPTOR_TYPE_SAMPLER);
+            reflectDescriptors(compiler, shaderResources.storage_images, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER);
+            reflectDescriptors(compiler, shaderResources.subpass_inputs, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT);
+
+            reflectPushConstants(compiler, shaderResources);
+            reflectSpecializationConstants(compiler);
+        }
+
+        void reflectDescriptors(const spirv_cross::CompilerReflection& compiler,
+            const spirv_cross::SmallVector<spirv_cross::Resource>& resources, VkDescriptorType descriptorType,
+            VkDescriptorType texelBufferType = VK_DESCRIPTOR_TYPE_MAX_ENUM)
+        {
+            for (const spirv_cross::Resource& resource : resources)
             {
                 DescriptorInfo info   = reflect_descriptor(compiler, resource);
-                info.vkDescriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-                descriptorInfos.insert({info.binding, info});
+                info.vkDescriptorType = descriptorType;
+
+                const spirv_cross::SPIRType& resourceType = compiler.get_type(resource.type_id);
+                if (texelBufferType != VK_DESCRIPTOR_TYPE_MAX_ENUM && resourceType.image.dim == spv::DimBuffer)
+                {
+                    info.vkDescriptorType = texelBufferType;
+                }
+                descriptorInfos.insert({{info.set, info.binding}, info});
             }
+        }
 
-            // Sampled image descriptor info
-            for (const spirv_cross::Resource& resource : shaderResources.sampled_images)
+        /// A stage has at most one push constant block, its range starts at the first member so that stages can
+        /// declare disjoint parts of the pipeline's push constants with layout(offset = ...)
+        void reflectPushConstants(
+            const spirv_cross::CompilerReflection& compiler, const spirv_cross::ShaderResources& shaderResources)
+        {
+            for (const spirv_cross::Resource& resource : shaderResources.push_constant_buffers)
             {
-                DescriptorInfo info   = reflect_descriptor(compiler, resource);
-                info.vkDescriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-                descriptorInfos.insert({info.binding, info});
+                const spirv_cross::SPIRType& blockType = compiler.get_type(resource.base_type_id);
+                const uint32_t size   = static_cast<uint32_t>(compiler.get_declared_struct_size(blockType));
+                const uint32_t offset = compiler.type_struct_member_offset(blockType, 0);
+
+                VkPushConstantRange range = {};
+                range.stageFlags          = getVulkanShaderType(type);
+                range.offset              = offset;
+                range.size                = size - offset;
+                pushConstantRange         = range;
             }
+        }
+
+        /// Work group sizes given with local_size_*_id are unnamed in SPIR-V, they are exposed as local_size_x/y/z
+        void reflectSpecializationConstants(const spirv_cross::CompilerReflection& compiler)
+        {
+            spirv_cross::SpecializationConstant workGroupSize[3];
+            compiler.get_work_group_size_specialization_constants(workGroupSize[0], workGroupSize[1], workGroupSize[2]);
+            const char* workGroupSizeNames[] = {"local_size_x", "local_size_y", "local_size_z"};
 
-            // storage buffer descriptor info
-            for (const spirv_cross::Resource& resource : shaderResources.storage_buffers)
+            for (const spirv_cross::SpecializationConstant& constant : compiler.get_specialization_constants())
             {
-                DescriptorInfo info   = reflect_descriptor(compiler, resource);
-                info.vkDescriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-                descriptorInfos.insert({info.binding, info});
+                std::string name = compiler.get_name(constant.id);
+                for (int i = 0; i < 3; i++)
+                {
+                    if (workGroupSize[i].id == constant.id)
+                    {
+                        name = workGroupSizeNames[i];
+                    }
+                }
+                if (name.empty())
+                {
+                    name = "constant_" + std::to_string(constant.constant_id);
+                }
+
+                const spirv_cross::SPIRConstant& value = compiler.get_constant(constant.id);
+                const spirv_cross::SPIRType& valueType = compiler.get_type(value.constant_type);
+
+                const bool isBoolean = valueType.basetype == spirv_cross::SPIRType::Boolean;
+
+                SpecializationConstantInfo info = {};
+                info.constantId                 = constant.constant_id;
+                info.baseType                   = valueType.basetype;
+                info.size                       = isBoolean ? sizeof(VkBool32) : valueType.width / 8;
+                info.defaultValue               = info.size == 8 ? value.scalar_u64() : value.scalar();
+                specializationConstants.insert({name, info});
             }
         }
 
+        /// Arrays of descriptors bind one descriptor per element, arrays of arrays are flattened. A size given by a
+        /// specialization constant uses its default value, a runtime array gets DefaultRuntimeArrayCount
         DescriptorInfo reflect_descriptor(
             const spirv_cross::CompilerReflection& compiler, const spirv_cross::Resource& resource)
         {
@@ -235,9 +449,35 @@ namespace dhh::shader
             uint32_t set        = compiler.get_decoration(resource.id, spv::DecorationDescriptorSet);
             DescriptorInfo info = {};
             info.binding        = compiler.get_decoration(resource.id, spv::DecorationBinding);
-            info.count          = 1;  // TODO: need a fix for array
+            info.count          = 1;
             info.set            = set;
             info.stages         = getVulkanShaderType(type);
+
+            for (size_t i = 0; i < descriptorType.array.size(); i++)
+            {
+                uint32_t size = descriptorType.array[i];
+                if (!descriptorType.array_size_literal[i])
+                {
+                    size = compiler.get_constant(size).scalar();
+                }
+                if (size == 0)
+                {
+                    info.runtimeArray = true;
+                    size              = DefaultRuntimeArrayCount;
+                }
+                info.count *= size;
+            }
+            return info;
+        }
+
+        std::map<DescriptorKey, DescriptorInfo>::iterator findDescriptorInfo(uint32_t binding, uint32_t set)
+        {
+            auto info = descriptorInfos.find({set, binding});
+            if (info == descriptorInfos.end())
+            {
+                throw std::runtime_error(
+                    "No descriptor at set " + std::to_string(set) + " binding " + std::to_string(binding));
+            }
             return info;
         }
 
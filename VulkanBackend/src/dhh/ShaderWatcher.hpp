@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace dhh::shader
+{
+    /// Collects the names of files written in a directory, from a thread of its own. Uses inotify on Linux, elsewhere
+    /// the modification times are polled. Subdirectories such as the SPIR-V cache are not watched
+    class ShaderWatcher
+    {
+    public:
+        ~ShaderWatcher()
+        {
+            stop();
+        }
+
+        /// False with the reason in error when the directory can't be watched, e.g. when the inotify limits are hit.
+        /// Nothing is collected then
+        bool start(const std::filesystem::path& directory, std::error_code& error)
+        {
+            this->directory = directory;
+#ifdef __linux__
+            // editors either write the file in place or write a temporary file and rename it over the original
+            fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (fd < 0 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+            {
+                error = std::error_code(errno, std::generic_category());
+                if (fd >= 0)
+                {
+                    close(fd);
+                    fd = -1;
+                }
+                return false;
+            }
+#endif
+            running = true;
+            thread  = std::thread([this] { watch(); });
+            return true;
+        }
+
+        void stop()
+        {
+            running = false;
+            if (thread.joinable())
+            {
+                thread.join();
+            }
+#ifdef __linux__
+            if (fd >= 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+#endif
+        }
+
+        /// Names of the files written since the last call, an editor saving a file several times shows up once
+        std::set<std::string> takeChanged()
+        {
+            std::set<std::string> result;
+            std::lock_guard<std::mutex> lock(mutex);
+            result.swap(changed);
+            return result;
+        }
+
+    private:
+        std::filesystem::path directory;
+        std::thread thread;
+        std::atomic<bool> running{false};
+        std::mutex mutex;
+        std::set<std::string> changed;
+#ifdef __linux__
+        int fd = -1;
+#endif
+
+        static constexpr int PollIntervalMs = 100;
+
+        void addChanged(const std::string& filename)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            changed.insert(filename);
+        }
+
+#ifdef __linux__
+        void watch()
+        {
+            alignas(inotify_event) char buffer[4096];
+            while (running)
+            {
+                pollfd pollInfo = {fd, POLLIN, 0};
+                if (poll(&pollInfo, 1, PollIntervalMs) <= 0)
+                {
+                    continue;
+                }
+                const ssize_t length = read(fd, buffer, sizeof(buffer));
+                for (ssize_t offset = 0; offset < length;)
+                {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                    if (event->len > 0)
+                    {
+                        addChanged(event->name);
+                    }
+                    offset += sizeof(inotify_event) + event->len;
+                }
+            }
+        }
+#else
+        void watch()
+        {
+            std::map<std::string, std::filesystem::file_time_type> writeTimes;
+            bool first = true;
+            while (running)
+            {
+                std::error_code error;
+                for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+                {
+                    if (!entry.is_regular_file(error))
+                    {
+                        continue;
+                    }
+                    const std::string filename = entry.path().filename().string();
+                    const auto writeTime       = entry.last_write_time(error);
+                    auto known                 = writeTimes.find(filename);
+                    if (known == writeTimes.end() || known->second != writeTime)
+                    {
+                        writeTimes[filename] = writeTime;
+                        if (!first)
+                        {
+                            addChanged(filename);
+                        }
+                    }
+                }
+                first = false;
+                std::this_thread::sleep_for(std::chrono::milliseconds(PollIntervalMs));
+            }
+        }
+#endif
+    };
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace dhh::thread
+{
+    /// Fixed number of workers pulling tasks from one FIFO queue. Tasks are started in submission order, so a task may
+    /// block on the future of a task submitted before it without deadlocking the pool
+    class ThreadPool
+    {
+    public:
+        explicit ThreadPool(size_t threadCount = std::max(1u, std::thread::hardware_concurrency()))
+        {
+            for (size_t i = 0; i < threadCount; i++)
+            {
+                workers.emplace_back([this] { workerLoop(); });
+            }
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            condition.notify_all();
+            for (auto& worker : workers)
+            {
+                worker.join();
+            }
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        template <typename Function>
+        std::future<std::invoke_result_t<Function>> submit(Function&& function)
+        {
+            using Result = std::invoke_result_t<Function>;
+            auto task    = std::make_shared<std::packaged_task<Result()>>(std::forward<Function>(function));
+            std::future<Result> result = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.emplace([task] { (*task)(); });
+            }
+            condition.notify_one();
+            return result;
+        }
+
+        size_t size() const
+        {
+            return workers.size();
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool stopping = false;
+
+        void workerLoop()
+        {
+            while (true)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+                    if (stopping && tasks.empty())
+                    {
+                        return;
+                    }
+                    task = std::move(tasks.front());
+                    tasks.pop();
+                }
+                task();
+            }
+        }
+    };
+}
@@ -0,0 +1,391 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace dhh::vk
+{
+    /// Copies host data into DEVICE_LOCAL buffers and images through staging memory on the transfer queue.
+    /// Uploads are recorded into a batch until flush(). A flushed batch releases the resources from the transfer queue
+    /// family and acquires them on the graphics queue, so work submitted to the graphics queue afterwards sees the data.
+    /// Two batches alternate, a batch's staging memory is reused once its fence has signaled. Not thread safe
+    class UploadManager
+    {
+    public:
+        void create(VkDevice device, VmaAllocator allocator, VkQueue transferQueue, uint32_t transferFamily,
+            VkQueue graphicsQueue, uint32_t graphicsFamily, VkDeviceSize stagingSize = 16 * 1024 * 1024)
+        {
+            this->device         = device;
+            this->allocator      = allocator;
+            this->transferQueue  = transferQueue;
+            this->transferFamily = transferFamily;
+            this->graphicsQueue  = graphicsQueue;
+            this->graphicsFamily = graphicsFamily;
+            this->stagingSize    = stagingSize;
+
+            transferPool = createCommandPool(transferFamily);
+            graphicsPool = createCommandPool(graphicsFamily);
+
+            for (Batch& batch : batches)
+            {
+                createStagingBuffer(stagingSize, batch.stagingBuffer, batch.stagingAllocation, batch.stagingData);
+                batch.transferCommandBuffer = allocateCommandBuffer(transferPool);
+                batch.acquireCommandBuffer  = allocateCommandBuffer(graphicsPool);
+
+                VkSemaphoreCreateInfo semaphoreInfo = {};
+                semaphoreInfo.sType                 = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+                VkFenceCreateInfo fenceInfo         = {};
+                fenceInfo.sType                     = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+                if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &batch.transferDone) != VK_SUCCESS
+                    || vkCreateFence(device, &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("Failed to create upload synchronization objects");
+                }
+            }
+        }
+
+        void destroy()
+        {
+            waitIdle();
+            for (Batch& batch : batches)
+            {
+                releaseOverflowBuffers(batch);
+                vmaDestroyBuffer(allocator, batch.stagingBuffer, batch.stagingAllocation);
+                vkDestroySemaphore(device, batch.transferDone, nullptr);
+                vkDestroyFence(device, batch.fence, nullptr);
+            }
+            vkDestroyCommandPool(device, transferPool, nullptr);
+            vkDestroyCommandPool(device, graphicsPool, nullptr);
+        }
+
+        /// The buffer needs VK_BUFFER_USAGE_TRANSFER_DST_BIT
+        void uploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize offset = 0)
+        {
+            Staging staging = stage(data, size);
+            Batch& batch    = batches[current];
+
+            VkBufferCopy region = {};
+            region.srcOffset    = staging.offset;
+            region.dstOffset    = offset;
+            region.size         = size;
+            vkCmdCopyBuffer(batch.transferCommandBuffer, staging.buffer, buffer, 1, &region);
+
+            if (transferFamily != graphicsFamily)
+            {
+                VkBufferMemoryBarrier barrier = {};
+                barrier.sType                 = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                barrier.srcQueueFamilyIndex   = transferFamily;
+                barrier.dstQueueFamilyIndex   = graphicsFamily;
+                barrier.buffer                = buffer;
+                barrier.offset                = offset;
+                barrier.size                  = size;
+                batch.bufferBarriers.push_back(barrier);
+            }
+        }
+
+        /// Upload one mip level of a 2D color image that has VK_IMAGE_USAGE_TRANSFER_DST_BIT. The level is left in
+        /// finalLayout, ready for the graphics queue
+        void uploadImage(VkImage image, uint32_t width, uint32_t height, const void* data, VkDeviceSize size,
+            VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, uint32_t mipLevel = 0)
+        {
+            Staging staging = stage(data, size);
+            Batch& batch    = batches[current];
+
+            VkImageMemoryBarrier barrier            = {};
+            barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.srcAccessMask                   = 0;
+            barrier.dstAccessMask                   = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.oldLayout                       = VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier.newLayout                       = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image                           = image;
+            barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+            barrier.subresourceRange.baseMipLevel   = mipLevel;
+            barrier.subresourceRange.levelCount     = 1;
+            barrier.subresourceRange.baseArrayLayer = 0;
+            barrier.subresourceRange.layerCount     = 1;
+            vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+            VkBufferImageCopy region           = {};
+            region.bufferOffset                = staging.offset;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel   = mipLevel;
+            region.imageSubresource.layerCount = 1;
+            region.imageExtent                 = {width, height, 1};
+            vkCmdCopyBufferToImage(batch.transferCommandBuffer, staging.buffer, image,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+            // the layout transition is part of the release, and repeated identically by the acquire
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = 0;
+            barrier.oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout     = finalLayout;
+            if (transferFamily != graphicsFamily)
+            {
+                barrier.srcQueueFamilyIndex = transferFamily;
+                barrier.dstQueueFamilyIndex = graphicsFamily;
+                batch.imageBarriers.push_back(barrier);
+            }
+            else
+            {
+                vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+            }
+        }
+
+        /// Submit everything recorded since the last flush
+        void flush()
+        {
+            Batch& batch = batches[current];
+            if (!batch.recording)
+            {
+                return;
+            }
+
+            // release on the transfer queue
+            for (auto& barrier : batch.bufferBarriers)
+            {
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.dstAccessMask = 0;
+            }
+            recordBarriers(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, batch);
+            vkEndCommandBuffer(batch.transferCommandBuffer);
+
+            // acquire on the graphics queue
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags                    = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            vkBeginCommandBuffer(batch.acquireCommandBuffer, &beginInfo);
+            for (auto& barrier : batch.bufferBarriers)
+            {
+                barrier.srcAccessMask = 0;
+                barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+            }
+            for (auto& barrier : batch.imageBarriers)
+            {
+                barrier.srcAccessMask = 0;
+                barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+            }
+            recordBarriers(batch.acquireCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, batch);
+            vkEndCommandBuffer(batch.acquireCommandBuffer);
+
+            VkSubmitInfo transferSubmit         = {};
+            transferSubmit.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            transferSubmit.commandBufferCount   = 1;
+            transferSubmit.pCommandBuffers      = &batch.transferCommandBuffer;
+            transferSubmit.signalSemaphoreCount = 1;
+            transferSubmit.pSignalSemaphores    = &batch.transferDone;
+            if (vkQueueSubmit(transferQueue, 1, &transferSubmit, VK_NULL_HANDLE) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to submit uploads");
+            }
+
+            // the semaphore wait also orders everything submitted to the graphics queue later after the copies
+            const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            VkSubmitInfo acquireSubmit           = {};
+            acquireSubmit.sType                  = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            acquireSubmit.waitSemaphoreCount     = 1;
+            acquireSubmit.pWaitSemaphores        = &batch.transferDone;
+            acquireSubmit.pWaitDstStageMask      = &waitStage;
+            acquireSubmit.commandBufferCount     = 1;
+            acquireSubmit.pCommandBuffers        = &batch.acquireCommandBuffer;
+            if (vkQueueSubmit(graphicsQueue, 1, &acquireSubmit, batch.fence) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to submit upload acquire");
+            }
+
+            batch.recording = false;
+            batch.pending   = true;
+            batch.bufferBarriers.clear();
+            batch.imageBarriers.clear();
+            current = (current + 1) % batches.size();
+        }
+
+        /// Block until every flushed upload has completed
+        void waitIdle()
+        {
+            for (Batch& batch : batches)
+            {
+                retire(batch);
+            }
+        }
+
+    private:
+        struct Batch
+        {
+            VkBuffer stagingBuffer;
+            VmaAllocation stagingAllocation;
+            char* stagingData;
+            VkDeviceSize head = 0;
+            // dedicated staging for uploads that do not fit, freed when the batch retires
+            std::vector<std::pair<VkBuffer, VmaAllocation>> overflowBuffers;
+
+            VkCommandBuffer transferCommandBuffer;
+            VkCommandBuffer acquireCommandBuffer;
+            VkSemaphore transferDone;
+            VkFence fence;
+            bool recording = false;
+            bool pending   = false;
+
+            std::vector<VkBufferMemoryBarrier> bufferBarriers;  // queue family ownership transfers
+            std::vector<VkImageMemoryBarrier> imageBarriers;
+        };
+
+        struct Staging
+        {
+            VkBuffer buffer;
+            VkDeviceSize offset;
+        };
+
+        VkDevice device;
+        VmaAllocator allocator;
+        VkQueue transferQueue;
+        uint32_t transferFamily;
+        VkQueue graphicsQueue;
+        uint32_t graphicsFamily;
+        VkDeviceSize stagingSize;
+        VkCommandPool transferPool;
+        VkCommandPool graphicsPool;
+        std::array<Batch, 2> batches;
+        size_t current = 0;
+
+        Staging stage(const void* data, VkDeviceSize size)
+        {
+            beginBatch();
+            Batch* batch = &batches[current];
+
+            if (size > stagingSize)
+            {
+                VkBuffer buffer;
+                VmaAllocation allocation;
+                char* mapped;
+                createStagingBuffer(size, buffer, allocation, mapped);
+                std::memcpy(mapped, data, size);
+                vmaFlushAllocation(allocator, allocation, 0, VK_WHOLE_SIZE);
+                batch->overflowBuffers.push_back({buffer, allocation});
+                return {buffer, 0};
+            }
+
+            // 16 covers the texel size alignment of buffer to image copies
+            VkDeviceSize offset = (batch->head + 15) / 16 * 16;
+            if (offset + size > stagingSize)
+            {
+                flush();
+                beginBatch();
+                batch  = &batches[current];
+                offset = 0;
+            }
+            std::memcpy(batch->stagingData + offset, data, size);
+            vmaFlushAllocation(allocator, batch->stagingAllocation, offset, size);
+            batch->head = offset + size;
+            return {batch->stagingBuffer, offset};
+        }
+
+        void beginBatch()
+        {
+            Batch& batch = batches[current];
+            if (batch.recording)
+            {
+                return;
+            }
+            retire(batch);
+            batch.head = 0;
+
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags                    = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            vkBeginCommandBuffer(batch.transferCommandBuffer, &beginInfo);
+            batch.recording = true;
+        }
+
+        void retire(Batch& batch)
+        {
+            if (!batch.pending)
+            {
+                return;
+            }
+            vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+            vkResetFences(device, 1, &batch.fence);
+            releaseOverflowBuffers(batch);
+            batch.pending = false;
+        }
+
+        void releaseOverflowBuffers(Batch& batch)
+        {
+            for (const auto& overflow : batch.overflowBuffers)
+            {
+                vmaDestroyBuffer(allocator, overflow.first, overflow.second);
+            }
+            batch.overflowBuffers.clear();
+        }
+
+        void recordBarriers(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage,
+            const Batch& batch)
+        {
+            if (batch.bufferBarriers.empty() && batch.imageBarriers.empty())
+            {
+                return;
+            }
+            vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr,
+                static_cast<uint32_t>(batch.bufferBarriers.size()), batch.bufferBarriers.data(),
+                static_cast<uint32_t>(batch.imageBarriers.size()), batch.imageBarriers.data());
+        }
+
+        void createStagingBuffer(VkDeviceSize size, VkBuffer& buffer, VmaAllocation& allocation, char*& mapped)
+        {
+            VkBufferCreateInfo bufferInfo = {};
+            bufferInfo.sType              = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size               = size;
+            bufferInfo.usage              = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+            bufferInfo.sharingMode        = VK_SHARING_MODE_EXCLUSIVE;
+
+            VmaAllocationCreateInfo allocationInfo = {};
+            allocationInfo.usage                   = VMA_MEMORY_USAGE_CPU_ONLY;
+            allocationInfo.flags                   = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+            VmaAllocationInfo info;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocationInfo, &buffer, &allocation, &info) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create staging buffer");
+            }
+            mapped = static_cast<char*>(info.pMappedData);
+        }
+
+        VkCommandPool createCommandPool(uint32_t family)
+        {
+            VkCommandPoolCreateInfo poolInfo = {};
+            poolInfo.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags                   = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            poolInfo.queueFamilyIndex        = family;
+
+            VkCommandPool pool;
+            if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create upload command pool");
+            }
+            return pool;
+        }
+
+        VkCommandBuffer allocateCommandBuffer(VkCommandPool pool)
+        {
+            VkCommandBufferAllocateInfo info = {};
+            info.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            info.commandPool                 = pool;
+            info.level                       = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            info.commandBufferCount          = 1;
+
+            VkCommandBuffer commandBuffer;
+            vkAllocateCommandBuffers(device, &info, &commandBuffer);
+            return commandBuffer;
+        }
+    };
+}
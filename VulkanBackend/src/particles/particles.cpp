@@ -15,6 +15,7 @@
 #include <vector>
 
 #define BODIES_COUNT 6144
+#define WORKGROUP_SIZE 256
 
 struct Body
 {
@@ -50,12 +51,12 @@ class Triangle : public VulkanBase
         VkBuffer buffer;
     } computeBuffer_;
 
-
+    // host copy of computeBuffer_, refreshed at the end of every dispatch
     struct
     {
         VmaAllocation memory;
         VkBuffer buffer;
-    } cameraBuffer_;
+    } readbackBuffer_;
 
     struct Transforms
     {
@@ -70,49 +71,46 @@ public:
     dhh::shader::Pipeline* cach_pipe;
     std::vector<Body> bodies;
 
-    Triangle() : VulkanBase(false)
+    explicit Triangle(bool headless) : VulkanBase(false, headless)
     {
         init();
         FillBodyInitialStates();
         CreateTrianglePipeline();
         CreateComputePipeline();
-        CreateCameraBuffer();
         WriteGraphicsDescriptorSet();
         CreateComputeBuffer();
         CreateVertexBuffer();
+        uploadManager.flush();
         BuildCommandBuffers();
         WriteComputeDescriptorSet();
         BuildComputeCommandBuffers();
         Compute();
     }
 
+    ~Triangle() override
+    {
+        vkDestroyFence(device, compute_fence_, nullptr);
+    }
+
     void UpdateTransform()
     {
         dhh::input::processKeyboard(window, camera);
 
-        void* data;
-        vmaMapMemory(allocator, cameraBuffer_.memory, &data);
+        // must be the first allocation of the frame, the command buffers were recorded with that offset
         Transforms transforms{
             {glm::perspective(glm::radians(camera.Zoom), (float) windowWidth / windowHeight, 0.1F, 1000.F)},
             {camera.GetViewMatrix()}, {glm::mat4(1.F)}};
 
-        memcpy(data, &transforms, sizeof(transforms));
-        vmaUnmapMemory(allocator, cameraBuffer_.memory);
-    }
-
-    void CreateCameraBuffer()
-    {
-        createBuffer(sizeof(glm::mat4) * 4, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
-            cameraBuffer_.buffer, cameraBuffer_.memory);
+        frameAllocator.push(transforms);
     }
 
     void WriteGraphicsDescriptorSet()
     {
         VkDescriptorBufferInfo buffer_info =
-            dhh::vk::initializer::descriptorBufferInfo(cameraBuffer_.buffer, 0, VK_WHOLE_SIZE);
+            dhh::vk::initializer::descriptorBufferInfo(frameAllocator.buffer, 0, sizeof(Transforms));
 
         VkWriteDescriptorSet write = dhh::vk::initializer::writeDescriptorSet(
-            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, 0, triangle_pipe->descriptorSets[0], &buffer_info);
+            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, 0, triangle_pipe->descriptorSets[0], &buffer_info);
 
         vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
     }
@@ -189,51 +187,53 @@ public:
 
     void Compute()
     {
-        VkFence complete_fence;
-        VkFence sdf;
-
-        VkFenceCreateInfo fence_create_info = dhh::vk::initializer::fenceCreateInfo();
-        vkCreateFence(device, &fence_create_info, nullptr, &complete_fence);
-
         VkSubmitInfo submit_info       = {};
         submit_info.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
         submit_info.commandBufferCount = 1;
         submit_info.pCommandBuffers    = &compute_cmd_buf;
 
-        auto now = std::chrono::high_resolution_clock::now();
-        vkQueueSubmit(graphicsQueue, 1, &submit_info, complete_fence);
-        vkWaitForFences(device, 1, &complete_fence, true, UINT64_MAX);
-        vkResetFences(device, 1, &complete_fence);
-
-        // std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(
-        // std::chrono::high_resolution_clock::now() - now).count() << std::endl;
+        vkQueueSubmit(graphicsQueue, 1, &submit_info, compute_fence_);
+        gpuProfiler.submitted(compute_profiler_slot_);
+        vkWaitForFences(device, 1, &compute_fence_, true, UINT64_MAX);
+        vkResetFences(device, 1, &compute_fence_);
+        gpuProfiler.collect(compute_profiler_slot_);
 
         void* data;
-        vmaMapMemory(allocator, computeBuffer_.memory, &data);
+        vmaMapMemory(allocator, readbackBuffer_.memory, &data);
+        vmaInvalidateAllocation(allocator, readbackBuffer_.memory, 0, VK_WHOLE_SIZE);
         std::vector<Body> fuck(BODIES_COUNT);
         memcpy(fuck.data(), data, sizeof(Body) * BODIES_COUNT);
-        vmaUnmapMemory(allocator, computeBuffer_.memory);
+        vmaUnmapMemory(allocator, readbackBuffer_.memory);
 
         std::cout << glm::to_string(fuck[5000].position) << "\n";
     }
 
     VkCommandBuffer compute_cmd_buf;
+    VkFence compute_fence_ = VK_NULL_HANDLE;  // Compute() waits on it, so it is never in flight after
+    uint32_t compute_profiler_slot_;
 
     void BuildComputeCommandBuffers()
     {
+        compute_profiler_slot_ = gpuProfiler.allocateSlots(1);
         VkCommandBufferAllocateInfo info =
             dhh::vk::initializer::commandBufferAllocateInfo(commandPool, 1, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
         vkAllocateCommandBuffers(device, &info, &compute_cmd_buf);
+        VkFenceCreateInfo fence_create_info = dhh::vk::initializer::fenceCreateInfo();
+        vkCreateFence(device, &fence_create_info, nullptr, &compute_fence_);
         VkCommandBufferBeginInfo begin_info =
             dhh::vk::initializer::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
         vkBeginCommandBuffer(compute_cmd_buf, &begin_info);
+        gpuProfiler.reset(compute_cmd_buf, compute_profiler_slot_);
 
         // calculate
 
         vkCmdBindPipeline(compute_cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, comput_pipe->pipeline);
         vkCmdBindDescriptorSets(compute_cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, comput_pipe->pipelineLayout, 0, 1,
             comput_pipe->descriptorSets.data(), 0, nullptr);
-        vkCmdDispatch(compute_cmd_buf, BODIES_COUNT / 256, 1, 1);
+        {
+            dhh::vk::GpuProfiler::Scope scope(gpuProfiler, compute_cmd_buf, "nbody.comp", compute_profiler_slot_);
+            vkCmdDispatch(compute_cmd_buf, (BODIES_COUNT + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+        }
 
         VkBufferMemoryBarrier barrier = {};
         barrier.buffer                = computeBuffer_.buffer;
@@ -248,7 +248,25 @@ public:
         vkCmdBindPipeline(compute_cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, cach_pipe->pipeline);
         vkCmdBindDescriptorSets(compute_cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, cach_pipe->pipelineLayout, 0, 1,
             cach_pipe->descriptorSets.data(), 0, nullptr);
-        vkCmdDispatch(compute_cmd_buf, BODIES_COUNT / 256, 1, 1);
+        {
+            dhh::vk::GpuProfiler::Scope scope(gpuProfiler, compute_cmd_buf, "cache.comp", compute_profiler_slot_);
+            vkCmdDispatch(compute_cmd_buf, (BODIES_COUNT + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+        }
+
+        // the bodies stay in device local memory, the host reads a copy
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(compute_cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_NULL_HANDLE, 0, nullptr, 1, &barrier, VK_NULL_HANDLE, nullptr);
+
+        VkBufferCopy region = {};
+        region.size         = sizeof(Body) * bodies.size();
+        vkCmdCopyBuffer(compute_cmd_buf, computeBuffer_.buffer, readbackBuffer_.buffer, 1, &region);
+
+        barrier.buffer        = readbackBuffer_.buffer;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(compute_cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+            VK_NULL_HANDLE, 0, nullptr, 1, &barrier, VK_NULL_HANDLE, nullptr);
 
         vkEndCommandBuffer(compute_cmd_buf);
     }
@@ -256,12 +274,13 @@ public:
 
     void CreateComputeBuffer()
     {
-        createBuffer(sizeof(Body) * bodies.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
-            computeBuffer_.buffer, computeBuffer_.memory);
-        void* data;
-        vmaMapMemory(allocator, computeBuffer_.memory, &data);
-        memcpy(data, bodies.data(), sizeof(Body) * bodies.size());
-        vmaUnmapMemory(allocator, computeBuffer_.memory);
+        const VkDeviceSize size = sizeof(Body) * bodies.size();
+        createBuffer(size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY, computeBuffer_.buffer, computeBuffer_.memory);
+        uploadManager.uploadBuffer(computeBuffer_.buffer, bodies.data(), size);
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU, readbackBuffer_.buffer,
+            readbackBuffer_.memory);
     }
 
     void CreateVertexBuffer()
@@ -275,11 +294,16 @@ public:
     {
         std::filesystem::path shaders_directory = dhh::shader::findShaderDirectory();
 
+        dhh::shader::SpecializationMap specialization;
+        specialization.set("BODIES_COUNT", BODIES_COUNT).set("local_size_x", uint32_t(WORKGROUP_SIZE));
+
         dhh::shader::Shader compute_shader(shaders_directory / "nbody.comp");
-        comput_pipe = new dhh::shader::Pipeline(device, {&compute_shader}, descriptorPool);
+        comput_pipe = new dhh::shader::Pipeline(
+            device, {&compute_shader}, descriptorAllocator, pipelineCache, specialization, descriptorIndexingFeatures);
 
         dhh::shader::Shader cache_shader(shaders_directory / "cache.comp");
-        cach_pipe = new dhh::shader::Pipeline(device, {&cache_shader}, descriptorPool);
+        cach_pipe = new dhh::shader::Pipeline(
+            device, {&cache_shader}, descriptorAllocator, pipelineCache, specialization, descriptorIndexingFeatures);
     }
 
     void CreateTrianglePipeline()
@@ -287,9 +311,10 @@ public:
         std::filesystem::path shaders_directory = dhh::shader::findShaderDirectory();
 
         dhh::shader::Shader vertex_shader(shaders_directory / "shader.vert");
+        vertex_shader.setDynamic(0);  // transforms live in the frame allocator
         dhh::shader::Shader fragment_shader(shaders_directory / "shader.frag");
 
-        triangle_pipe = new dhh::shader::Pipeline(device, {&vertex_shader, &fragment_shader}, descriptorPool,
+        triangle_pipe = new dhh::shader::Pipeline(device, {&vertex_shader, &fragment_shader}, descriptorAllocator,
             renderPass, dhh::vk::initializer::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT),
             {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR},
             dhh::vk::initializer::pipelineRasterizationStateCreateInfo(
@@ -300,72 +325,29 @@ public:
                                                                         | VK_COLOR_COMPONENT_B_BIT
                                                                         | VK_COLOR_COMPONENT_A_BIT,
                 false),
-            dhh::vk::initializer::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_POINT_LIST));
+            dhh::vk::initializer::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_POINT_LIST),
+            pipelineCache, {}, descriptorIndexingFeatures);
     }
 
 
     void BuildCommandBuffers()
     {
-        VkCommandBufferBeginInfo cmd_buf_info = dhh::vk::initializer::commandBufferBeginInfo();
-
-        // Set clear values for all framebuffer attachments with loadOp set to clear
-        // We use two attachments (color and depth) that are cleared at the start of the subpass and as such we need to
-        // set clear values for both
-        std::vector<VkClearValue> clear_values(2);
-        clear_values[0].color        = {{0.0F, 0.0F, 0.2F, 1.0F}};
-        clear_values[1].depthStencil = {1.0F, 0};
-
-        for (int32_t i = 0; i < commandBuffers.size(); ++i)
-        {
-            VkRenderPassBeginInfo render_pass_begin_info = dhh::vk::initializer::renderPassBeginInfo(
-                clear_values, framebuffers[i], renderPass, windowWidth, windowHeight);
-
-            vkBeginCommandBuffer(commandBuffers[i], &cmd_buf_info);
-
-            // Start the first sub pass specified in our default render pass setup by the base class
-            // This will clear the color and depth attachment
-            vkCmdBeginRenderPass(commandBuffers[i], &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-
-            // Update dynamic viewport state
-            VkViewport viewport = {};
-            viewport.height     = -static_cast<float>(windowHeight);
-            viewport.width      = static_cast<float>(windowWidth);
-            viewport.minDepth   = static_cast<float>(0.0F);
-            viewport.maxDepth   = static_cast<float>(1.0F);
-            viewport.x          = 0;
-            viewport.y          = windowHeight;
-            vkCmdSetViewport(commandBuffers[i], 0, 1, &viewport);
-
-            // Update dynamic scissor state
-            VkRect2D scissor      = {};
-            scissor.extent.width  = windowWidth;
-            scissor.extent.height = windowHeight;
-            scissor.offset.x      = 0;
-            scissor.offset.y      = 0;
-            vkCmdSetScissor(commandBuffers[i], 0, 1, &scissor);
-
+        addDrawGroup([this](VkCommandBuffer command_buffer, uint32_t image_index) {
             // Bind descriptor sets describing shader binding points
-            vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, triangle_pipe->pipelineLayout,
-                0, 1, &triangle_pipe->descriptorSets[0], 0, nullptr);
+            const uint32_t transform_offset = frameAllocator.getRegionOffset(image_index);
+            vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, triangle_pipe->pipelineLayout, 0,
+                1, &triangle_pipe->descriptorSets[0], 1, &transform_offset);
 
             // Bind the rendering pipeline
             // The pipeline (state object) contains all states of the rendering pipeline, binding it will set all the
             // states specified at pipeline creation time
-            vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, triangle_pipe->pipeline);
+            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, triangle_pipe->pipeline);
 
-            // Bind triangle vertex buffer (contains position and colors)
             VkDeviceSize offsets[1] = {0};
-            vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, &vertices_.buffer, offsets);
-
-            vkCmdDraw(commandBuffers[i], BODIES_COUNT, 1, 0, 0);
+            vkCmdBindVertexBuffers(command_buffer, 0, 1, &vertices_.buffer, offsets);
 
-            vkCmdEndRenderPass(commandBuffers[i]);
-
-            // Ending the render pass will add an implicit barrier transitioning the frame buffer color attachment to
-            // VK_IMAGE_LAYOUT_PRESENT_SRC_KHR for presenting it to the windowing system
-
-            vkEndCommandBuffer(commandBuffers[i]);
-        }
+            vkCmdDraw(command_buffer, BODIES_COUNT, 1, 0, 0);
+        });
     }
 
     bool color_set = false;
@@ -381,10 +363,11 @@ public:
     void UpdateVertexBuffer()
     {
         void* data;
-        vmaMapMemory(allocator, computeBuffer_.memory, &data);
+        vmaMapMemory(allocator, readbackBuffer_.memory, &data);
+        vmaInvalidateAllocation(allocator, readbackBuffer_.memory, 0, VK_WHOLE_SIZE);
         std::vector<Body> fuck(BODIES_COUNT);
         memcpy(fuck.data(), data, sizeof(Body) * BODIES_COUNT);
-        vmaUnmapMemory(allocator, computeBuffer_.memory);
+        vmaUnmapMemory(allocator, readbackBuffer_.memory);
         std::default_random_engine rnd_engine;
         std::normal_distribution<float> rnd_dist(0.0F, 1.0F);
 
@@ -411,17 +394,30 @@ int main(int argc, char* argv[])
 {
     try
     {
-        Triangle app;
+        // --headless [frame count] renders offscreen and writes the last frame to particles.ppm
+        const bool headless = argc > 1 && std::string(argv[1]) == "--headless";
+        Triangle app(headless);
+        if (headless && argc > 2)
+        {
+            app.headlessFrameCount = std::stoul(argv[2]);
+        }
 
         int anchor   = 0;
         double years = 0;
-        while (glfwWindowShouldClose(app.window) != GLFW_TRUE)
+        while (app.running())
         {
+            app.beginFrame();
             app.UpdateTransform();
             app.UpdateVertexBuffer();
-            app.drawFrame();
+            app.endFrame();
             app.Compute();
-            glfwPollEvents();
+        }
+
+        app.gpuProfiler.report(std::cout);
+        if (headless)
+        {
+            app.saveFrame("particles.ppm");
+            app.gpuProfiler.appendCsv("particles_gpu_times.csv");
         }
     }
     catch (std::exception& e)
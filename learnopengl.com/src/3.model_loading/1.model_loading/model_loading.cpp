@@ -1,6 +1,7 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <iostream>
+#include <memory>
 #include <shader.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -217,7 +218,11 @@ int main(int argc, char* argv[])
 	init();
 
 
-	Model myModel(filesystem::getResourcesPath() + "objects/nanosuit/nanosuit.obj");
+	// the model streams in while the first frames are drawn
+	auto loader = std::make_unique<AssetLoader>();
+	Model myModel(filesystem::getResourcesPath() + "objects/nanosuit/nanosuit.obj", *loader, VertexFormat::Float,
+	              GL_COMPRESSED_RGB_S3TC_DXT1_EXT);
+	bool loaded = false;
 
 	Shader shader("shader.vert", "shader.frag");
 
@@ -226,6 +231,13 @@ int main(int argc, char* argv[])
 	{
 		processInput(window);
 
+		loader->update();
+		if (!loaded && loader->isIdle())
+		{
+			loaded = true;
+			printf("Assets loaded in %.3f s, %zu meshlets\n", glfwGetTime(), myModel.getMeshletCount());
+		}
+
 		glClearColor(0.0, 0.0, 0.0, 1.f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
@@ -241,13 +253,15 @@ int main(int argc, char* argv[])
 		shader.setMat4("view", view);
 		shader.setMat4("projection", projection);
 
-		myModel.Draw(shader);
+		myModel.DrawCulled(shader, projection * view, model, camera.Position);
 
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
+	// the staging buffer is released while the context is still current
+	loader.reset();
 	glfwTerminate();
 
 	return 0;
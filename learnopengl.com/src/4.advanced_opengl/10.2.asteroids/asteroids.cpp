@@ -33,7 +33,6 @@ static glm::vec3 lightDir = glm::vec3(0.1, 0.1, -1);
 
 GLuint FBO, texColorBuffer, rbo;
 void createOffscreenFB(GLuint& FBO, GLuint& texColorBuffer, GLuint& rbo);
-GLuint loadCubeMap(std::vector<std::filesystem::path> faces, std::filesystem::path directory);
 
 struct PostEffect
 {
@@ -138,10 +137,6 @@ void framebuffer_size_callback(GLFWwindow* window, int newWidth, int newHeight)
 	width = newWidth;
 	height = newHeight;
 	glViewport(0, 0, width, height);
-	glDeleteFramebuffers(1, &FBO);
-	glDeleteTextures(1, &texColorBuffer);
-	glDeleteBuffers(1, &rbo);
-	createOffscreenFB(FBO, texColorBuffer, rbo);
 	glfwSetCursorPos(window, width / 2, height / 2);
 }
 
@@ -232,43 +227,6 @@ void createOffscreenFB(GLuint& FBO, GLuint& texColorBuffer, GLuint& rbo)
 	}
 }
 
-GLuint loadCubeMap(std::vector<std::filesystem::path> faces, std::filesystem::path directory)
-{
-	GLuint texture;
-	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &texture);
-
-	int width, height, nrChannels;
-	std::filesystem::path fullPath;
-	fullPath = directory;
-	fullPath /= faces[0];
-	stbi_load(fullPath.string().c_str(), &width, &height, &nrChannels, 0);
-	glTextureStorage2D(texture, 1, GL_RGB8, width, height);
-
-	for (size_t i = 0; i < faces.size(); i++)
-	{
-		fullPath = directory;
-		fullPath /= faces[i];
-		unsigned char* data = stbi_load(fullPath.string().c_str(), &width, &height, &nrChannels, 0);
-		if (data)
-		{
-			GLenum format;
-			if (nrChannels == 1)
-				format = GL_RED;
-			else if (nrChannels == 3)
-				format = GL_RGB;
-			else if (nrChannels == 4)
-				format = GL_RGBA;
-			glTextureSubImage3D(texture, 0, 0, 0, i, width, height, 1, format, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-	}
-	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	return texture;
-}
-
 void drawOverlay()
 {
 	ImGui_ImplOpenGL3_NewFrame();
@@ -33,7 +33,6 @@ static glm::vec3 lightDir = glm::vec3(0.1, 0.1, -1);
 
 GLuint FBO, texColorBuffer, rbo;
 void createOffscreenFB(GLuint& FBO, GLuint& texColorBuffer, GLuint& rbo);
-GLuint loadCubeMap(std::vector<std::filesystem::path> faces, std::filesystem::path directory);
 
 struct PostEffect
 {
@@ -138,10 +137,6 @@ void framebuffer_size_callback(GLFWwindow* window, int newWidth, int newHeight)
 	width = newWidth;
 	height = newHeight;
 	glViewport(0, 0, width, height);
-	glDeleteFramebuffers(1, &FBO);
-	glDeleteTextures(1, &texColorBuffer);
-	glDeleteBuffers(1, &rbo);
-	createOffscreenFB(FBO, texColorBuffer, rbo);
 	glfwSetCursorPos(window, width / 2, height / 2);
 }
 
@@ -232,43 +227,6 @@ void createOffscreenFB(GLuint& FBO, GLuint& texColorBuffer, GLuint& rbo)
 	}
 }
 
-GLuint loadCubeMap(std::vector<std::filesystem::path> faces, std::filesystem::path directory)
-{
-	GLuint texture;
-	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &texture);
-
-	int width, height, nrChannels;
-	std::filesystem::path fullPath;
-	fullPath = directory;
-	fullPath /= faces[0];
-	stbi_load(fullPath.string().c_str(), &width, &height, &nrChannels, 0);
-	glTextureStorage2D(texture, 1, GL_RGB8, width, height);
-
-	for (size_t i = 0; i < faces.size(); i++)
-	{
-		fullPath = directory;
-		fullPath /= faces[i];
-		unsigned char* data = stbi_load(fullPath.string().c_str(), &width, &height, &nrChannels, 0);
-		if (data)
-		{
-			GLenum format;
-			if (nrChannels == 1)
-				format = GL_RED;
-			else if (nrChannels == 3)
-				format = GL_RGB;
-			else if (nrChannels == 4)
-				format = GL_RGBA;
-			glTextureSubImage3D(texture, 0, 0, 0, i, width, height, 1, format, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-	}
-	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	return texture;
-}
-
 void drawOverlay()
 {
 	ImGui_ImplOpenGL3_NewFrame();
@@ -326,8 +284,10 @@ void run()
 	Shader planetShader("planet.vert", "planet.frag");
 	Shader rockShader("rock.vert", "rock.frag");
 
-	Model planetModel(filesystem::getResourcesPath() + "objects/planet/planet.obj");
-	Model rockModel(filesystem::getResourcesPath() + "objects/rock/rock.obj");
+	Model planetModel(filesystem::getResourcesPath() + "objects/planet/planet.obj", VertexFormat::Float,
+	                  GL_COMPRESSED_RGB_S3TC_DXT1_EXT);
+	Model rockModel(filesystem::getResourcesPath() + "objects/rock/rock.obj", VertexFormat::Packed,
+	                GL_COMPRESSED_RGB_S3TC_DXT1_EXT);
 
 	GLuint uboBuffer;
 	glCreateBuffers(1, &uboBuffer);
@@ -336,6 +296,7 @@ void run()
 
 	uint32_t amount = 200000;
 	glm::mat4* modelMatrices = new glm::mat4[amount];
+	std::vector<glm::vec4> instanceBounds(amount); // position and scale, for picking the level of detail
 	srand(glfwGetTime());
 	float radius = 150.f;
 	float offset = 50.f;
@@ -362,30 +323,27 @@ void run()
 
 		// 4. now add to list of matrices
 		modelMatrices[i] = model;
+		instanceBounds[i] = glm::vec4(x, y, z, scale);
 	}
 
 	GLuint buffer;
 	glCreateBuffers(1, &buffer);
 	glNamedBufferData(buffer, amount * sizeof(glm::mat4), modelMatrices, GL_STATIC_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffer);
+
+	// the rocks are sorted by level of detail every frame, each level is drawn over its run of instance ids
+	GLuint instanceIdBuffer;
+	glCreateBuffers(1, &instanceIdBuffer);
+	glNamedBufferData(instanceIdBuffer, amount * sizeof(uint32_t), nullptr, GL_STREAM_DRAW);
+	std::vector<uint32_t> instanceIds(amount);
+	std::vector<uint8_t> instanceLods(amount);
+	std::vector<uint32_t> lodCounts, lodFirsts;
 	for (const auto& mesh : rockModel.meshes)
 	{
-		glVertexArrayVertexBuffer(mesh.VAO, 1, buffer, 0, sizeof(glm::mat4));
-
-		glVertexArrayAttribFormat(mesh.VAO, 3, 16, GL_FLOAT, GL_FALSE, 0);
-		glVertexArrayAttribFormat(mesh.VAO, 4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4));
-		glVertexArrayAttribFormat(mesh.VAO, 5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4) * 2);
-		glVertexArrayAttribFormat(mesh.VAO, 6, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4) * 3);
-
+		glVertexArrayVertexBuffer(mesh.VAO, 1, instanceIdBuffer, 0, sizeof(uint32_t));
+		glVertexArrayAttribIFormat(mesh.VAO, 3, 1, GL_UNSIGNED_INT, 0);
 		glEnableVertexArrayAttrib(mesh.VAO, 3);
-		glEnableVertexArrayAttrib(mesh.VAO, 4);
-		glEnableVertexArrayAttrib(mesh.VAO, 5);
-		glEnableVertexArrayAttrib(mesh.VAO, 6);
-
 		glVertexArrayAttribBinding(mesh.VAO, 3, 1);
-		glVertexArrayAttribBinding(mesh.VAO, 4, 1);
-		glVertexArrayAttribBinding(mesh.VAO, 5, 1);
-		glVertexArrayAttribBinding(mesh.VAO, 6, 1);
-
 		glVertexArrayBindingDivisor(mesh.VAO, 1, 1);
 	}
 
@@ -410,10 +368,42 @@ void run()
 		rockShader.setInt("material.texture_diffuse1", 0);
 		glBindTextureUnit(0, rockModel.textures_loaded[0].id);
 		
-		for (size_t i = 0; i < rockModel.meshes.size(); i++)
+		const float pixelsPerUnit = getPixelsPerUnit(glm::radians(camera.Zoom), float(height));
+		for (const Mesh& mesh : rockModel.meshes)
 		{
-			glBindVertexArray(rockModel.meshes[i].VAO);
-			glDrawElementsInstanced(GL_TRIANGLES, rockModel.meshes[i].indices.size(), GL_UNSIGNED_INT, nullptr, amount);
+			if (mesh.lods.empty())
+				continue;
+
+			// the coarsest level whose error stays under a pixel, counting sort of the instances by it
+			lodCounts.assign(mesh.lods.size(), 0);
+			for (uint32_t j = 0; j < amount; j++)
+			{
+				const float distance = glm::distance(camera.Position, glm::vec3(instanceBounds[j]));
+				instanceLods[j] = uint8_t(selectLod(mesh.lods, distance / instanceBounds[j].w, pixelsPerUnit));
+				lodCounts[instanceLods[j]]++;
+			}
+			lodFirsts.assign(mesh.lods.size(), 0);
+			for (size_t lod = 1; lod < mesh.lods.size(); lod++)
+				lodFirsts[lod] = lodFirsts[lod - 1] + lodCounts[lod - 1];
+			for (uint32_t j = 0; j < amount; j++)
+				instanceIds[lodFirsts[instanceLods[j]]++] = j;
+			glNamedBufferSubData(instanceIdBuffer, 0, amount * sizeof(uint32_t), instanceIds.data());
+
+			// a rock whose packing lost too much is drawn from floats, positionTransform is then the identity
+			rockShader.setMat4("positionTransform", mesh.positionTransform);
+			rockShader.setBool("packedNormal", mesh.format == VertexFormat::Packed);
+			glBindVertexArray(mesh.VAO);
+			uint32_t baseInstance = 0;
+			for (size_t lod = 0; lod < mesh.lods.size(); lod++)
+			{
+				const void* offset = reinterpret_cast<const void*>(sizeof(uint32_t) * mesh.lods[lod].firstIndex);
+				if (lodCounts[lod] > 0)
+				{
+					glDrawElementsInstancedBaseInstance(GL_TRIANGLES, mesh.lods[lod].indexCount, GL_UNSIGNED_INT,
+					                                    offset, lodCounts[lod], baseInstance);
+				}
+				baseInstance += lodCounts[lod];
+			}
 		}
 
 
@@ -1,8 +1,9 @@
 #version 450
+// packed vertices, see common/vertex_packing.h, or floats for a mesh that could not be packed
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoord;
-layout (location = 3) in mat4 instanceMatrix;
+layout (location = 3) in uint instanceId;
 
 out ATTR {
 	vec3 Normal;
@@ -16,10 +17,27 @@ layout (binding = 0) uniform UniformBufferObject{
 	mat4 view;
 };
 
+layout (std430, binding = 1) readonly buffer InstanceMatrices {
+	mat4 instanceMatrices[];
+};
+
+uniform mat4 positionTransform;
+uniform bool packedNormal;
+
+vec3 octDecode(vec2 encoded)
+{
+	vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	float t = max(-normal.z, 0.0);
+	normal.xy += mix(vec2(t), vec2(-t), greaterThanEqual(normal.xy, vec2(0.0)));
+	return normalize(normal);
+}
+
 void main()
 {
-    gl_Position = projection * view * instanceMatrix * vec4(aPos, 1.0);
-	vs_out.Normal = aNormal;
-	vs_out.FragPos = (instanceMatrix * vec4(aPos, 1.0)).xyz;
+	mat4 instanceMatrix = instanceMatrices[instanceId];
+	vec4 position = positionTransform * vec4(aPos, 1.0);
+	gl_Position = projection * view * instanceMatrix * position;
+	vs_out.Normal = packedNormal ? octDecode(aNormal.xy) : normalize(aNormal);
+	vs_out.FragPos = (instanceMatrix * position).xyz;
 	vs_out.TexCoord = aTexCoord;
 }
@@ -281,8 +281,8 @@ int main(int argc, char* argv[])
 
 	GLuint cubeTexture = TextureFromFile("textures/marble.jpg", filesystem::getResourcesPath());
 	GLuint floorTexture = TextureFromFile("textures/metal.png", filesystem::getResourcesPath());
-	GLuint grassTexture = TextureFromFile("textures/grass.png", filesystem::getResourcesPath(), GL_RGBA8,
-	                                      GL_CLAMP_TO_EDGE);
+	GLuint grassTexture = TextureFromFile("textures/grass.png", filesystem::getResourcesPath(),
+	                                      GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_CLAMP_TO_EDGE);
 
 	std::vector<glm::vec3> vegetation;
 	vegetation.emplace_back(-0.5f, 0.0f, 0.51f);
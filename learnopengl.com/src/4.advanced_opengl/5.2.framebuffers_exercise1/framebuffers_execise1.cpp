@@ -8,6 +8,7 @@
 #include <camera.h>
 #include <model.h>
 #include <filesystem.h>
+#include <offscreen_framebuffer.h>
 #include <map>
 #include <imgui.h>
 #include <imgui_impl_opengl3.h>
@@ -23,6 +24,7 @@ uint32_t height = 768;
 Camera camera;
 
 GLuint FBO, texColorBuffer, rbo;
+bool framebufferResized = false;
 void createOffscreenFB(GLuint& FBO, GLuint& texColorBuffer, GLuint& rbo);
 
 struct PostEffect
@@ -212,10 +214,8 @@ void framebuffer_size_callback(GLFWwindow* window, int newWidth, int newHeight)
 	width = newWidth;
 	height = newHeight;
 	glViewport(0, 0, width, height);
-	glDeleteFramebuffers(1, &FBO);
-	glDeleteTextures(1, &texColorBuffer);
-	glDeleteBuffers(1, &rbo);
-	createOffscreenFB(FBO, texColorBuffer, rbo);
+	// a drag sends many resize events, the attachments are resized once before the next frame
+	framebufferResized = true;
 	glfwSetCursorPos(window, width / 2, height / 2);
 }
 
@@ -409,6 +409,12 @@ int main(int argc, char* argv[])
 
 	while (!glfwWindowShouldClose(window))
 	{
+		if (framebufferResized)
+		{
+			resizeOffscreenFB(FBO, texColorBuffer, rbo, width, height);
+			framebufferResized = false;
+		}
+
 		processInput(window);
 
 		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
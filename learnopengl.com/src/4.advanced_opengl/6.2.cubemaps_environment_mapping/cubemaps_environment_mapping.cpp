@@ -8,6 +8,7 @@
 #include <camera.h>
 #include <model.h>
 #include <filesystem.h>
+#include <offscreen_framebuffer.h>
 #include <map>
 #include <imgui.h>
 #include <imgui_impl_opengl3.h>
@@ -30,8 +31,8 @@ static glm::vec3 lightDir = glm::vec3(0.1, 0.1, -1);
 
 
 GLuint FBO, texColorBuffer, rbo;
+bool framebufferResized = false;
 void createOffscreenFB(GLuint& FBO, GLuint& texColorBuffer, GLuint& rbo);
-GLuint loadCubeMap(std::vector<std::filesystem::path> faces, std::filesystem::path directory);
 
 struct PostEffect
 {
@@ -286,10 +287,8 @@ void framebuffer_size_callback(GLFWwindow* window, int newWidth, int newHeight)
 	width = newWidth;
 	height = newHeight;
 	glViewport(0, 0, width, height);
-	glDeleteFramebuffers(1, &FBO);
-	glDeleteTextures(1, &texColorBuffer);
-	glDeleteBuffers(1, &rbo);
-	createOffscreenFB(FBO, texColorBuffer, rbo);
+	// a drag sends many resize events, the attachments are resized once before the next frame
+	framebufferResized = true;
 	glfwSetCursorPos(window, width / 2, height / 2);
 }
 
@@ -377,43 +376,6 @@ void createOffscreenFB(GLuint& FBO, GLuint& texColorBuffer, GLuint& rbo)
 	}
 }
 
-GLuint loadCubeMap(std::vector<std::filesystem::path> faces, std::filesystem::path directory)
-{
-	GLuint texture;
-	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &texture);
-
-	int width, height, nrChannels;
-	std::filesystem::path fullPath;
-	fullPath = directory;
-	fullPath /= faces[0];
-	stbi_load(fullPath.string().c_str(), &width, &height, &nrChannels, 0);
-	glTextureStorage2D(texture, 1, GL_RGB8, width, height);
-
-	for (size_t i = 0; i < faces.size(); i++)
-	{
-		fullPath = directory;
-		fullPath /= faces[i];
-		unsigned char* data = stbi_load(fullPath.string().c_str(), &width, &height, &nrChannels, 0);
-		if (data)
-		{
-			GLenum format;
-			if (nrChannels == 1)
-				format = GL_RED;
-			else if (nrChannels == 3)
-				format = GL_RGB;
-			else if (nrChannels == 4)
-				format = GL_RGBA;
-			glTextureSubImage3D(texture, 0, 0, 0, i, width, height, 1, format, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-	}
-	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	return texture;
-}
-
 void drawOverlay()
 {
 	ImGui_ImplOpenGL3_NewFrame();
@@ -523,7 +485,8 @@ void run()
 	glEnableVertexArrayAttrib(skyboxVAO, 0);
 	glVertexArrayAttribBinding(skyboxVAO, 0, 0);
 
-	GLuint cubemapTexture = loadCubeMap(faces, filesystem::getResourcesPath() + "textures/skybox");
+	GLuint cubemapTexture =
+		TextureCache::get().acquireCubeMap(faces, filesystem::getResourcesPath() + "textures/skybox");
 	Model myModel(filesystem::getResourcesPath() + "objects/nanosuit/nanosuit.obj");
 
 
@@ -545,6 +508,12 @@ void run()
 
 	while (!glfwWindowShouldClose(window))
 	{
+		if (framebufferResized)
+		{
+			resizeOffscreenFB(FBO, texColorBuffer, rbo, width, height);
+			framebufferResized = false;
+		}
+
 		processInput(window);
 
 		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
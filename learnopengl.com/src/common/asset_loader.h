@@ -0,0 +1,420 @@
+#pragma once
+#include "texture_cooker.h"
+#include <glad/glad.h>
+#include <stb_image.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+inline GLenum getImageFormat(int components)
+{
+	if (components == 1)
+		return GL_RED;
+	if (components == 3)
+		return GL_RGB;
+	if (components == 4)
+		return GL_RGBA;
+	throw std::runtime_error("unknown image channels");
+}
+
+// S3TC is an extension the loader may not have been generated with, every desktop GL 4 driver supports it
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+/// Cooking is opt in per texture: a texture requested in one of the block compressed formats below is cooked into it,
+/// every other format is uploaded as it is. Use BC3 (DXT5) for textures with alpha and BC5 (RGTC2) for normal maps
+inline bool getBlockFormat(GLenum internalFormat, BlockFormat& format)
+{
+	if (internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+		format = BlockFormat::BC1;
+	else if (internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+		format = BlockFormat::BC3;
+	else if (internalFormat == GL_COMPRESSED_RG_RGTC2)
+		format = BlockFormat::BC5;
+	else if (internalFormat == GL_COMPRESSED_RGBA_BPTC_UNORM)
+		format = BlockFormat::BC7;
+	else
+		return false;
+	return true;
+}
+
+/// The format a texture is decoded into when it is not cooked, block compressed requests map to the uncompressed
+/// format with the same channels
+inline GLenum getDecodedFormat(GLenum internalFormat)
+{
+	BlockFormat format;
+	if (!getBlockFormat(internalFormat, format))
+		return internalFormat;
+	if (format == BlockFormat::BC1)
+		return GL_RGB8;
+	if (format == BlockFormat::BC5)
+		return GL_RG8;
+	return GL_RGBA8;
+}
+
+inline GLenum getCompressedInternalFormat(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1:
+		return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BlockFormat::BC3:
+		return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case BlockFormat::BC5:
+		return GL_COMPRESSED_RG_RGTC2;
+	case BlockFormat::BC7:
+		return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+	throw std::runtime_error("unknown block format");
+}
+
+inline void setTextureParameters(uint32_t texture, GLenum wrapMode)
+{
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, wrapMode);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, wrapMode);
+	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+/// Color is filtered in linear light, two channel textures are normal maps
+inline MipOptions getMipOptions(GLenum internalFormat)
+{
+	MipOptions options;
+	if (internalFormat == GL_RG8)
+		options.colorSpace = MipColorSpace::Normal;
+	else if (internalFormat == GL_RGB8 || internalFormat == GL_RGBA8 || internalFormat == GL_SRGB8
+	         || internalFormat == GL_SRGB8_ALPHA8)
+		options.colorSpace = MipColorSpace::Srgb;
+	return options;
+}
+
+/// Allocates and fills a texture created with glCreateTextures from a mip chain built on the CPU. data points at
+/// chain.data or its offset in a bound pixel unpack buffer
+inline void uploadTexture(uint32_t texture, GLenum internalFormat, GLenum wrapMode, const MipChain& chain,
+                          const uint8_t* data)
+{
+	const GLenum format = getImageFormat(int(chain.components));
+	glTextureStorage2D(texture, GLsizei(chain.levels.size()), internalFormat, chain.width, chain.height);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t i = 0; i < chain.levels.size(); i++)
+	{
+		const MipLevel& level = chain.levels[i];
+		glTextureSubImage2D(texture, GLint(i), 0, 0, level.width, level.height, format, GL_UNSIGNED_BYTE,
+		                    data + level.offset);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	setTextureParameters(texture, wrapMode);
+}
+
+/// Same for a cooked texture, with the mip chain it was cooked with. data points at image.data or its offset in a
+/// bound pixel unpack buffer
+inline void uploadCompressedTexture(uint32_t texture, const CompressedImage& image, GLenum wrapMode,
+                                    const uint8_t* data)
+{
+	const GLenum internalFormat = getCompressedInternalFormat(image.format);
+	glTextureStorage2D(texture, GLsizei(image.levels.size()), internalFormat, image.width, image.height);
+	for (size_t i = 0; i < image.levels.size(); i++)
+	{
+		const CompressedLevel& level = image.levels[i];
+		glCompressedTextureSubImage2D(texture, GLint(i), 0, 0, level.width, level.height, internalFormat,
+		                              GLsizei(level.size), data + level.offset);
+	}
+	setTextureParameters(texture, wrapMode);
+}
+
+/// Loads assets on worker threads so the application keeps drawing while they stream in. A job runs on a worker and
+/// returns a completion that update() runs on the GL thread. Textures are decoded on the workers and uploaded through a
+/// persistently mapped pixel buffer, up to uploadBudget bytes per update(). Textures requested in a block compressed
+/// format are cooked on the workers instead, see getBlockFormat. Create, submit and update on the GL thread
+class AssetLoader
+{
+public:
+	using Completion = std::function<void()>;
+	using Job = std::function<Completion()>;
+
+	explicit AssetLoader(size_t stagingSize = 64 << 20, size_t uploadBudget = 16 << 20, unsigned threadCount = 0)
+		: stagingSize(stagingSize),
+		  uploadBudget(uploadBudget)
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glCreateBuffers(1, &stagingBuffer);
+		glNamedBufferStorage(stagingBuffer, stagingSize, nullptr, flags);
+		staging = static_cast<unsigned char*>(glMapNamedBufferRange(stagingBuffer, 0, stagingSize, flags));
+		if (!staging)
+			throw std::runtime_error("failed to map staging buffer");
+
+		if (threadCount == 0)
+			threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+		for (unsigned i = 0; i < threadCount; i++)
+			workers.emplace_back([this] { work(); });
+	}
+
+	~AssetLoader()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		jobAdded.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+
+		for (const StagingRange& range : stagingRanges)
+			glDeleteSync(range.fence);
+		glUnmapNamedBuffer(stagingBuffer);
+		glDeleteBuffers(1, &stagingBuffer);
+	}
+
+	AssetLoader(const AssetLoader&) = delete;
+	AssetLoader& operator=(const AssetLoader&) = delete;
+
+	void submit(Job job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+		pendingJobs++;
+		jobAdded.notify_one();
+	}
+
+	/// The texture object is created right away and stays empty until the image is decoded and uploaded
+	uint32_t loadTexture(const std::string& filename, GLenum internalFormat = GL_RGB8, GLenum wrapMode = GL_REPEAT)
+	{
+		uint32_t texture;
+		glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+		submit([this, texture, filename, internalFormat, wrapMode]() -> Completion {
+			auto image = std::make_shared<Image>();
+			image->texture = texture;
+			image->internalFormat = getDecodedFormat(internalFormat);
+			image->wrapMode = wrapMode;
+			BlockFormat format;
+			image->isCompressed = getBlockFormat(internalFormat, format)
+				&& loadCompressedTexture(filename, format, image->compressed);
+			int width, height, components;
+			unsigned char* data = image->isCompressed
+				? nullptr
+				: stbi_load(filename.c_str(), &width, &height, &components, 0);
+			if (data)
+				image->mips = buildMipChain(data, width, height, components, getMipOptions(image->internalFormat));
+			else if (!image->isCompressed)
+				std::cout << "Texture failed to load at path: " << filename << std::endl;
+			stbi_image_free(data);
+			return [this, image] { uploads.push_back(image); };
+		});
+		return texture;
+	}
+
+	/// Call once per frame, runs finished completions and uploads decoded textures
+	void update()
+	{
+		std::deque<Completion> finished;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished.swap(completions);
+		}
+		for (Completion& completion : finished)
+		{
+			if (completion)
+				completion();
+			pendingJobs--;
+		}
+
+		retireStaging();
+		size_t uploaded = 0;
+		while (!uploads.empty() && uploaded < uploadBudget)
+		{
+			if (!upload(*uploads.front()))
+				break;
+			uploaded += uploads.front()->size();
+			uploads.pop_front();
+		}
+	}
+
+	/// Nothing is queued, decoding or waiting for upload
+	bool isIdle() const
+	{
+		return pendingJobs == 0 && uploads.empty();
+	}
+
+private:
+	struct Image
+	{
+		uint32_t texture;
+		GLenum internalFormat;
+		GLenum wrapMode;
+		bool isCompressed = false;
+		CompressedImage compressed;
+		MipChain mips; // empty when the image failed to load
+
+		size_t size() const
+		{
+			return isCompressed ? compressed.data.size() : mips.data.size();
+		}
+
+		const uint8_t* pixels() const
+		{
+			return isCompressed ? compressed.data.data() : mips.data.data();
+		}
+	};
+
+	/// A part of the staging buffer the GPU may still read from
+	struct StagingRange
+	{
+		GLsync fence;
+		size_t begin;
+		size_t end;   // aligned, where the next range may begin
+		bool wrapped; // begins a new lap at the start of the buffer
+	};
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable jobAdded;
+	std::deque<Job> jobs;               // guarded by mutex
+	std::deque<Completion> completions; // guarded by mutex
+	bool running = true;                // guarded by mutex
+	size_t pendingJobs = 0;             // submitted and not completed yet, GL thread only
+
+	std::deque<std::shared_ptr<Image>> uploads;
+	uint32_t stagingBuffer;
+	unsigned char* staging;
+	size_t stagingSize;
+	size_t stagingHead = 0;      // next write position, the staging buffer is used as a ring
+	bool stagingWrapped = false; // stagingHead is behind the oldest range, the free space ends at that range
+	std::deque<StagingRange> stagingRanges;
+	size_t uploadBudget;
+
+	void work()
+	{
+		// the loads run next to each other already, the mip and block passes inside one stay on this thread
+		isParallelWorker = true;
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				jobAdded.wait(lock, [this] { return !running || !jobs.empty(); });
+				if (!running)
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+
+			Completion completion;
+			try
+			{
+				completion = job();
+			}
+			catch (const std::exception& e)
+			{
+				std::cout << "ERROR::ASSET_LOADER::" << e.what() << std::endl;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			completions.push_back(std::move(completion));
+		}
+	}
+
+	void retireStaging()
+	{
+		while (!stagingRanges.empty())
+		{
+			const GLenum status = glClientWaitSync(stagingRanges.front().fence, 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				break;
+			glDeleteSync(stagingRanges.front().fence);
+			stagingRanges.pop_front();
+			// every range of the previous lap is retired, the free space runs to the end of the buffer again
+			if (!stagingRanges.empty() && stagingRanges.front().wrapped)
+				stagingWrapped = false;
+		}
+		if (stagingRanges.empty())
+		{
+			stagingHead = 0;
+			stagingWrapped = false;
+		}
+	}
+
+	/// Returns false when the ring has no room, the upload is tried again next frame
+	bool allocateStaging(size_t size, StagingRange& range)
+	{
+		// offsets of pixel unpack buffers are aligned like client memory
+		const auto align = [](size_t value) { return (value + 15) & ~size_t(15); };
+		range.wrapped = false;
+		if (stagingRanges.empty())
+		{
+			range.begin = 0;
+		}
+		else
+		{
+			// the ring is free from stagingHead to the end of the buffer and from its start to the oldest range, or
+			// only from stagingHead to the oldest range once it wrapped
+			const size_t oldest = stagingRanges.front().begin;
+			if (!stagingWrapped && stagingHead + size <= stagingSize)
+				range.begin = stagingHead;
+			else if (!stagingWrapped && align(size) <= oldest)
+			{
+				range.begin = 0;
+				range.wrapped = true;
+			}
+			else if (stagingWrapped && align(stagingHead + size) <= oldest)
+				range.begin = stagingHead;
+			else
+				return false;
+		}
+		range.end = align(range.begin + size);
+		stagingHead = range.end;
+		stagingWrapped = stagingWrapped || range.wrapped;
+		return true;
+	}
+
+	bool upload(const Image& image)
+	{
+		if (!image.isCompressed && image.mips.levels.empty())
+			return true;
+
+		const size_t size = image.size();
+		StagingRange range;
+		const bool staged = size <= stagingSize;
+		if (staged && !allocateStaging(size, range))
+			return false;
+
+		if (staged)
+		{
+			std::memcpy(staging + range.begin, image.pixels(), size);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+			upload(image, reinterpret_cast<const uint8_t*>(range.begin));
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			range.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			stagingRanges.push_back(range);
+		}
+		else
+		{
+			// larger than the whole staging buffer, copied from client memory instead
+			upload(image, image.pixels());
+		}
+		return true;
+	}
+
+	static void upload(const Image& image, const uint8_t* pixels)
+	{
+		if (image.isCompressed)
+			uploadCompressedTexture(image.texture, image.compressed, image.wrapMode, pixels);
+		else
+			uploadTexture(image.texture, image.internalFormat, image.wrapMode, image.mips, pixels);
+	}
+};
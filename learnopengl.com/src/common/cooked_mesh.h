@@ -0,0 +1,358 @@
+#pragma once
+#include "mapped_file.h"
+#include "mesh.h"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+/// Cooked model, written the first time a model is imported and mapped on every later start so Assimp is skipped.
+/// All offsets are from the start of the file:
+///   CookedHeader
+///   CookedMesh[meshCount]
+///   CookedMaterial[materialCount]
+///   CookedTexture[textureCount]
+///   uint32_t materialTextures[materialTextureCount], indices into the texture table
+///   char strings[stringsSize], texture paths
+///   Vertex vertices[], at vertexOffset
+///   uint32_t indices[], at indexOffset, the indices of each mesh followed by the indices of its coarser levels
+///   Meshlet meshlets[meshletCount], at meshletOffset
+///   MeshLod lods[lodCount], at lodOffset
+const uint32_t CookedMagic = 0x4b4f4f43; // "COOK"
+const uint32_t CookedVersion = 4; // 2: optimized for the vertex cache, 3: meshlets, 4: levels of detail
+
+struct CookedHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceSize; // the cooked file is stale once the source changes
+	int64_t sourceWriteTime;
+	uint32_t vertexSize; // sizeof(Vertex) of the writer
+	uint32_t meshletSize; // sizeof(Meshlet) of the writer
+	uint32_t meshCount;
+	uint32_t materialCount;
+	uint32_t textureCount;
+	uint32_t materialTextureCount;
+	uint32_t stringsSize;
+	uint32_t meshletCount;
+	uint32_t lodCount;
+	uint32_t reserved;
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint64_t meshletOffset;
+	uint64_t lodOffset;
+	uint64_t fileSize;
+};
+
+struct CookedMesh
+{
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t lodIndexCount; // after the indexCount indices
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+	uint32_t firstLod;
+	uint32_t lodCount;
+	uint32_t material;
+};
+
+struct CookedMaterial
+{
+	uint32_t firstTexture; // into materialTextures
+	uint32_t textureCount;
+};
+
+struct CookedTexture
+{
+	uint32_t type; // index into cookedTextureTypes
+	uint32_t pathOffset;
+	uint32_t pathLength;
+};
+
+inline const char* cookedTextureTypes[] = {"texture_diffuse", "texture_specular"};
+
+inline std::string getCookedPath(const std::string& sourcePath)
+{
+	return sourcePath + ".cooked";
+}
+
+/// A mapped cooked file, checked against its source. Without the source the cooked file is used as it is, so a build
+/// can ship cooked models only
+class CookedModel
+{
+public:
+	explicit CookedModel(const std::string& sourcePath) : file(getCookedPath(sourcePath))
+	{
+		if (file.size() < sizeof(CookedHeader))
+			return;
+		std::memcpy(&header, file.data(), sizeof(header));
+		if (header.magic != CookedMagic || header.version != CookedVersion || header.vertexSize != sizeof(Vertex)
+			|| header.meshletSize != sizeof(Meshlet) || header.fileSize != file.size())
+			return;
+		if (std::filesystem::exists(sourcePath))
+		{
+			uint64_t size;
+			int64_t writeTime;
+			getSourceStamp(sourcePath, size, writeTime);
+			if (size != header.sourceSize || writeTime != header.sourceWriteTime)
+				return;
+		}
+		valid = isConsistent();
+		if (!valid)
+			std::cout << "Cooked model is corrupt: " << getCookedPath(sourcePath) << std::endl;
+	}
+
+	bool isValid() const
+	{
+		return valid;
+	}
+
+	const CookedHeader& getHeader() const
+	{
+		return header;
+	}
+
+	const CookedMesh* meshes() const
+	{
+		return reinterpret_cast<const CookedMesh*>(file.data() + sizeof(CookedHeader));
+	}
+
+	const CookedMaterial* materials() const
+	{
+		return reinterpret_cast<const CookedMaterial*>(meshes() + header.meshCount);
+	}
+
+	const CookedTexture* textures() const
+	{
+		return reinterpret_cast<const CookedTexture*>(materials() + header.materialCount);
+	}
+
+	const uint32_t* materialTextures() const
+	{
+		return reinterpret_cast<const uint32_t*>(textures() + header.textureCount);
+	}
+
+	std::string texturePath(const CookedTexture& texture) const
+	{
+		const char* strings = reinterpret_cast<const char*>(materialTextures() + header.materialTextureCount);
+		return std::string(strings + texture.pathOffset, texture.pathLength);
+	}
+
+	const Vertex* vertices() const
+	{
+		return reinterpret_cast<const Vertex*>(file.data() + header.vertexOffset);
+	}
+
+	const uint32_t* indices() const
+	{
+		return reinterpret_cast<const uint32_t*>(file.data() + header.indexOffset);
+	}
+
+	const Meshlet* meshlets() const
+	{
+		return reinterpret_cast<const Meshlet*>(file.data() + header.meshletOffset);
+	}
+
+	const MeshLod* lods() const
+	{
+		return reinterpret_cast<const MeshLod*>(file.data() + header.lodOffset);
+	}
+
+private:
+	MappedFile file;
+	CookedHeader header = {};
+	bool valid = false;
+
+	/// Every offset, range and index of the file lies inside the file and the table it points into, so a corrupt or
+	/// edited file is rejected instead of read out of bounds. Sizes are summed in 64 bits, a 32 bit field can't wrap
+	bool isConsistent() const
+	{
+		const uint64_t tablesEnd = sizeof(header) + sizeof(CookedMesh) * uint64_t(header.meshCount)
+			+ sizeof(CookedMaterial) * uint64_t(header.materialCount)
+			+ sizeof(CookedTexture) * uint64_t(header.textureCount)
+			+ sizeof(uint32_t) * uint64_t(header.materialTextureCount) + header.stringsSize;
+		if (tablesEnd > header.vertexOffset || header.vertexOffset > header.indexOffset
+			|| header.indexOffset > header.meshletOffset || header.meshletOffset > header.lodOffset
+			|| header.vertexOffset % 16 != 0 || header.indexOffset % alignof(uint32_t) != 0
+			|| header.meshletOffset % 16 != 0
+			|| header.lodOffset != header.meshletOffset + sizeof(Meshlet) * uint64_t(header.meshletCount)
+			|| header.fileSize != header.lodOffset + sizeof(MeshLod) * uint64_t(header.lodCount))
+			return false;
+		// the index section may end in the padding before the meshlets
+		const uint64_t vertexTotal = (header.indexOffset - header.vertexOffset) / sizeof(Vertex);
+		const uint64_t indexTotal = (header.meshletOffset - header.indexOffset) / sizeof(uint32_t);
+
+		for (uint32_t i = 0; i < header.textureCount; i++)
+		{
+			const CookedTexture& texture = textures()[i];
+			if (texture.type >= std::size(cookedTextureTypes)
+				|| uint64_t(texture.pathOffset) + texture.pathLength > header.stringsSize)
+				return false;
+		}
+		for (uint32_t i = 0; i < header.materialTextureCount; i++)
+		{
+			if (materialTextures()[i] >= header.textureCount)
+				return false;
+		}
+		for (uint32_t i = 0; i < header.materialCount; i++)
+		{
+			const CookedMaterial& material = materials()[i];
+			if (uint64_t(material.firstTexture) + material.textureCount > header.materialTextureCount)
+				return false;
+		}
+
+		for (uint32_t i = 0; i < header.meshCount; i++)
+		{
+			const CookedMesh& mesh = meshes()[i];
+			const uint64_t meshIndexCount = uint64_t(mesh.indexCount) + mesh.lodIndexCount;
+			if (mesh.material >= header.materialCount
+				|| uint64_t(mesh.firstVertex) + mesh.vertexCount > vertexTotal
+				|| mesh.firstIndex + meshIndexCount > indexTotal
+				|| uint64_t(mesh.firstMeshlet) + mesh.meshletCount > header.meshletCount
+				|| uint64_t(mesh.firstLod) + mesh.lodCount > header.lodCount)
+				return false;
+			// indices, meshlets and levels are drawn from the buffers of the mesh
+			const uint32_t* meshIndices = indices() + mesh.firstIndex;
+			for (uint64_t j = 0; j < meshIndexCount; j++)
+			{
+				if (meshIndices[j] >= mesh.vertexCount)
+					return false;
+			}
+			for (uint32_t j = 0; j < mesh.meshletCount; j++)
+			{
+				const Meshlet& meshlet = meshlets()[mesh.firstMeshlet + j];
+				if (meshlet.firstIndex + uint64_t(meshlet.triangleCount) * 3 > meshIndexCount)
+					return false;
+			}
+			for (uint32_t j = 0; j < mesh.lodCount; j++)
+			{
+				const MeshLod& lod = lods()[mesh.firstLod + j];
+				if (uint64_t(lod.firstIndex) + lod.indexCount > meshIndexCount)
+					return false;
+			}
+		}
+		return true;
+	}
+};
+
+/// Write the meshes of an imported model next to its source. Meshes with the same textures share a material
+inline void writeCookedModel(const std::string& sourcePath, const std::vector<MeshData>& meshes)
+{
+	std::vector<CookedMesh> cookedMeshes;
+	std::vector<CookedMaterial> materials;
+	std::vector<CookedTexture> textures;
+	std::vector<uint32_t> materialTextures;
+	std::string strings;
+	std::map<std::string, uint32_t> textureIndices;            // by path
+	std::map<std::vector<uint32_t>, uint32_t> materialIndices; // by texture list
+	uint32_t vertexCount = 0, indexCount = 0, meshletCount = 0, lodCount = 0;
+
+	for (const MeshData& mesh : meshes)
+	{
+		std::vector<uint32_t> meshTextures;
+		for (const Texture& texture : mesh.textures)
+		{
+			auto index = textureIndices.find(texture.path);
+			if (index == textureIndices.end())
+			{
+				CookedTexture cookedTexture;
+				cookedTexture.type = texture.type == cookedTextureTypes[0] ? 0 : 1;
+				cookedTexture.pathOffset = static_cast<uint32_t>(strings.size());
+				cookedTexture.pathLength = static_cast<uint32_t>(texture.path.size());
+				strings += texture.path;
+				index = textureIndices.insert({texture.path, static_cast<uint32_t>(textures.size())}).first;
+				textures.push_back(cookedTexture);
+			}
+			meshTextures.push_back(index->second);
+		}
+
+		auto material = materialIndices.find(meshTextures);
+		if (material == materialIndices.end())
+		{
+			materials.push_back({static_cast<uint32_t>(materialTextures.size()),
+			                     static_cast<uint32_t>(meshTextures.size())});
+			materialTextures.insert(materialTextures.end(), meshTextures.begin(), meshTextures.end());
+			material = materialIndices.insert({meshTextures, static_cast<uint32_t>(materials.size() - 1)}).first;
+		}
+
+		cookedMeshes.push_back({vertexCount, static_cast<uint32_t>(mesh.vertices.size()), indexCount,
+		                        static_cast<uint32_t>(mesh.indices.size()),
+		                        static_cast<uint32_t>(mesh.lodIndices.size()), meshletCount,
+		                        static_cast<uint32_t>(mesh.meshlets.size()), lodCount,
+		                        static_cast<uint32_t>(mesh.lods.size()), material->second});
+		vertexCount += static_cast<uint32_t>(mesh.vertices.size());
+		indexCount += static_cast<uint32_t>(mesh.indices.size() + mesh.lodIndices.size());
+		meshletCount += static_cast<uint32_t>(mesh.meshlets.size());
+		lodCount += static_cast<uint32_t>(mesh.lods.size());
+	}
+
+	CookedHeader header = {};
+	header.magic = CookedMagic;
+	header.version = CookedVersion;
+	getSourceStamp(sourcePath, header.sourceSize, header.sourceWriteTime);
+	header.vertexSize = sizeof(Vertex);
+	header.meshletSize = sizeof(Meshlet);
+	header.meshCount = static_cast<uint32_t>(cookedMeshes.size());
+	header.materialCount = static_cast<uint32_t>(materials.size());
+	header.textureCount = static_cast<uint32_t>(textures.size());
+	header.materialTextureCount = static_cast<uint32_t>(materialTextures.size());
+	header.stringsSize = static_cast<uint32_t>(strings.size());
+	header.meshletCount = meshletCount;
+	header.lodCount = lodCount;
+	const uint64_t tablesEnd = sizeof(header) + sizeof(CookedMesh) * cookedMeshes.size()
+		+ sizeof(CookedMaterial) * materials.size() + sizeof(CookedTexture) * textures.size()
+		+ sizeof(uint32_t) * materialTextures.size() + strings.size();
+	header.vertexOffset = (tablesEnd + 15) & ~uint64_t(15);
+	header.indexOffset = header.vertexOffset + sizeof(Vertex) * uint64_t(vertexCount);
+	const uint64_t indicesEnd = header.indexOffset + sizeof(uint32_t) * uint64_t(indexCount);
+	header.meshletOffset = (indicesEnd + 15) & ~uint64_t(15);
+	header.lodOffset = header.meshletOffset + sizeof(Meshlet) * uint64_t(meshletCount);
+	header.fileSize = header.lodOffset + sizeof(MeshLod) * uint64_t(lodCount);
+
+	// written to a temporary file first, a crash never leaves a half written cooked file behind
+	const std::string cookedPath = getCookedPath(sourcePath);
+	const std::string temporaryPath = getTemporaryPath(cookedPath);
+	bool written;
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		const auto write = [&file](const void* data, size_t size) {
+			file.write(static_cast<const char*>(data), size);
+		};
+		write(&header, sizeof(header));
+		write(cookedMeshes.data(), sizeof(CookedMesh) * cookedMeshes.size());
+		write(materials.data(), sizeof(CookedMaterial) * materials.size());
+		write(textures.data(), sizeof(CookedTexture) * textures.size());
+		write(materialTextures.data(), sizeof(uint32_t) * materialTextures.size());
+		write(strings.data(), strings.size());
+		const char padding[16] = {};
+		write(padding, header.vertexOffset - tablesEnd);
+		for (const MeshData& mesh : meshes)
+			write(mesh.vertices.data(), sizeof(Vertex) * mesh.vertices.size());
+		for (const MeshData& mesh : meshes)
+		{
+			write(mesh.indices.data(), sizeof(uint32_t) * mesh.indices.size());
+			write(mesh.lodIndices.data(), sizeof(uint32_t) * mesh.lodIndices.size());
+		}
+		write(padding, header.meshletOffset - indicesEnd);
+		for (const MeshData& mesh : meshes)
+			write(mesh.meshlets.data(), sizeof(Meshlet) * mesh.meshlets.size());
+		for (const MeshData& mesh : meshes)
+			write(mesh.lods.data(), sizeof(MeshLod) * mesh.lods.size());
+		written = bool(file);
+	}
+	std::error_code error;
+	if (written)
+		std::filesystem::rename(temporaryPath, cookedPath, error);
+	if (!written || error)
+	{
+		std::filesystem::remove(temporaryPath, error);
+		std::cout << "Failed to write cooked model: " << cookedPath << "\n";
+	}
+}
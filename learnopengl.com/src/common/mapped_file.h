@@ -0,0 +1,116 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// Read-only mapping of a whole file
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& path)
+	{
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+		                   nullptr);
+		LARGE_INTEGER fileSize;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			return;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr)
+			return;
+		view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (view != nullptr)
+			length = static_cast<size_t>(fileSize.QuadPart);
+#else
+		const int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat status;
+		if (fstat(fd, &status) == 0 && status.st_size > 0)
+		{
+			void* address = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (address != MAP_FAILED)
+			{
+				view = address;
+				length = static_cast<size_t>(status.st_size);
+			}
+		}
+		close(fd);
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (view != nullptr)
+			UnmapViewOfFile(view);
+		if (mapping != nullptr)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (view != nullptr)
+			munmap(view, length);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data() const
+	{
+		return static_cast<const char*>(view);
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+private:
+	void* view = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+/// Cooked files are written here and renamed over the target, so a crash never leaves a half written file behind. The
+/// name is unique to the process and thread, two writers of the same file never write into each other's temporary
+inline std::string getTemporaryPath(const std::string& path)
+{
+#ifdef _WIN32
+	const unsigned long processId = GetCurrentProcessId();
+#else
+	const unsigned long processId = static_cast<unsigned long>(getpid());
+#endif
+	return path + "." + std::to_string(processId) + "."
+		+ std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+}
+
+/// Size and modification time identify the source a cooked file was made from
+inline void getSourceStamp(const std::string& sourcePath, uint64_t& size, int64_t& writeTime)
+{
+	std::error_code error;
+	size = std::filesystem::file_size(sourcePath, error);
+	writeTime = std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count();
+}
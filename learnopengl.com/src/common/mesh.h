@@ -1,6 +1,12 @@
+#pragma once
+#include "mesh_simplifier.h"
+#include "meshlet.h"
 #include "shader.h"
+#include "vertex_packing.h"
 #include <glm/glm.hpp>
+#include <iostream>
 #include <string>
+#include <utility>
 #include <vector>
 
 struct Vertex
@@ -17,32 +23,121 @@ struct Texture
 	std::string path;
 };
 
+/// Layout of the vertex buffer. Packed needs a vertex shader that decodes it: location 0 is the unorm16 position
+/// inside the bounds, transformed by the positionTransform uniform, and location 1 the octahedral normal as a vec2.
+/// A mesh whose packing loses too much keeps the float layout, Mesh::format is the layout it got. A shader for both
+/// reads location 1 as a vec3 and decodes its xy when the packedNormal uniform is set
+enum class VertexFormat
+{
+	Float,
+	Packed
+};
+
+/// Geometry of a mesh before it is uploaded, the textures are only referenced by type and path
+struct MeshData
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<Texture> textures;
+	std::vector<Meshlet> meshlets;    // empty when the mesh was not split
+	std::vector<MeshLod> lods;        // empty or the full mesh first, then coarser levels
+	std::vector<uint32_t> lodIndices; // of every level but the first, after indices in the element buffer
+};
+
 class Mesh
 {
 public:
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
 	std::vector<Texture> textures;
+	std::vector<Meshlet> meshlets;
+	std::vector<MeshLod> lods;
+	std::vector<uint32_t> lodIndices;
 
 	uint32_t VAO;
+	VertexFormat format; // Float when Packed was requested and packing lost more than the tolerance
+	glm::mat4 positionTransform{1.f}; // from the packed position to model space, identity for the float layout
 
-	Mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned>& indices,
-	     const std::vector<Texture>& textures)
-		: vertices(vertices),
-		  indices(indices),
-		  textures(textures)
+	Mesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices, std::vector<Texture> textures,
+	     VertexFormat format = VertexFormat::Float)
+		: Mesh(MeshData{std::move(vertices), std::move(indices), std::move(textures)}, format)
+	{
+	}
+
+	explicit Mesh(MeshData data, VertexFormat format = VertexFormat::Float)
+		: vertices(std::move(data.vertices)),
+		  indices(std::move(data.indices)),
+		  textures(std::move(data.textures)),
+		  meshlets(std::move(data.meshlets)),
+		  lods(std::move(data.lods)),
+		  lodIndices(std::move(data.lodIndices)),
+		  format(format),
+		  requestedFormat(format)
 	{
 		setupMesh();
 	}
 
 	void Draw(Shader shader);
+	/// Draws the meshlets that pass isMeshletVisible in one multi draw and returns how many were drawn. A mesh without
+	/// meshlets is drawn whole
+	uint32_t DrawCulled(Shader shader, const Frustum& frustum, const glm::vec3& cameraPosition);
 private:
 	uint32_t VBO, EBO;
+	VertexFormat requestedFormat;
+	std::vector<GLsizei> drawCounts; // scratch for DrawCulled
+	std::vector<const void*> drawOffsets;
 
 	void setupMesh();
+	void bindTextures(Shader& shader);
 };
 
 inline void Mesh::Draw(Shader shader)
+{
+	bindTextures(shader);
+	glBindVertexArray(VAO);
+	glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, nullptr);
+}
+
+inline uint32_t Mesh::DrawCulled(Shader shader, const Frustum& frustum, const glm::vec3& cameraPosition)
+{
+	if (meshlets.empty())
+	{
+		Draw(shader);
+		return 0;
+	}
+
+	// neighbouring visible meshlets are merged into one range
+	drawCounts.clear();
+	drawOffsets.clear();
+	uint32_t visible = 0;
+	uint32_t rangeEnd = ~0u;
+	for (const Meshlet& meshlet : meshlets)
+	{
+		if (!isMeshletVisible(meshlet, frustum, cameraPosition))
+			continue;
+		visible++;
+		if (meshlet.firstIndex == rangeEnd)
+		{
+			drawCounts.back() += GLsizei(meshlet.triangleCount * 3);
+		}
+		else
+		{
+			drawCounts.push_back(GLsizei(meshlet.triangleCount * 3));
+			drawOffsets.push_back(reinterpret_cast<const void*>(sizeof(uint32_t) * meshlet.firstIndex));
+		}
+		rangeEnd = meshlet.firstIndex + meshlet.triangleCount * 3;
+	}
+	if (visible == 0)
+		return 0;
+
+	bindTextures(shader);
+	glBindVertexArray(VAO);
+	glMultiDrawElements(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_INT, drawOffsets.data(),
+	                    GLsizei(drawCounts.size()));
+	return visible;
+}
+
+inline void Mesh::bindTextures(Shader& shader)
 {
 	uint32_t diffuseNr = 1;
 	uint32_t specularNr = 1;
@@ -58,30 +153,68 @@ inline void Mesh::Draw(Shader shader)
 		shader.setInt(("material." + textures[i].type + number), i);
 		glBindTextureUnit(i, textures[i].id);
 	}
-	glBindVertexArray(VAO);
-	glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, nullptr);
+	// a mesh that fell back to floats still sets them, its shader was chosen for the packed layout
+	if (requestedFormat == VertexFormat::Packed)
+	{
+		shader.setMat4("positionTransform", positionTransform);
+		shader.setBool("packedNormal", format == VertexFormat::Packed);
+	}
 }
 
+/// A packed mesh falls back to the float layout when packing loses more than the tolerance, format tells the caller
 inline void Mesh::setupMesh()
 {
+	std::vector<PackedVertex> packed;
+	if (format == VertexFormat::Packed)
+	{
+		PackingBounds bounds;
+		PackingError error;
+		if (packVertices(vertices, packed, bounds, error))
+		{
+			positionTransform = bounds.getTransform();
+		}
+		else
+		{
+			std::cout << "Vertex packing error too large, position " << error.position << " normal "
+			          << error.normalDegrees << " degrees texcoord " << error.texCoord << ", keeping floats"
+			          << std::endl;
+			format = VertexFormat::Float;
+		}
+	}
+
 	glCreateBuffers(1, &VBO);
-	glNamedBufferData(VBO, sizeof(Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+	if (format == VertexFormat::Packed)
+		glNamedBufferData(VBO, sizeof(PackedVertex) * packed.size(), packed.data(), GL_STATIC_DRAW);
+	else
+		glNamedBufferData(VBO, sizeof(Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
 
 	glCreateBuffers(1, &EBO);
-	glNamedBufferData(EBO, sizeof(uint32_t) * indices.size(), indices.data(), GL_STATIC_DRAW);
+	glNamedBufferData(EBO, sizeof(uint32_t) * (indices.size() + lodIndices.size()), nullptr, GL_STATIC_DRAW);
+	glNamedBufferSubData(EBO, 0, sizeof(uint32_t) * indices.size(), indices.data());
+	glNamedBufferSubData(EBO, sizeof(uint32_t) * indices.size(), sizeof(uint32_t) * lodIndices.size(),
+	                     lodIndices.data());
 
 	glCreateVertexArrays(1, &VAO);
 
-	glVertexArrayVertexBuffer(VAO, 0, VBO, 0, sizeof(Vertex));
+	glVertexArrayVertexBuffer(VAO, 0, VBO, 0, format == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex));
 	glVertexArrayElementBuffer(VAO, EBO);
 
 	glEnableVertexArrayAttrib(VAO, 0);
 	glEnableVertexArrayAttrib(VAO, 1);
 	glEnableVertexArrayAttrib(VAO, 2);
 
-	glVertexArrayAttribFormat(VAO, 0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Position));
-	glVertexArrayAttribFormat(VAO, 1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Normal));
-	glVertexArrayAttribFormat(VAO, 2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, TexCoords));
+	if (format == VertexFormat::Packed)
+	{
+		glVertexArrayAttribFormat(VAO, 0, 3, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(PackedVertex, Position));
+		glVertexArrayAttribFormat(VAO, 1, 2, GL_BYTE, GL_TRUE, offsetof(PackedVertex, Normal));
+		glVertexArrayAttribFormat(VAO, 2, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertex, TexCoords));
+	}
+	else
+	{
+		glVertexArrayAttribFormat(VAO, 0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Position));
+		glVertexArrayAttribFormat(VAO, 1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Normal));
+		glVertexArrayAttribFormat(VAO, 2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, TexCoords));
+	}
 
 	glVertexArrayAttribBinding(VAO, 0, 0);
 	glVertexArrayAttribBinding(VAO, 1, 0);
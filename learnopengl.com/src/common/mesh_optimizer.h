@@ -0,0 +1,289 @@
+#pragma once
+#include "mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Load time optimization of indexed triangle lists, run before a model is cooked:
+///   1. identical vertices are merged
+///   2. triangles are reordered for the post-transform vertex cache (Tom Forsyth's linear-speed algorithm)
+///   3. clusters of that order are sorted so outward facing ones are drawn first, less overdraw
+///   4. vertices are reordered by first use, for vertex fetch locality
+/// ACMR (transformed vertices per triangle) is measured on a FIFO cache before and after
+namespace meshopt
+{
+	const uint32_t FifoCacheSize = 16;
+
+	struct Statistics
+	{
+		size_t verticesBefore = 0;
+		size_t verticesAfter = 0;
+		size_t triangles = 0;
+		float acmrBefore = 0;
+		float acmrAfter = 0;
+	};
+
+	/// Average cache miss ratio of a FIFO cache, 3 is the worst case and about 0.5 the best for regular grids
+	inline float computeAcmr(const std::vector<uint32_t>& indices, size_t vertexCount,
+	                         uint32_t cacheSize = FifoCacheSize)
+	{
+		if (indices.empty())
+			return 0;
+		std::vector<uint32_t> insertedAt(vertexCount, 0); // time the vertex entered the cache, 0 when never
+		uint32_t time = cacheSize + 1, misses = 0;
+		for (uint32_t index : indices)
+		{
+			if (insertedAt[index] == 0 || time - insertedAt[index] > cacheSize)
+			{
+				insertedAt[index] = time++;
+				misses++;
+			}
+		}
+		return float(misses) / (indices.size() / 3);
+	}
+
+	/// Merges vertices with identical bytes, the indices are remapped
+	inline void deduplicateVertices(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		const auto key = [](const Vertex& vertex) {
+			return std::string(reinterpret_cast<const char*>(&vertex), sizeof(Vertex));
+		};
+		std::unordered_map<std::string, uint32_t> unique;
+		unique.reserve(vertices.size());
+		std::vector<uint32_t> remap(vertices.size());
+		std::vector<Vertex> result;
+		result.reserve(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			auto inserted = unique.emplace(key(vertices[i]), uint32_t(result.size()));
+			if (inserted.second)
+				result.push_back(vertices[i]);
+			remap[i] = inserted.first->second;
+		}
+		for (uint32_t& index : indices)
+			index = remap[index];
+		vertices = std::move(result);
+	}
+
+	namespace forsyth
+	{
+		const int CacheSize = 32;
+
+		inline float score(int cachePosition, uint32_t remainingTriangles)
+		{
+			if (remainingTriangles == 0)
+				return -1;
+			float result = 0;
+			if (cachePosition >= 3)
+				result = std::pow(1 - float(cachePosition - 3) / (CacheSize - 3), 1.5f);
+			else if (cachePosition >= 0)
+				result = 0.75f; // the last triangle's vertices, using them again doesn't help strips
+			return result + 2 * std::pow(float(remainingTriangles), -0.5f);
+		}
+	}
+
+	/// Greedily emits the triangle with the best vertex scores, scoring favours vertices recently used and vertices
+	/// with few triangles left
+	inline void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+	{
+		using namespace forsyth;
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		// triangles of each vertex
+		std::vector<uint32_t> remaining(vertexCount, 0), offsets(vertexCount + 1, 0);
+		for (uint32_t index : indices)
+			remaining[index]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] = offsets[v] + remaining[v];
+		std::vector<uint32_t> adjacency(indices.size()), filled(offsets.begin(), offsets.end() - 1);
+		for (size_t t = 0; t < triangleCount; t++)
+			for (int k = 0; k < 3; k++)
+				adjacency[filled[indices[t * 3 + k]]++] = uint32_t(t);
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount), triangleScore(triangleCount, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+			vertexScore[v] = score(-1, remaining[v]);
+		for (size_t t = 0; t < triangleCount; t++)
+			for (int k = 0; k < 3; k++)
+				triangleScore[t] += vertexScore[indices[t * 3 + k]];
+
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+		std::vector<uint32_t> cache, nextCache;
+		size_t best = std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin();
+		size_t cursor = 0;
+
+		for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+		{
+			emitted[best] = true;
+			const uint32_t* triangle = &indices[best * 3];
+			result.insert(result.end(), triangle, triangle + 3);
+
+			// the triangle leaves the adjacency of its vertices
+			for (int k = 0; k < 3; k++)
+			{
+				const uint32_t v = triangle[k];
+				uint32_t* begin = &adjacency[offsets[v]];
+				uint32_t* end = begin + remaining[v];
+				std::iter_swap(std::find(begin, end, uint32_t(best)), end - 1);
+				remaining[v]--;
+			}
+
+			// its vertices move to the front of the LRU cache
+			nextCache.assign(triangle, triangle + 3);
+			for (uint32_t v : cache)
+				if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+					nextCache.push_back(v);
+			cache.swap(nextCache);
+
+			// scores change for everything in the cache and for vertices that just fell out of it
+			for (size_t i = 0; i < cache.size(); i++)
+			{
+				const uint32_t v = cache[i];
+				cachePosition[v] = i < size_t(CacheSize) ? int(i) : -1;
+				const float newScore = score(cachePosition[v], remaining[v]);
+				const float difference = newScore - vertexScore[v];
+				vertexScore[v] = newScore;
+				for (uint32_t j = 0; j < remaining[v]; j++)
+					triangleScore[adjacency[offsets[v] + j]] += difference;
+			}
+			if (cache.size() > size_t(CacheSize))
+				cache.resize(CacheSize);
+
+			// the best next triangle is one touching the cache, otherwise the next one not emitted yet
+			float bestScore = -1;
+			for (uint32_t v : cache)
+			{
+				for (uint32_t j = 0; j < remaining[v]; j++)
+				{
+					const uint32_t t = adjacency[offsets[v] + j];
+					if (triangleScore[t] > bestScore)
+					{
+						bestScore = triangleScore[t];
+						best = t;
+					}
+				}
+			}
+			if (bestScore < 0)
+			{
+				while (cursor < triangleCount && emitted[cursor])
+					cursor++;
+				best = cursor;
+			}
+		}
+		indices = std::move(result);
+	}
+
+	/// Splits the cache optimized order into clusters where the cache starts over, a triangle whose three vertices all
+	/// miss, and draws the clusters facing away from the mesh center first so they occlude the rest
+	inline void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices,
+	                             uint32_t cacheSize = FifoCacheSize)
+	{
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		std::vector<size_t> clusterStarts;
+		std::vector<uint32_t> insertedAt(vertices.size(), 0);
+		uint32_t time = cacheSize + 1;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			int misses = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				const uint32_t index = indices[t * 3 + k];
+				if (insertedAt[index] == 0 || time - insertedAt[index] > cacheSize)
+				{
+					insertedAt[index] = time++;
+					misses++;
+				}
+			}
+			if (t == 0 || misses == 3)
+				clusterStarts.push_back(t);
+		}
+		clusterStarts.push_back(triangleCount);
+
+		glm::vec3 meshCenter(0.f);
+		for (const Vertex& vertex : vertices)
+			meshCenter += vertex.Position;
+		meshCenter /= float(std::max<size_t>(1, vertices.size()));
+
+		struct Cluster
+		{
+			size_t begin, end;
+			float sortKey;
+		};
+		std::vector<Cluster> clusters;
+		for (size_t c = 0; c + 1 < clusterStarts.size(); c++)
+		{
+			glm::vec3 center(0.f), normal(0.f);
+			float area = 0;
+			for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+			{
+				const glm::vec3& a = vertices[indices[t * 3]].Position;
+				const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+				const glm::vec3& d = vertices[indices[t * 3 + 2]].Position;
+				const glm::vec3 areaNormal = glm::cross(b - a, d - a); // length is twice the area
+				const float weight = glm::length(areaNormal);
+				center += (a + b + d) / 3.f * weight;
+				normal += areaNormal;
+				area += weight;
+			}
+			center = area > 0 ? center / area : vertices[indices[clusterStarts[c] * 3]].Position;
+			const float normalLength = glm::length(normal);
+			const float facing = normalLength > 0 ? glm::dot(center - meshCenter, normal / normalLength) : 0;
+			clusters.push_back({clusterStarts[c], clusterStarts[c + 1], facing});
+		}
+		std::stable_sort(clusters.begin(), clusters.end(),
+		                 [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+		for (const Cluster& cluster : clusters)
+			result.insert(result.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+		indices = std::move(result);
+	}
+
+	/// Vertices in the order the indices first use them, unused vertices are dropped
+	inline void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		const uint32_t unused = ~0u;
+		std::vector<uint32_t> remap(vertices.size(), unused);
+		std::vector<Vertex> result;
+		result.reserve(vertices.size());
+		for (uint32_t& index : indices)
+		{
+			if (remap[index] == unused)
+			{
+				remap[index] = uint32_t(result.size());
+				result.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+		vertices = std::move(result);
+	}
+
+	inline Statistics optimizeMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		Statistics statistics;
+		statistics.verticesBefore = vertices.size();
+		statistics.triangles = indices.size() / 3;
+		statistics.acmrBefore = computeAcmr(indices, vertices.size());
+
+		deduplicateVertices(vertices, indices);
+		optimizeVertexCache(indices, vertices.size());
+		optimizeOverdraw(indices, vertices);
+		optimizeVertexFetch(vertices, indices);
+
+		statistics.verticesAfter = vertices.size();
+		statistics.acmrAfter = computeAcmr(indices, vertices.size());
+		return statistics;
+	}
+}
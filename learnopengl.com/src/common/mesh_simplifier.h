@@ -0,0 +1,428 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+const uint32_t MaxMeshLods = 5; // including the full mesh
+
+/// An index range of a simplified version of a mesh, drawn with the vertices of the full mesh
+struct MeshLod
+{
+	uint32_t firstIndex; // into the element buffer of the mesh
+	uint32_t indexCount;
+	float error;         // distance of the simplified surface from the full one, in model units
+};
+
+/// Pixels covered by one unit at distance one, for the vertical field of view in radians
+inline float getPixelsPerUnit(float fovy, float viewportHeight)
+{
+	return viewportHeight / (2 * std::tan(fovy / 2));
+}
+
+/// Coarsest level whose error stays below maxPixels on screen. For a scaled instance the distance is divided by the
+/// scale, the error is in model units
+inline size_t selectLod(const std::vector<MeshLod>& lods, float distance, float pixelsPerUnit, float maxPixels = 1.f)
+{
+	const float allowedError = maxPixels * distance / pixelsPerUnit;
+	size_t lod = 0;
+	while (lod + 1 < lods.size() && lods[lod + 1].error <= allowedError)
+		lod++;
+	return lod;
+}
+
+namespace simplifier
+{
+	const int Dimensions = 8; // position, normal, texture coordinates
+
+	/// Garland and Heckbert's quadric for surfaces with attributes: the squared distance of a point to the planes of
+	/// the triangles, in position, normal and texture coordinate space
+	struct Quadric
+	{
+		double a[Dimensions * (Dimensions + 1) / 2]; // upper triangle of the symmetric matrix, by rows
+		double b[Dimensions];
+		double c;
+		double weight; // summed triangle area, the error divided by it is a squared distance
+
+		void add(const Quadric& other)
+		{
+			for (size_t i = 0; i < std::size(a); i++)
+				a[i] += other.a[i];
+			for (int i = 0; i < Dimensions; i++)
+				b[i] += other.b[i];
+			c += other.c;
+			weight += other.weight;
+		}
+
+		double evaluate(const double* v) const
+		{
+			double result = c;
+			const double* row = a;
+			for (int i = 0; i < Dimensions; i++)
+			{
+				double sum = row[0] * v[i];
+				for (int j = i + 1; j < Dimensions; j++)
+					sum += 2 * row[j - i] * v[j];
+				result += v[i] * sum + 2 * b[i] * v[i];
+				row += Dimensions - i;
+			}
+			return result;
+		}
+	};
+
+	inline double dot(const double* x, const double* y)
+	{
+		double result = 0;
+		for (int i = 0; i < Dimensions; i++)
+			result += x[i] * y[i];
+		return result;
+	}
+
+	/// Quadric of the plane through p, q and r, weighted by the area of the triangle
+	inline bool makeQuadric(const double* p, const double* q, const double* r, double area, Quadric& quadric)
+	{
+		double e1[Dimensions], e2[Dimensions];
+		for (int i = 0; i < Dimensions; i++)
+		{
+			e1[i] = q[i] - p[i];
+			e2[i] = r[i] - p[i];
+		}
+		const double length1 = std::sqrt(dot(e1, e1));
+		if (length1 <= 0 || area <= 0)
+			return false;
+		for (double& x : e1)
+			x /= length1;
+		const double projection = dot(e1, e2);
+		for (int i = 0; i < Dimensions; i++)
+			e2[i] -= projection * e1[i];
+		const double length2 = std::sqrt(dot(e2, e2));
+		if (length2 <= 0)
+			return false;
+		for (double& x : e2)
+			x /= length2;
+
+		const double pe1 = dot(p, e1), pe2 = dot(p, e2);
+		double* row = quadric.a;
+		for (int i = 0; i < Dimensions; i++)
+		{
+			for (int j = i; j < Dimensions; j++)
+				row[j - i] = area * ((i == j ? 1 : 0) - e1[i] * e1[j] - e2[i] * e2[j]);
+			row += Dimensions - i;
+		}
+		for (int i = 0; i < Dimensions; i++)
+			quadric.b[i] = area * (pe1 * e1[i] + pe2 * e2[i] - p[i]);
+		quadric.c = area * (dot(p, p) - pe1 * pe1 - pe2 * pe2);
+		quadric.weight = area;
+		return true;
+	}
+}
+
+/// Edge collapse simplification with the quadric error metric, snapshotting the triangles each time fewer than the
+/// next target count are left. Vertices collapse onto a neighbour, so every level indexes the input vertices:
+/// - the quadrics include normals and texture coordinates, so collapses that smear attributes cost more
+/// - vertices sharing a position (UV and normal seams) collapse together along the seam or not at all
+/// - vertices on open borders and non-manifold edges are locked
+/// - collapses that flip a triangle or break the link condition are rejected
+/// errors receives the distance from the full surface of each snapshot, in model units. Simplification stops early
+/// when nothing is left to collapse, so fewer snapshots than targets may come back.
+/// VertexType has the Position, Normal and TexCoords members of Vertex
+template <typename VertexType>
+std::vector<std::vector<uint32_t>> simplifyMesh(const std::vector<VertexType>& vertices,
+                                                const std::vector<uint32_t>& indices,
+                                                const std::vector<size_t>& targetTriangleCounts,
+                                                std::vector<float>& errors)
+{
+	using namespace simplifier;
+	std::vector<std::vector<uint32_t>> snapshots;
+	errors.clear();
+	const size_t vertexCount = vertices.size(), triangleCount = indices.size() / 3;
+	if (triangleCount == 0 || targetTriangleCounts.empty())
+		return snapshots;
+
+	// attributes are weighted relative to the size of the mesh, so the error stays a distance in model units
+	glm::vec3 minimum(INFINITY), maximum(-INFINITY);
+	for (const VertexType& vertex : vertices)
+	{
+		minimum = glm::min(minimum, vertex.Position);
+		maximum = glm::max(maximum, vertex.Position);
+	}
+	const glm::vec3 size = maximum - minimum;
+	const double extent = std::max({size.x, size.y, size.z, 1e-6f});
+	const double normalWeight = 0.05 * extent, texCoordWeight = 0.05 * extent;
+	std::vector<double> points(vertexCount * Dimensions);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		double* point = &points[v * Dimensions];
+		const VertexType& vertex = vertices[v];
+		for (int k = 0; k < 3; k++)
+		{
+			point[k] = vertex.Position[k];
+			point[3 + k] = vertex.Normal[k] * normalWeight;
+		}
+		point[6] = vertex.TexCoords.x * texCoordWeight;
+		point[7] = vertex.TexCoords.y * texCoordWeight;
+	}
+
+	// vertices sharing a position
+	std::vector<uint32_t> positionOf(vertexCount);
+	std::vector<std::vector<uint32_t>> wedges;
+	{
+		std::unordered_map<std::string, uint32_t> positions;
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			const std::string key(reinterpret_cast<const char*>(&vertices[v].Position), sizeof(glm::vec3));
+			auto inserted = positions.emplace(key, uint32_t(wedges.size()));
+			if (inserted.second)
+				wedges.emplace_back();
+			positionOf[v] = inserted.first->second;
+			wedges[positionOf[v]].push_back(uint32_t(v));
+		}
+	}
+	const size_t positionCount = wedges.size();
+
+	// edges between positions not shared by exactly two triangles lock their ends
+	std::vector<bool> locked(positionCount, false);
+	{
+		std::unordered_map<uint64_t, uint32_t> edgeUses;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				uint64_t a = positionOf[indices[t * 3 + k]], b = positionOf[indices[t * 3 + (k + 1) % 3]];
+				if (a == b)
+					locked[a] = true;
+				edgeUses[std::min(a, b) << 32 | std::max(a, b)]++;
+			}
+		}
+		for (const auto& edge : edgeUses)
+		{
+			if (edge.second != 2)
+			{
+				locked[edge.first >> 32] = true;
+				locked[edge.first & 0xffffffff] = true;
+			}
+		}
+	}
+
+	std::vector<uint32_t> corners(indices);
+	std::vector<bool> triangleAlive(triangleCount, true);
+	std::vector<std::vector<uint32_t>> vertexTriangles(vertexCount);
+	std::vector<Quadric> quadrics(vertexCount);
+	std::memset(quadrics.data(), 0, sizeof(Quadric) * quadrics.size());
+	size_t aliveTriangles = triangleCount;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const uint32_t* corner = &corners[t * 3];
+		for (int k = 0; k < 3; k++)
+			vertexTriangles[corner[k]].push_back(uint32_t(t));
+		const glm::vec3 normal = glm::cross(vertices[corner[1]].Position - vertices[corner[0]].Position,
+		                                    vertices[corner[2]].Position - vertices[corner[0]].Position);
+		Quadric quadric;
+		if (makeQuadric(&points[corner[0] * Dimensions], &points[corner[1] * Dimensions],
+		                &points[corner[2] * Dimensions], 0.5 * glm::length(normal), quadric))
+		{
+			for (int k = 0; k < 3; k++)
+				quadrics[corner[k]].add(quadric);
+		}
+	}
+
+	const auto neighbours = [&](uint32_t position, std::vector<uint32_t>& result) {
+		result.clear();
+		for (uint32_t wedge : wedges[position])
+			for (uint32_t t : vertexTriangles[wedge])
+				for (int k = 0; k < 3; k++)
+					if (positionOf[corners[t * 3 + k]] != position)
+						result.push_back(positionOf[corners[t * 3 + k]]);
+		std::sort(result.begin(), result.end());
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+	};
+
+	struct Collapse
+	{
+		double cost;
+		uint32_t position, target, version;
+		bool operator>(const Collapse& other) const
+		{
+			return cost > other.cost;
+		}
+	};
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+	std::vector<uint32_t> versions(positionCount, 0);
+	std::vector<bool> removed(positionCount, false);
+	std::vector<std::pair<uint32_t, uint32_t>> pairs;
+	std::vector<uint32_t> positionNeighbours, targetNeighbours;
+
+	// cost of moving every wedge of position onto a wedge of target, false when the collapse is not allowed
+	const auto evaluate = [&](uint32_t position, uint32_t target, double& cost, double& distance) {
+		pairs.clear();
+		cost = 0;
+		double weight = 0;
+		for (uint32_t wedge : wedges[position])
+		{
+			if (vertexTriangles[wedge].empty())
+				continue;
+			uint32_t best = ~0u;
+			double bestCost = 0;
+			for (uint32_t t : vertexTriangles[wedge])
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					const uint32_t other = corners[t * 3 + k];
+					if (positionOf[other] != target)
+						continue;
+					const double otherCost = quadrics[wedge].evaluate(&points[other * Dimensions]);
+					if (best == ~0u || otherCost < bestCost)
+					{
+						best = other;
+						bestCost = otherCost;
+					}
+				}
+			}
+			if (best == ~0u)
+				return false; // the wedge is on the other side of a seam, moving it would open a crack
+			pairs.push_back({wedge, best});
+			cost += bestCost;
+			weight += quadrics[wedge].weight;
+		}
+
+		const glm::vec3& to = vertices[wedges[target][0]].Position;
+		for (const auto& pair : pairs)
+		{
+			for (uint32_t t : vertexTriangles[pair.first])
+			{
+				const uint32_t* corner = &corners[t * 3];
+				if (positionOf[corner[0]] == target || positionOf[corner[1]] == target
+					|| positionOf[corner[2]] == target)
+					continue;
+				glm::vec3 p[3], q[3];
+				for (int k = 0; k < 3; k++)
+				{
+					p[k] = vertices[corner[k]].Position;
+					q[k] = corner[k] == pair.first ? to : p[k];
+				}
+				const glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				const glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				if (glm::dot(before, after) <= 0.2f * glm::length(before) * glm::length(after))
+					return false;
+			}
+		}
+
+		// more than two shared neighbours would leave a non-manifold edge
+		neighbours(position, positionNeighbours);
+		neighbours(target, targetNeighbours);
+		size_t shared = 0;
+		for (uint32_t neighbour : positionNeighbours)
+			shared += std::binary_search(targetNeighbours.begin(), targetNeighbours.end(), neighbour);
+		if (shared > 2)
+			return false;
+
+		distance = weight > 0 ? std::sqrt(std::max(cost, 0.0) / weight) : 0;
+		return !pairs.empty();
+	};
+
+	std::vector<uint32_t> candidates;
+	const auto queueBest = [&](uint32_t position) {
+		versions[position]++;
+		if (locked[position] || removed[position])
+			return;
+		neighbours(position, candidates);
+		Collapse best = {0, position, ~0u, versions[position]};
+		for (uint32_t target : candidates)
+		{
+			double cost, distance;
+			if (evaluate(position, target, cost, distance) && (best.target == ~0u || cost < best.cost))
+			{
+				best.cost = cost;
+				best.target = target;
+			}
+		}
+		if (best.target != ~0u)
+			queue.push(best);
+	};
+	for (uint32_t position = 0; position < positionCount; position++)
+		queueBest(position);
+
+	const auto snapshot = [&](double error) {
+		std::vector<uint32_t> result;
+		result.reserve(aliveTriangles * 3);
+		for (size_t t = 0; t < triangleCount; t++)
+			if (triangleAlive[t])
+				result.insert(result.end(), &corners[t * 3], &corners[t * 3] + 3);
+		snapshots.push_back(std::move(result));
+		errors.push_back(float(error));
+	};
+
+	size_t nextTarget = 0;
+	double maximumDistance = 0;
+	std::vector<uint32_t> affected;
+	while (nextTarget < targetTriangleCounts.size() && !queue.empty())
+	{
+		const Collapse collapse = queue.top();
+		queue.pop();
+		if (collapse.version != versions[collapse.position] || removed[collapse.position]
+			|| removed[collapse.target])
+			continue;
+		double cost, distance;
+		if (!evaluate(collapse.position, collapse.target, cost, distance))
+		{
+			queueBest(collapse.position);
+			continue;
+		}
+
+		for (const auto& pair : pairs)
+		{
+			quadrics[pair.second].add(quadrics[pair.first]);
+			for (uint32_t t : vertexTriangles[pair.first])
+			{
+				if (!triangleAlive[t])
+					continue;
+				uint32_t* corner = &corners[t * 3];
+				if (positionOf[corner[0]] == collapse.target || positionOf[corner[1]] == collapse.target
+					|| positionOf[corner[2]] == collapse.target)
+				{
+					triangleAlive[t] = false;
+					aliveTriangles--;
+					for (int k = 0; k < 3; k++)
+					{
+						std::vector<uint32_t>& list = vertexTriangles[corner[k]];
+						if (corner[k] != pair.first)
+							list.erase(std::find(list.begin(), list.end(), t));
+					}
+				}
+				else
+				{
+					for (int k = 0; k < 3; k++)
+						if (corner[k] == pair.first)
+							corner[k] = pair.second;
+					vertexTriangles[pair.second].push_back(t);
+				}
+			}
+			vertexTriangles[pair.first].clear();
+		}
+		removed[collapse.position] = true;
+		maximumDistance = std::max(maximumDistance, distance);
+
+		while (nextTarget < targetTriangleCounts.size() && aliveTriangles <= targetTriangleCounts[nextTarget])
+		{
+			snapshot(maximumDistance);
+			nextTarget++;
+		}
+
+		neighbours(collapse.target, affected);
+		affected.push_back(collapse.target);
+		for (uint32_t position : affected)
+			queueBest(position);
+	}
+
+	// the last snapshot is what simplification could reach, if it is still worth a level
+	if (nextTarget < targetTriangleCounts.size()
+		&& aliveTriangles * 5 < (snapshots.empty() ? triangleCount : snapshots.back().size() / 3) * 4)
+		snapshot(maximumDistance);
+	return snapshots;
+}
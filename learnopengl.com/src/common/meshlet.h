@@ -0,0 +1,236 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+const uint32_t MaxMeshletVertices = 64;
+const uint32_t MaxMeshletTriangles = 124;
+
+/// A cluster of adjacent triangles, contiguous in the index buffer of its mesh. Bounds are in model space
+struct Meshlet
+{
+	uint32_t firstIndex;
+	uint32_t triangleCount;
+	uint32_t vertexCount; // unique vertices, at most MaxMeshletVertices
+	glm::vec3 center;     // bounding sphere
+	float radius;
+	glm::vec3 coneApex;   // every triangle faces away from a camera inside the cone, see isMeshletBackfacing
+	glm::vec3 coneAxis;
+	float coneCutoff;     // sine of the cone angle, 1 when the normals spread too far for a cone
+};
+
+/// Planes of a clip space matrix, pointing inwards. From a model view projection matrix they are in model space
+struct Frustum
+{
+	glm::vec4 planes[6];
+
+	explicit Frustum(const glm::mat4& matrix)
+	{
+		const glm::vec4 x(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0]);
+		const glm::vec4 y(matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1]);
+		const glm::vec4 z(matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2]);
+		const glm::vec4 w(matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]);
+		planes[0] = w + x;
+		planes[1] = w - x;
+		planes[2] = w + y;
+		planes[3] = w - y;
+		planes[4] = w + z;
+		planes[5] = w - z;
+		for (glm::vec4& plane : planes)
+			plane /= glm::length(glm::vec3(plane));
+	}
+
+	bool containsSphere(const glm::vec3& center, float radius) const
+	{
+		for (const glm::vec4& plane : planes)
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+				return false;
+		return true;
+	}
+};
+
+inline bool isMeshletBackfacing(const Meshlet& meshlet, const glm::vec3& cameraPosition)
+{
+	const glm::vec3 direction = meshlet.coneApex - cameraPosition;
+	const float length = glm::length(direction);
+	return length > 0 && glm::dot(direction, meshlet.coneAxis) > meshlet.coneCutoff * length;
+}
+
+/// Frustum and cone test, with the frustum and the camera position in the model space of the meshlet. The cone test
+/// assumes the model matrix has no non-uniform scale
+inline bool isMeshletVisible(const Meshlet& meshlet, const Frustum& frustum, const glm::vec3& cameraPosition)
+{
+	return frustum.containsSphere(meshlet.center, meshlet.radius) && !isMeshletBackfacing(meshlet, cameraPosition);
+}
+
+namespace meshlets
+{
+	/// Ritter's bounding sphere, within a few percent of the smallest one
+	inline void computeSphere(const std::vector<glm::vec3>& points, glm::vec3& center, float& radius)
+	{
+		const auto farthest = [&points](const glm::vec3& from) {
+			size_t result = 0;
+			float distance = -1;
+			for (size_t i = 0; i < points.size(); i++)
+			{
+				const glm::vec3 offset = points[i] - from;
+				if (glm::dot(offset, offset) > distance)
+				{
+					distance = glm::dot(offset, offset);
+					result = i;
+				}
+			}
+			return points[result];
+		};
+		const glm::vec3 a = farthest(points[0]);
+		const glm::vec3 b = farthest(a);
+		center = (a + b) * 0.5f;
+		radius = glm::length(b - a) * 0.5f;
+		for (const glm::vec3& point : points)
+		{
+			const float distance = glm::length(point - center);
+			if (distance > radius)
+			{
+				const float grown = (radius + distance) * 0.5f;
+				center += (point - center) * ((grown - radius) / distance);
+				radius = grown;
+			}
+		}
+	}
+
+	template <typename VertexType>
+	void computeBounds(Meshlet& meshlet, const uint32_t* indices, const std::vector<VertexType>& vertices,
+	                   std::vector<glm::vec3>& points)
+	{
+		points.clear();
+		for (uint32_t i = 0; i < meshlet.triangleCount * 3; i++)
+			points.push_back(vertices[indices[i]].Position);
+		computeSphere(points, meshlet.center, meshlet.radius);
+
+		// cone around the average triangle normal
+		std::vector<glm::vec3> normals(meshlet.triangleCount);
+		glm::vec3 axis(0.f);
+		for (uint32_t t = 0; t < meshlet.triangleCount; t++)
+		{
+			const glm::vec3 normal = glm::cross(points[t * 3 + 1] - points[t * 3], points[t * 3 + 2] - points[t * 3]);
+			const float length = glm::length(normal);
+			normals[t] = length > 0 ? normal / length : glm::vec3(0.f);
+			axis += normals[t];
+		}
+		const float axisLength = glm::length(axis);
+		axis = axisLength > 0 ? axis / axisLength : glm::vec3(0.f, 0.f, 1.f);
+		float minimumDot = 1;
+		for (const glm::vec3& normal : normals)
+			if (normal != glm::vec3(0.f))
+				minimumDot = std::min(minimumDot, glm::dot(axis, normal));
+
+		meshlet.coneAxis = axis;
+		meshlet.coneApex = meshlet.center;
+		meshlet.coneCutoff = 1;
+		if (axisLength == 0 || minimumDot <= 0.1f)
+			return;
+
+		// the apex is moved back along the axis until it is behind every triangle plane
+		float apexDistance = 0;
+		for (uint32_t t = 0; t < meshlet.triangleCount; t++)
+		{
+			if (normals[t] == glm::vec3(0.f))
+				continue;
+			const float distance = glm::dot(meshlet.center - points[t * 3], normals[t]) / glm::dot(axis, normals[t]);
+			apexDistance = std::max(apexDistance, distance);
+		}
+		meshlet.coneApex = meshlet.center - axis * apexDistance;
+		meshlet.coneCutoff = std::sqrt(1 - minimumDot * minimumDot);
+	}
+}
+
+/// Splits an indexed triangle list into meshlets, reordering the indices so each meshlet is contiguous. A meshlet is
+/// grown from the first triangle left in index order by the adjacent triangle adding the fewest vertices, so the
+/// vertex cache order of the input is mostly kept. VertexType has the Position member of Vertex
+template <typename VertexType>
+std::vector<Meshlet> buildMeshlets(std::vector<uint32_t>& indices, const std::vector<VertexType>& vertices)
+{
+	const size_t triangleCount = indices.size() / 3;
+	std::vector<Meshlet> result;
+	if (triangleCount == 0)
+		return result;
+
+	// triangles of each vertex
+	std::vector<uint32_t> offsets(vertices.size() + 1, 0);
+	for (uint32_t index : indices)
+		offsets[index + 1]++;
+	for (size_t v = 0; v < vertices.size(); v++)
+		offsets[v + 1] += offsets[v];
+	std::vector<uint32_t> adjacency(indices.size()), filled(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+		for (int k = 0; k < 3; k++)
+			adjacency[filled[indices[t * 3 + k]]++] = uint32_t(t);
+
+	std::vector<uint32_t> ordered;
+	ordered.reserve(indices.size());
+	std::vector<bool> used(triangleCount, false), inMeshlet(vertices.size(), false);
+	std::vector<uint32_t> meshletVertices;
+	std::vector<glm::vec3> points;
+	size_t cursor = 0;
+
+	while (ordered.size() < indices.size())
+	{
+		while (used[cursor])
+			cursor++;
+
+		Meshlet meshlet = {};
+		meshlet.firstIndex = uint32_t(ordered.size());
+		size_t next = cursor;
+		while (true)
+		{
+			used[next] = true;
+			for (int k = 0; k < 3; k++)
+			{
+				const uint32_t v = indices[next * 3 + k];
+				ordered.push_back(v);
+				if (!inMeshlet[v])
+				{
+					inMeshlet[v] = true;
+					meshletVertices.push_back(v);
+				}
+			}
+			if (++meshlet.triangleCount == MaxMeshletTriangles)
+				break;
+
+			// fewest new vertices first, then the earliest in index order
+			size_t best = triangleCount;
+			int bestNew = 4;
+			for (uint32_t v : meshletVertices)
+			{
+				for (uint32_t j = offsets[v]; j < offsets[v + 1]; j++)
+				{
+					const uint32_t t = adjacency[j];
+					if (used[t])
+						continue;
+					const int newVertices = !inMeshlet[indices[t * 3]] + !inMeshlet[indices[t * 3 + 1]]
+						+ !inMeshlet[indices[t * 3 + 2]];
+					if (meshletVertices.size() + newVertices <= MaxMeshletVertices
+						&& (newVertices < bestNew || (newVertices == bestNew && t < best)))
+					{
+						best = t;
+						bestNew = newVertices;
+					}
+				}
+			}
+			if (best == triangleCount)
+				break;
+			next = best;
+		}
+
+		meshlet.vertexCount = uint32_t(meshletVertices.size());
+		for (uint32_t v : meshletVertices)
+			inMeshlet[v] = false;
+		meshletVertices.clear();
+		meshlets::computeBounds(meshlet, ordered.data() + meshlet.firstIndex, vertices, points);
+		result.push_back(meshlet);
+	}
+	indices = std::move(ordered);
+	return result;
+}
@@ -0,0 +1,437 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_GENERATOR_SSE2
+#endif
+
+/// CPU mip chains for 8 bit images of 1 to 4 channels, shared by the texture cooker and the runtime upload. Each level
+/// is filtered from the one above it, the rows of a level are split across threads. With SSE2 the filters run four
+/// floats at a time in linear space, the conversions from and to 8 bit stay table lookups
+enum class MipFilter
+{
+	Box,   // 2x2 average
+	Kaiser // separable Kaiser windowed sinc over 8 taps, sharper, for offline cooking
+};
+
+enum class MipColorSpace
+{
+	Linear,
+	Srgb,  // RGB is averaged in linear light, alpha as it is
+	Normal // RGB is a tangent space normal, renormalized after filtering
+};
+
+struct MipOptions
+{
+	MipFilter filter = MipFilter::Box;
+	MipColorSpace colorSpace = MipColorSpace::Linear;
+};
+
+struct MipLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset; // into the data
+	uint64_t size;
+};
+
+struct MipChain
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t components = 0;
+	std::vector<MipLevel> levels; // down to 1x1, the base level first
+	std::vector<uint8_t> data;
+
+	const uint8_t* getLevel(size_t level) const
+	{
+		return data.data() + levels[level].offset;
+	}
+};
+
+/// Set on threads that already run next to others, such as the asset loader workers and the threads of parallelFor
+inline thread_local bool isParallelWorker = false;
+
+/// Runs body(begin, end) over [0, count) split across the hardware threads. On a parallel worker it runs inline, so
+/// nested calls and calls from several loader workers never start more threads than there are cores
+inline void parallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& body)
+{
+	const uint32_t threadCount = std::min(count, std::max(1u, std::thread::hardware_concurrency()));
+	if (threadCount <= 1 || isParallelWorker)
+	{
+		body(0, count);
+		return;
+	}
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		threads.emplace_back([&body, begin = count * i / threadCount, end = count * (i + 1) / threadCount] {
+			isParallelWorker = true;
+			body(begin, end);
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+namespace mip
+{
+	/// Levels smaller than this are not worth starting threads for
+	const uint32_t ParallelPixels = 1 << 16;
+
+	inline void forRows(uint32_t rows, uint32_t width, const std::function<void(uint32_t, uint32_t)>& body)
+	{
+		if (size_t(rows) * width < ParallelPixels)
+			body(0, rows);
+		else
+			parallelFor(rows, body);
+	}
+
+	inline const float* getSrgbToLinear()
+	{
+		static const std::vector<float> table = [] {
+			std::vector<float> values(256);
+			for (int i = 0; i < 256; i++)
+			{
+				const float c = i / 255.f;
+				values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+			return values;
+		}();
+		return table.data();
+	}
+
+	/// Indexed by linear * 4095, fine enough for 8 bit results
+	inline const uint8_t* getLinearToSrgb()
+	{
+		static const std::vector<uint8_t> table = [] {
+			std::vector<uint8_t> values(4096);
+			for (int i = 0; i < 4096; i++)
+			{
+				const float l = i / 4095.f;
+				const float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1 / 2.4f) - 0.055f;
+				values[i] = uint8_t(std::clamp(c * 255.f + 0.5f, 0.f, 255.f));
+			}
+			return values;
+		}();
+		return table.data();
+	}
+
+	inline void decode(const uint8_t* pixels, size_t count, uint32_t components, MipColorSpace colorSpace, float* out)
+	{
+		const float* srgbToLinear = getSrgbToLinear();
+		for (size_t i = 0; i < count; i++)
+		{
+			for (uint32_t c = 0; c < components; c++)
+			{
+				const uint8_t value = pixels[i * components + c];
+				float& result = out[i * components + c];
+				if (colorSpace == MipColorSpace::Srgb && c < 3)
+					result = srgbToLinear[value];
+				else if (colorSpace == MipColorSpace::Normal && c < 3)
+					result = value / 127.5f - 1;
+				else
+					result = value / 255.f;
+			}
+		}
+	}
+
+	inline void encode(const float* values, size_t count, uint32_t components, MipColorSpace colorSpace,
+	                   uint8_t* out)
+	{
+		const uint8_t* linearToSrgb = getLinearToSrgb();
+		for (size_t i = 0; i < count; i++)
+		{
+			const float* pixel = values + i * components;
+			float scale = 1;
+			if (colorSpace == MipColorSpace::Normal && components >= 3)
+			{
+				const float length = std::sqrt(pixel[0] * pixel[0] + pixel[1] * pixel[1] + pixel[2] * pixel[2]);
+				scale = length > 0 ? 1 / length : 0;
+			}
+			for (uint32_t c = 0; c < components; c++)
+			{
+				uint8_t& result = out[i * components + c];
+				if (colorSpace == MipColorSpace::Srgb && c < 3)
+					result = linearToSrgb[int(std::clamp(pixel[c], 0.f, 1.f) * 4095 + 0.5f)];
+				else if (colorSpace == MipColorSpace::Normal && c < 3)
+					result = uint8_t(std::clamp((pixel[c] * scale + 1) * 127.5f + 0.5f, 0.f, 255.f));
+				else
+					result = uint8_t(std::clamp(pixel[c] * 255 + 0.5f, 0.f, 255.f));
+			}
+		}
+	}
+
+	/// out[i] = a[i] + b[i]
+	inline void addRows(const float* a, const float* b, float* out, size_t count)
+	{
+		size_t i = 0;
+#ifdef MIP_GENERATOR_SSE2
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+#endif
+		for (; i < count; i++)
+			out[i] = a[i] + b[i];
+	}
+
+	/// out[i] += weight * in[i]
+	inline void addScaledRow(const float* in, float weight, float* out, size_t count)
+	{
+		size_t i = 0;
+#ifdef MIP_GENERATOR_SSE2
+		const __m128 scale = _mm_set1_ps(weight);
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(scale, _mm_loadu_ps(in + i))));
+#endif
+		for (; i < count; i++)
+			out[i] += weight * in[i];
+	}
+
+	/// Integer 2x2 average, SSE2 for four channels where a whole group of four source pixels is inside the row
+	inline void downsampleBoxLinear(const uint8_t* source, uint32_t sourceWidth, uint32_t sourceHeight,
+	                                uint8_t* destination, uint32_t width, uint32_t height, uint32_t components)
+	{
+		forRows(height, width, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t y = begin; y < end; y++)
+			{
+				const uint8_t* row0 = source + size_t(std::min(y * 2, sourceHeight - 1)) * sourceWidth * components;
+				const uint8_t* row1 =
+					source + size_t(std::min(y * 2 + 1, sourceHeight - 1)) * sourceWidth * components;
+				uint8_t* out = destination + size_t(y) * width * components;
+				uint32_t x = 0;
+#ifdef MIP_GENERATOR_SSE2
+				if (components == 4)
+				{
+					const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+					for (; x * 2 + 3 < sourceWidth && x + 1 < width; x += 2)
+					{
+						const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+						const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+						// columns summed per source pixel, then neighbouring pixels summed into one
+						const __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+						const __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+						const __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(low, high),
+						                                  _mm_unpackhi_epi64(low, high));
+						const __m128i average = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+						_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(average, zero));
+					}
+				}
+#endif
+				for (; x < width; x++)
+				{
+					const uint32_t x0 = std::min(x * 2, sourceWidth - 1) * components;
+					const uint32_t x1 = std::min(x * 2 + 1, sourceWidth - 1) * components;
+					for (uint32_t c = 0; c < components; c++)
+					{
+						const uint32_t sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+						out[x * components + c] = uint8_t((sum + 2) / 4);
+					}
+				}
+			}
+		});
+	}
+
+	inline void downsampleBox(const uint8_t* source, uint32_t sourceWidth, uint32_t sourceHeight,
+	                          uint8_t* destination, uint32_t width, uint32_t height, uint32_t components,
+	                          MipColorSpace colorSpace)
+	{
+		const size_t sourceStride = size_t(sourceWidth) * components;
+		forRows(height, width, [&](uint32_t begin, uint32_t end) {
+			std::vector<float> rows(sourceStride * 2), result(size_t(width) * components);
+			for (uint32_t y = begin; y < end; y++)
+			{
+				for (uint32_t r = 0; r < 2; r++)
+				{
+					const uint32_t sourceY = std::min(y * 2 + r, sourceHeight - 1);
+					decode(source + sourceY * sourceStride, sourceWidth, components, colorSpace,
+					       rows.data() + r * sourceStride);
+				}
+				// the two rows are summed first, then the pairs of columns
+				float* sum = rows.data();
+				addRows(rows.data(), rows.data() + sourceStride, sum, sourceStride);
+				uint32_t x = 0;
+#ifdef MIP_GENERATOR_SSE2
+				if (components >= 3)
+				{
+					// a pixel of three channels is written with four lanes, the last one is written again by the
+					// next pixel, so both the reads and the writes stay inside the rows
+					const uint32_t vectorWidth = components == 4 ? std::min(width, sourceWidth / 2)
+					                                             : std::min(width - 1, (sourceWidth - 1) / 2);
+					const __m128 quarter = _mm_set1_ps(0.25f);
+					for (; x < vectorWidth; x++)
+					{
+						const __m128 left = _mm_loadu_ps(sum + x * 2 * components);
+						const __m128 right = _mm_loadu_ps(sum + (x * 2 + 1) * components);
+						_mm_storeu_ps(result.data() + x * components, _mm_mul_ps(_mm_add_ps(left, right), quarter));
+					}
+				}
+#endif
+				for (; x < width; x++)
+				{
+					const uint32_t x0 = std::min(x * 2, sourceWidth - 1) * components;
+					const uint32_t x1 = std::min(x * 2 + 1, sourceWidth - 1) * components;
+					for (uint32_t c = 0; c < components; c++)
+						result[x * components + c] = (sum[x0 + c] + sum[x1 + c]) / 4;
+				}
+				encode(result.data(), width, components, colorSpace, destination + size_t(y) * width * components);
+			}
+		});
+	}
+
+	/// Weights of the 8 source texels around a destination texel, for halving. alpha = 4 and a support of two
+	/// destination texels
+	inline const float* getKaiserWeights()
+	{
+		static const std::vector<float> weights = [] {
+			const auto besselI0 = [](float x) {
+				float sum = 1, term = 1;
+				for (int k = 1; k < 16; k++)
+				{
+					term *= (x / (2 * k)) * (x / (2 * k));
+					sum += term;
+				}
+				return sum;
+			};
+			const float alpha = 4, support = 2, pi = 3.14159265f;
+			std::vector<float> values(8);
+			float total = 0;
+			for (int i = 0; i < 8; i++)
+			{
+				const float x = (i - 3.5f) / 2; // in destination texels
+				const float sinc = std::sin(pi * x) / (pi * x);
+				const float ratio = x / support;
+				values[i] = sinc * besselI0(alpha * std::sqrt(1 - ratio * ratio)) / besselI0(alpha);
+				total += values[i];
+			}
+			for (float& value : values)
+				value /= total;
+			return values;
+		}();
+		return weights.data();
+	}
+
+	inline void downsampleKaiser(const uint8_t* source, uint32_t sourceWidth, uint32_t sourceHeight,
+	                             uint8_t* destination, uint32_t width, uint32_t height, uint32_t components,
+	                             MipColorSpace colorSpace)
+	{
+		const float* weights = getKaiserWeights();
+		const size_t sourceStride = size_t(sourceWidth) * components, stride = size_t(width) * components;
+
+		std::vector<float> decoded(sourceStride * sourceHeight);
+		forRows(sourceHeight, sourceWidth, [&](uint32_t begin, uint32_t end) {
+			decode(source + begin * sourceStride, size_t(end - begin) * sourceWidth, components, colorSpace,
+			       decoded.data() + begin * sourceStride);
+		});
+
+		// horizontal pass into width x sourceHeight, a dimension of 1 is copied instead of halved
+		std::vector<float> horizontal(stride * sourceHeight);
+		forRows(sourceHeight, width, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t y = begin; y < end; y++)
+			{
+				const float* in = decoded.data() + y * sourceStride;
+				float* out = horizontal.data() + y * stride;
+				if (sourceWidth == width)
+				{
+					std::copy(in, in + stride, out);
+					continue;
+				}
+				for (uint32_t x = 0; x < width; x++)
+				{
+					const int first = int(x * 2) - 3;
+#ifdef MIP_GENERATOR_SSE2
+					// away from the edges all 8 taps are in the row and a pixel is four lanes, three channels
+					// read and write one float of their neighbour as in downsampleBox
+					const int lastRead = first + 7 + (components == 3 ? 1 : 0);
+					if (components >= 3 && first >= 0 && lastRead < int(sourceWidth)
+						&& (components == 4 || x + 1 < width))
+					{
+						__m128 sum = _mm_setzero_ps();
+						for (int i = 0; i < 8; i++)
+							sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[i]),
+							                                 _mm_loadu_ps(in + (first + i) * components)));
+						_mm_storeu_ps(out + x * components, sum);
+						continue;
+					}
+#endif
+					for (uint32_t c = 0; c < components; c++)
+					{
+						float sum = 0;
+						for (int i = 0; i < 8; i++)
+						{
+							const int sourceX = std::clamp(first + i, 0, int(sourceWidth) - 1);
+							sum += weights[i] * in[sourceX * components + c];
+						}
+						out[x * components + c] = sum;
+					}
+				}
+			}
+		});
+
+		forRows(height, width, [&](uint32_t begin, uint32_t end) {
+			std::vector<float> row(stride);
+			for (uint32_t y = begin; y < end; y++)
+			{
+				if (sourceHeight == height)
+				{
+					std::copy(horizontal.data() + y * stride, horizontal.data() + (y + 1) * stride, row.begin());
+				}
+				else
+				{
+					std::fill(row.begin(), row.end(), 0.f);
+					for (int i = 0; i < 8; i++)
+					{
+						const int sourceY = std::clamp(int(y * 2) - 3 + i, 0, int(sourceHeight) - 1);
+						addScaledRow(horizontal.data() + sourceY * stride, weights[i], row.data(), stride);
+					}
+				}
+				encode(row.data(), width, components, colorSpace, destination + y * stride);
+			}
+		});
+	}
+}
+
+inline MipChain buildMipChain(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t components,
+                              const MipOptions& options = {})
+{
+	MipChain chain;
+	chain.width = width;
+	chain.height = height;
+	chain.components = components;
+
+	// the whole chain is laid out first, each level is then written in place from the one above it
+	uint64_t offset = 0;
+	for (uint32_t w = width, h = height;; w = std::max(1u, w / 2), h = std::max(1u, h / 2))
+	{
+		const uint64_t size = uint64_t(w) * h * components;
+		chain.levels.push_back({w, h, offset, size});
+		offset += size;
+		if (w == 1 && h == 1)
+			break;
+	}
+	chain.data.resize(offset);
+	std::memcpy(chain.data.data(), pixels, chain.levels[0].size);
+
+	for (size_t i = 1; i < chain.levels.size(); i++)
+	{
+		const MipLevel& source = chain.levels[i - 1];
+		const MipLevel& level = chain.levels[i];
+		const uint8_t* in = chain.data.data() + source.offset;
+		uint8_t* out = chain.data.data() + level.offset;
+		if (options.filter == MipFilter::Kaiser)
+			mip::downsampleKaiser(in, source.width, source.height, out, level.width, level.height, components,
+			                      options.colorSpace);
+		else if (options.colorSpace == MipColorSpace::Linear)
+			mip::downsampleBoxLinear(in, source.width, source.height, out, level.width, level.height, components);
+		else
+			mip::downsampleBox(in, source.width, source.height, out, level.width, level.height, components,
+			                   options.colorSpace);
+	}
+	return chain;
+}
@@ -1,11 +1,16 @@
 #include "mesh.h"
+#include "cooked_mesh.h"
+#include "mesh_optimizer.h"
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#include "texture_cache.h"
 #include <filesystem>
 
 unsigned int TextureFromFile(const char* path, const std::string& directory, GLenum internalFormat = GL_RGB8,
@@ -14,21 +19,65 @@ unsigned int TextureFromFile(const char* path, const std::string& directory, GLe
 class Model
 {
 public:
-	Model(std::string path)
+	/// Textures are created in textureFormat, pass a block compressed format to have them cooked (see getBlockFormat)
+	Model(std::string path, VertexFormat vertexFormat = VertexFormat::Float, GLenum textureFormat = GL_RGB8)
+		: directory(std::filesystem::path(path).parent_path().string()),
+		  vertexFormat(vertexFormat),
+		  textureFormat(textureFormat)
 	{
-		loadModel(path);
+		addMeshes(loadModel(path));
 	}
 
+	/// Imports on a worker of the loader and streams the textures in, meshes stays empty until the import is done.
+	/// The model must outlive the jobs it started
+	Model(std::string path, AssetLoader& loader, VertexFormat vertexFormat = VertexFormat::Float,
+	      GLenum textureFormat = GL_RGB8)
+		: directory(std::filesystem::path(path).parent_path().string()),
+		  loader(&loader),
+		  vertexFormat(vertexFormat),
+		  textureFormat(textureFormat)
+	{
+		loader.submit([this, path]() -> AssetLoader::Completion {
+			auto meshData = std::make_shared<std::vector<MeshData>>(loadModel(path));
+			return [this, meshData] { addMeshes(std::move(*meshData)); };
+		});
+	}
+
+	~Model()
+	{
+		for (const Texture& texture : textures_loaded)
+			TextureCache::get().release(texture.id);
+	}
+
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+
 	std::vector<Mesh> meshes;
 	std::vector<Texture> textures_loaded;
 	
 	void Draw(Shader shader);
+	/// Draws only the meshlets that can be visible and returns how many of them were drawn, the camera position is in
+	/// world space
+	uint32_t DrawCulled(Shader shader, const glm::mat4& viewProjection, const glm::mat4& model,
+	                    const glm::vec3& cameraPosition);
+	size_t getMeshletCount() const;
 private:
 	std::string directory;
-	void loadModel(std::string path);
-	void processNode(aiNode* node, const aiScene* scene);
-	Mesh processMesh(aiMesh* mesh, const aiScene* scene);
-	std::vector<Texture> loadMaterialTextures(aiMaterial* material, aiTextureType type, std::string typeName);
+	AssetLoader* loader = nullptr;
+	VertexFormat vertexFormat;
+	GLenum textureFormat;
+	std::unordered_map<std::string, size_t> textureIndices; // into textures_loaded, by path
+
+	/// CPU only, safe to call from any thread
+	static std::vector<MeshData> loadModel(const std::string& path);
+	static bool loadCooked(const std::string& path, std::vector<MeshData>& meshData);
+	static void processNode(aiNode* node, const aiScene* scene, std::vector<MeshData>& meshData);
+	static MeshData processMesh(aiMesh* mesh, const aiScene* scene);
+	static void buildLods(MeshData& mesh);
+	static std::vector<Texture> loadMaterialTextures(aiMaterial* material, aiTextureType type, std::string typeName);
+
+	void addMeshes(std::vector<MeshData> meshData);
+	Texture loadTexture(const std::string& path, const std::string& typeName);
 };
 
 inline void Model::Draw(Shader shader)
@@ -39,39 +88,149 @@ inline void Model::Draw(Shader shader)
 	}
 }
 
-inline void Model::loadModel(std::string path)
+inline uint32_t Model::DrawCulled(Shader shader, const glm::mat4& viewProjection, const glm::mat4& model,
+                                  const glm::vec3& cameraPosition)
+{
+	const Frustum frustum(viewProjection * model);
+	const glm::vec3 localCamera = glm::inverse(model) * glm::vec4(cameraPosition, 1.f);
+	uint32_t visible = 0;
+	for (Mesh& mesh : meshes)
+		visible += mesh.DrawCulled(shader, frustum, localCamera);
+	return visible;
+}
+
+inline size_t Model::getMeshletCount() const
+{
+	size_t count = 0;
+	for (const Mesh& mesh : meshes)
+		count += mesh.meshlets.size();
+	return count;
+}
+
+/// Assimp only runs when there is no up to date cooked file, the result is optimized, split into meshlets, simplified
+/// into levels of detail and cooked for the next start
+inline std::vector<MeshData> Model::loadModel(const std::string& path)
 {
+	std::vector<MeshData> meshData;
+	if (loadCooked(path, meshData))
+		return meshData;
+
 	Assimp::Importer importer;
 	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
 
 	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
 	{
 		std::cout << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
-		return;
+		return meshData;
+	}
+	processNode(scene->mRootNode, scene, meshData);
+
+	meshopt::Statistics total;
+	size_t meshletCount = 0, coarsestTriangles = 0;
+	for (MeshData& mesh : meshData)
+	{
+		meshopt::Statistics statistics = meshopt::optimizeMesh(mesh.vertices, mesh.indices);
+		mesh.meshlets = buildMeshlets(mesh.indices, mesh.vertices);
+		meshopt::optimizeVertexFetch(mesh.vertices, mesh.indices);
+		buildLods(mesh);
+		meshletCount += mesh.meshlets.size();
+		coarsestTriangles += mesh.lods.back().indexCount / 3;
+		statistics.acmrAfter = meshopt::computeAcmr(mesh.indices, mesh.vertices.size());
+		total.verticesBefore += statistics.verticesBefore;
+		total.verticesAfter += statistics.verticesAfter;
+		total.triangles += statistics.triangles;
+		total.acmrBefore += statistics.acmrBefore * statistics.triangles;
+		total.acmrAfter += statistics.acmrAfter * statistics.triangles;
+	}
+	if (total.triangles > 0)
+	{
+		std::cout << path << ": " << total.triangles << " triangles, vertices " << total.verticesBefore << " -> "
+		          << total.verticesAfter << ", ACMR " << total.acmrBefore / total.triangles << " -> "
+		          << total.acmrAfter / total.triangles << ", " << meshletCount << " meshlets, coarsest level "
+		          << coarsestTriangles << " triangles" << std::endl;
+	}
+	writeCookedModel(path, meshData);
+	return meshData;
+}
+
+inline bool Model::loadCooked(const std::string& path, std::vector<MeshData>& meshData)
+{
+	const CookedModel cooked(path);
+	if (!cooked.isValid())
+		return false;
+
+	const CookedHeader& header = cooked.getHeader();
+	const CookedTexture* cookedTextures = cooked.textures();
+	const uint32_t* materialTextures = cooked.materialTextures();
+	const Vertex* vertices = cooked.vertices();
+	const uint32_t* indices = cooked.indices();
+	const Meshlet* meshlets = cooked.meshlets();
+	const MeshLod* lods = cooked.lods();
+
+	meshData.resize(header.meshCount);
+	for (uint32_t i = 0; i < header.meshCount; i++)
+	{
+		const CookedMesh& mesh = cooked.meshes()[i];
+		const CookedMaterial& material = cooked.materials()[mesh.material];
+
+		meshData[i].vertices.assign(vertices + mesh.firstVertex, vertices + mesh.firstVertex + mesh.vertexCount);
+		meshData[i].indices.assign(indices + mesh.firstIndex, indices + mesh.firstIndex + mesh.indexCount);
+		meshData[i].meshlets.assign(meshlets + mesh.firstMeshlet, meshlets + mesh.firstMeshlet + mesh.meshletCount);
+		const uint32_t* lodIndices = indices + mesh.firstIndex + mesh.indexCount;
+		meshData[i].lodIndices.assign(lodIndices, lodIndices + mesh.lodIndexCount);
+		meshData[i].lods.assign(lods + mesh.firstLod, lods + mesh.firstLod + mesh.lodCount);
+		for (uint32_t j = 0; j < material.textureCount; j++)
+		{
+			const CookedTexture& texture = cookedTextures[materialTextures[material.firstTexture + j]];
+			meshData[i].textures.push_back({0, cookedTextureTypes[texture.type], cooked.texturePath(texture)});
+		}
 	}
-	directory = std::filesystem::path(path).parent_path().string();
-	processNode(scene->mRootNode, scene);
+	return true;
 }
 
-inline void Model::processNode(aiNode* node, const aiScene* scene)
+inline void Model::processNode(aiNode* node, const aiScene* scene, std::vector<MeshData>& meshData)
 {
 	for (size_t i = 0; i < node->mNumMeshes; i++)
 	{
 		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		meshes.push_back(processMesh(mesh, scene));
+		meshData.push_back(processMesh(mesh, scene));
 	}
 
 	for (size_t i = 0; i < node->mNumChildren; i++)
 	{
-		processNode(node->mChildren[i], scene);
+		processNode(node->mChildren[i], scene, meshData);
 	}
 }
 
-inline Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
+/// Every level halves the triangles of the one before, down to MaxMeshLods levels or as far as the simplifier gets
+inline void Model::buildLods(MeshData& mesh)
 {
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
-	std::vector<Texture> textures;
+	const size_t triangleCount = mesh.indices.size() / 3;
+	std::vector<size_t> targets;
+	for (uint32_t i = 1; i < MaxMeshLods && (triangleCount >> i) >= 16; i++)
+		targets.push_back(triangleCount >> i);
+
+	std::vector<float> errors;
+	std::vector<std::vector<uint32_t>> levels = simplifyMesh(mesh.vertices, mesh.indices, targets, errors);
+	mesh.lods = {{0, static_cast<uint32_t>(mesh.indices.size()), 0.f}};
+	mesh.lodIndices.clear();
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		meshopt::optimizeVertexCache(levels[i], mesh.vertices.size());
+		mesh.lods.push_back({static_cast<uint32_t>(mesh.indices.size() + mesh.lodIndices.size()),
+		                     static_cast<uint32_t>(levels[i].size()), errors[i]});
+		mesh.lodIndices.insert(mesh.lodIndices.end(), levels[i].begin(), levels[i].end());
+	}
+}
+
+inline MeshData Model::processMesh(aiMesh* mesh, const aiScene* scene)
+{
+	MeshData meshData;
+	std::vector<Vertex>& vertices = meshData.vertices;
+	std::vector<uint32_t>& indices = meshData.indices;
+	std::vector<Texture>& textures = meshData.textures;
+	vertices.reserve(mesh->mNumVertices);
+	indices.reserve(mesh->mNumFaces * 3);
 
 	/// store vertices
 	for (size_t i = 0; i < mesh->mNumVertices; i++)
@@ -115,8 +274,7 @@ inline Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
 		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
 	}
 
-
-	return Mesh(vertices, indices, textures);
+	return meshData;
 }
 
 inline std::vector<Texture> Model::loadMaterialTextures(aiMaterial* material, aiTextureType type, std::string typeName)
@@ -126,68 +284,40 @@ inline std::vector<Texture> Model::loadMaterialTextures(aiMaterial* material, ai
 	{
 		aiString str;
 		material->GetTexture(type, i, &str);
-		bool skip = false;
-		for (size_t j = 0; j < textures_loaded.size(); j++)
-		{
-			if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-			{
-				textures.push_back(textures_loaded[j]);
-				skip = true;
-				break;
-			}
-		}
-		if (!skip)
-		{
-			Texture texture;
-			texture.id = TextureFromFile(str.C_Str(), directory);
-			texture.type = typeName;
-			texture.path = std::string(str.C_Str());
-			textures.push_back(texture);
-			textures_loaded.push_back(texture);
-		}
+		textures.push_back({0, typeName, str.C_Str()});
 	}
 	return textures;
 }
 
-unsigned int TextureFromFile(const char* path, const std::string& directory, GLenum internalFormat, GLenum wrapMode)
+/// Creates the GL objects, on the GL thread
+inline void Model::addMeshes(std::vector<MeshData> meshData)
 {
-	std::string filename = std::string(path);
-	filename = directory + '/' + filename;
-
-	unsigned int textureID;
-	glCreateTextures(GL_TEXTURE_2D, 1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-		else
-			throw std::runtime_error("unknown image channels");
-
-		glTextureStorage2D(textureID, 1, internalFormat, width, height);
-		glTextureSubImage2D(textureID, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, data);
-
-		glGenerateTextureMipmap(textureID);
-
-		glTextureParameteri(textureID, GL_TEXTURE_WRAP_S, wrapMode);
-		glTextureParameteri(textureID, GL_TEXTURE_WRAP_T, wrapMode);
-		glTextureParameteri(textureID, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTextureParameteri(textureID, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
+	meshes.reserve(meshes.size() + meshData.size());
+	for (MeshData& data : meshData)
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		for (Texture& texture : data.textures)
+			texture = loadTexture(texture.path, texture.type);
+		meshes.emplace_back(std::move(data), vertexFormat);
 	}
+}
 
-	return textureID;
+/// Each model holds one reference per texture it uses
+inline Texture Model::loadTexture(const std::string& path, const std::string& typeName)
+{
+	auto loaded = textureIndices.find(path);
+	if (loaded != textureIndices.end())
+		return textures_loaded[loaded->second];
+	Texture texture;
+	texture.id = TextureCache::get().acquire(directory + '/' + path, textureFormat, GL_REPEAT, loader);
+	texture.type = typeName;
+	texture.path = path;
+	textureIndices[path] = textures_loaded.size();
+	textures_loaded.push_back(texture);
+	return texture;
+}
+
+/// Goes through the texture cache, so loading the same file twice returns the same texture
+unsigned int TextureFromFile(const char* path, const std::string& directory, GLenum internalFormat, GLenum wrapMode)
+{
+	return TextureCache::get().acquire(directory + '/' + path, internalFormat, wrapMode);
 }
@@ -0,0 +1,266 @@
+#pragma once
+#include "asset_loader.h"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Process wide cache of textures, shared by every model and demo. Textures are looked up by canonical path and source
+/// stamp first. On a miss a texture with an up to date cooked file is uploaded from it without reading the source, any
+/// other is looked up by a hash of the file contents, so a file reached through two paths or copied under another name
+/// is still decoded and stored once. Every acquire is paired with a release, the texture is deleted with its last
+/// reference. GL thread only
+class TextureCache
+{
+public:
+	static TextureCache& get()
+	{
+		static TextureCache cache;
+		return cache;
+	}
+
+	/// With a loader the texture is decoded on its workers and looked up by path only
+	uint32_t acquire(const std::string& filename, GLenum internalFormat = GL_RGB8, GLenum wrapMode = GL_REPEAT,
+	                 AssetLoader* loader = nullptr)
+	{
+		const std::string pathKey = getPathKey(filename, internalFormat, wrapMode);
+		auto cached = byPath.find(pathKey);
+		if (cached != byPath.end())
+			return addReference(cached->second);
+
+		if (loader)
+		{
+			const uint32_t texture = loader->loadTexture(filename, internalFormat, wrapMode);
+			addEntry(texture, pathKey, 0);
+			return texture;
+		}
+
+		uint32_t texture;
+		BlockFormat format;
+		CompressedImage compressed;
+		const bool isCompressed = getBlockFormat(internalFormat, format);
+		if (isCompressed && readCompressedTexture(filename, format, compressed))
+		{
+			glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+			uploadCompressedTexture(texture, compressed, wrapMode, compressed.data.data());
+			addEntry(texture, pathKey, 0);
+			return texture;
+		}
+
+		std::ifstream file(filename, std::ios::binary);
+		const std::vector<unsigned char> contents((std::istreambuf_iterator<char>(file)),
+		                                          std::istreambuf_iterator<char>());
+		const uint64_t contentKey = getContentKey(contents, internalFormat, wrapMode);
+		auto sameContent = byContent.find(contentKey);
+		if (sameContent != byContent.end())
+		{
+			byPath[pathKey] = sameContent->second;
+			entries[sameContent->second].pathKeys.push_back(pathKey);
+			return addReference(sameContent->second);
+		}
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+		if (isCompressed && loadCompressedTexture(filename, format, compressed))
+		{
+			uploadCompressedTexture(texture, compressed, wrapMode, compressed.data.data());
+		}
+		else
+		{
+			int width, height, components;
+			unsigned char* data = contents.empty() ? nullptr
+			                                       : stbi_load_from_memory(contents.data(), int(contents.size()),
+			                                                               &width, &height, &components, 0);
+			if (data)
+			{
+				const GLenum decodedFormat = getDecodedFormat(internalFormat);
+				const MipChain mips = buildMipChain(data, width, height, components, getMipOptions(decodedFormat));
+				uploadTexture(texture, decodedFormat, wrapMode, mips, mips.data.data());
+			}
+			else
+				std::cout << "Texture failed to load at path: " << filename << std::endl;
+			stbi_image_free(data);
+		}
+
+		addEntry(texture, pathKey, contentKey);
+		return texture;
+	}
+
+	/// Cube map from six faces in +X, -X, +Y, -Y, +Z, -Z order, each face cooked to BC1 like a 2D texture. When a face
+	/// can't be cooked the faces are decoded to RGB8 instead, 0 when they can't be decoded either
+	uint32_t acquireCubeMap(const std::vector<std::filesystem::path>& faces, const std::filesystem::path& directory)
+	{
+		std::vector<std::filesystem::path> paths;
+		std::string pathKey;
+		for (const std::filesystem::path& face : faces)
+		{
+			paths.push_back(directory / face);
+			pathKey += getPathKey(paths.back().string(), GL_RGB8, GL_CLAMP_TO_EDGE) + ';';
+		}
+		auto cached = byPath.find(pathKey);
+		if (cached != byPath.end())
+			return addReference(cached->second);
+
+		// a face is read or cooked on a thread each, the cooker is CPU only
+		std::vector<CompressedImage> images(paths.size());
+		std::vector<char> loaded(paths.size(), 0);
+		parallelFor(uint32_t(paths.size()), [&](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; i++)
+				loaded[i] = loadCompressedTexture(paths[i].string(), BlockFormat::BC1, images[i]);
+		});
+		bool compressed = !paths.empty();
+		for (size_t i = 0; i < paths.size() && compressed; i++)
+			compressed = loaded[i] && images[i].width == images[0].width && images[i].height == images[0].height;
+
+		uint32_t texture;
+		glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &texture);
+		if (compressed)
+		{
+			const GLenum internalFormat = getCompressedInternalFormat(BlockFormat::BC1);
+			glTextureStorage2D(texture, GLsizei(images[0].levels.size()), internalFormat, images[0].width,
+			                   images[0].height);
+			for (size_t i = 0; i < images.size(); i++)
+			{
+				for (size_t j = 0; j < images[i].levels.size(); j++)
+				{
+					const CompressedLevel& level = images[i].levels[j];
+					glCompressedTextureSubImage3D(texture, GLint(j), 0, 0, GLint(i), level.width, level.height, 1,
+					                              internalFormat, GLsizei(level.size),
+					                              images[i].data.data() + level.offset);
+				}
+			}
+		}
+		else if (!uploadDecodedCubeMap(texture, paths))
+		{
+			glDeleteTextures(1, &texture);
+			return 0;
+		}
+		glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(texture, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		addEntry(texture, pathKey, 0);
+		return texture;
+	}
+
+	void release(uint32_t texture)
+	{
+		auto entry = entries.find(texture);
+		if (entry == entries.end() || --entry->second.references > 0)
+			return;
+		for (const std::string& pathKey : entry->second.pathKeys)
+			byPath.erase(pathKey);
+		if (entry->second.contentKey != 0)
+			byContent.erase(entry->second.contentKey);
+		entries.erase(entry);
+		glDeleteTextures(1, &texture);
+	}
+
+	size_t size() const
+	{
+		return entries.size();
+	}
+
+private:
+	struct Entry
+	{
+		size_t references;
+		std::vector<std::string> pathKeys; // every path the texture was acquired through
+		uint64_t contentKey;               // 0 when the contents were not hashed
+	};
+
+	std::unordered_map<std::string, uint32_t> byPath;
+	std::unordered_map<uint64_t, uint32_t> byContent;
+	std::unordered_map<uint32_t, Entry> entries;
+
+	TextureCache() = default;
+
+	uint32_t addReference(uint32_t texture)
+	{
+		entries[texture].references++;
+		return texture;
+	}
+
+	void addEntry(uint32_t texture, const std::string& pathKey, uint64_t contentKey)
+	{
+		byPath[pathKey] = texture;
+		if (contentKey != 0)
+			byContent[contentKey] = texture;
+		entries[texture] = {1, {pathKey}, contentKey};
+	}
+
+	/// Every face decoded to RGB8 with its mip chain, false when a face can't be decoded or differs in size from the
+	/// first one
+	static bool uploadDecodedCubeMap(uint32_t texture, const std::vector<std::filesystem::path>& paths)
+	{
+		if (paths.empty())
+			return false;
+		std::vector<MipChain> mips(paths.size());
+		parallelFor(uint32_t(paths.size()), [&](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; i++)
+			{
+				int width, height, components;
+				unsigned char* data = stbi_load(paths[i].string().c_str(), &width, &height, &components, 3);
+				if (data)
+					mips[i] = buildMipChain(data, width, height, 3, getMipOptions(GL_RGB8));
+				stbi_image_free(data);
+			}
+		});
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			if (mips[i].levels.empty() || mips[i].width != mips[0].width || mips[i].height != mips[0].height)
+			{
+				std::cout << "Cube map face failed to load at path: " << paths[i].string() << std::endl;
+				return false;
+			}
+		}
+
+		glTextureStorage2D(texture, GLsizei(mips[0].levels.size()), GL_RGB8, mips[0].width, mips[0].height);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (size_t i = 0; i < mips.size(); i++)
+		{
+			for (size_t j = 0; j < mips[i].levels.size(); j++)
+			{
+				const MipLevel& level = mips[i].levels[j];
+				glTextureSubImage3D(texture, GLint(j), 0, 0, GLint(i), level.width, level.height, 1, GL_RGB,
+				                    GL_UNSIGNED_BYTE, mips[i].getLevel(j));
+			}
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		return true;
+	}
+
+	/// The same file with another format or wrap mode is a different texture, and so is the file once it changed
+	static std::string getPathKey(const std::string& filename, GLenum internalFormat, GLenum wrapMode)
+	{
+		std::error_code error;
+		const std::filesystem::path canonical = std::filesystem::weakly_canonical(filename, error);
+		uint64_t size;
+		int64_t writeTime;
+		getSourceStamp(filename, size, writeTime);
+		return (error ? filename : canonical.string()) + '|' + std::to_string(size) + '|' + std::to_string(writeTime)
+			+ '|' + std::to_string(internalFormat) + '|' + std::to_string(wrapMode);
+	}
+
+	/// FNV-1a over the file and the parameters
+	static uint64_t getContentKey(const std::vector<unsigned char>& contents, GLenum internalFormat, GLenum wrapMode)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		const auto add = [&hash](uint64_t byte) {
+			hash ^= byte;
+			hash *= 1099511628211ull;
+		};
+		for (unsigned char byte : contents)
+			add(byte);
+		add(internalFormat & 0xff);
+		add(internalFormat >> 8);
+		add(wrapMode & 0xff);
+		add(wrapMode >> 8);
+		return hash != 0 ? hash : 1;
+	}
+};
@@ -0,0 +1,489 @@
+#pragma once
+#include "mapped_file.h"
+#include "mip_generator.h"
+#include <stb_image.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// Offline texture cooker, CPU only so it runs and can be checked without a GPU. Images are decoded, a Kaiser filtered
+/// mip chain is built, sRGB correct for color and renormalized for normal maps (BC5), and every level is encoded into
+/// 4x4 blocks, written next to the source as <image>.bc<n>.ctex so every format an image is used in keeps its own file:
+///   CompressedTextureHeader
+///   CompressedLevel[levelCount]
+///   uint8_t data[dataSize], the levels largest first
+enum class BlockFormat : uint32_t
+{
+	BC1 = 1, // RGB, 4 bits per pixel
+	BC3 = 3, // RGBA, BC1 color and BC4 alpha
+	BC5 = 5, // two channels, for normal maps
+	BC7 = 7  // RGBA, mode 6 only
+};
+
+// AstrophysicsSim/src/common/cube_map.h reads cooked skybox faces with its own copy of this layout. Bump its version
+// together with this one and keep its structs in step
+const uint32_t CompressedTextureMagic = 0x58455443; // "CTEX"
+const uint32_t CompressedTextureVersion = 3;
+
+struct CompressedTextureHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceSize;
+	int64_t sourceWriteTime;
+	BlockFormat format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t levelCount;
+	uint64_t dataSize;
+};
+
+struct CompressedLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset; // into the data
+	uint64_t size;
+};
+
+struct RgbaImage
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> pixels; // 4 bytes per pixel
+};
+
+struct CompressedImage
+{
+	BlockFormat format;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<CompressedLevel> levels;
+	std::vector<uint8_t> data;
+};
+
+inline std::string getCompressedPath(const std::string& sourcePath, BlockFormat format)
+{
+	return sourcePath + ".bc" + std::to_string(uint32_t(format)) + ".ctex";
+}
+
+inline uint32_t getBlockSize(BlockFormat format)
+{
+	return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+namespace bc
+{
+	inline uint16_t toRgb565(const int color[3])
+	{
+		return uint16_t(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5
+		                | ((color[2] * 31 + 127) / 255));
+	}
+
+	inline void fromRgb565(uint16_t packed, int color[3])
+	{
+		const int r = packed >> 11 & 31, g = packed >> 5 & 63, b = packed & 31;
+		color[0] = r << 3 | r >> 2;
+		color[1] = g << 2 | g >> 4;
+		color[2] = b << 3 | b >> 2;
+	}
+
+	/// The bounds of each channel give the corners of a box, this picks the diagonal the pixels run along: a channel
+	/// that falls while the widest one rises gets its low and high swapped
+	inline void alignEndpoints(const uint8_t pixels[64], int channels, int low[], int high[])
+	{
+		int widest = 0;
+		for (int c = 1; c < channels; c++)
+			if (high[c] - low[c] > high[widest] - low[widest])
+				widest = c;
+		int sums[4] = {};
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < channels; c++)
+				sums[c] += pixels[i * 4 + c];
+		for (int c = 0; c < channels; c++)
+		{
+			// covariance with the widest channel, scaled by 16 * 16 to stay in integers
+			int covariance = 0;
+			for (int i = 0; c != widest && i < 16; i++)
+				covariance += (pixels[i * 4 + widest] * 16 - sums[widest]) * (pixels[i * 4 + c] * 16 - sums[c]) / 16;
+			if (covariance < 0)
+				std::swap(low[c], high[c]);
+		}
+	}
+
+	/// Single channel block, channel is the byte of the RGBA pixels to encode
+	inline void encodeBC4(const uint8_t pixels[64], int channel, uint8_t* block)
+	{
+		int low = 255, high = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			low = std::min<int>(low, pixels[i * 4 + channel]);
+			high = std::max<int>(high, pixels[i * 4 + channel]);
+		}
+		// high > low selects the eight value palette
+		int palette[8] = {high, low};
+		for (int i = 2; i < 8; i++)
+			palette[i] = ((8 - i) * high + (i - 1) * low) / 7;
+
+		block[0] = uint8_t(high);
+		block[1] = uint8_t(low);
+		uint64_t indices = 0;
+		for (int i = 0; high > low && i < 16; i++)
+		{
+			int best = 0, bestError = 256;
+			for (int j = 0; j < 8; j++)
+			{
+				const int error = std::abs(pixels[i * 4 + channel] - palette[j]);
+				if (error < bestError)
+				{
+					best = j;
+					bestError = error;
+				}
+			}
+			indices |= uint64_t(best) << (i * 3);
+		}
+		for (int i = 0; i < 6; i++)
+			block[2 + i] = uint8_t(indices >> (i * 8));
+	}
+
+	/// Endpoints from the color bounds inset by 1/16 along the diagonal of the pixels, always in four color mode
+	inline void encodeBC1(const uint8_t pixels[64], uint8_t* block)
+	{
+		int low[3] = {255, 255, 255}, high[3] = {0, 0, 0};
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				low[c] = std::min<int>(low[c], pixels[i * 4 + c]);
+				high[c] = std::max<int>(high[c], pixels[i * 4 + c]);
+			}
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			const int inset = (high[c] - low[c]) / 16;
+			low[c] += inset;
+			high[c] -= inset;
+		}
+		alignEndpoints(pixels, 3, low, high);
+
+		uint16_t color0 = toRgb565(high), color1 = toRgb565(low);
+		if (color0 < color1)
+			std::swap(color0, color1);
+		int palette[4][3];
+		fromRgb565(color0, palette[0]);
+		fromRgb565(color1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		uint32_t indices = 0;
+		for (int i = 0; color0 != color1 && i < 16; i++)
+		{
+			int best = 0, bestError = 1 << 30;
+			for (int j = 0; j < 4; j++)
+			{
+				int error = 0;
+				for (int c = 0; c < 3; c++)
+					error += (pixels[i * 4 + c] - palette[j][c]) * (pixels[i * 4 + c] - palette[j][c]);
+				if (error < bestError)
+				{
+					best = j;
+					bestError = error;
+				}
+			}
+			indices |= uint32_t(best) << (i * 2);
+		}
+		block[0] = uint8_t(color0);
+		block[1] = uint8_t(color0 >> 8);
+		block[2] = uint8_t(color1);
+		block[3] = uint8_t(color1 >> 8);
+		for (int i = 0; i < 4; i++)
+			block[4 + i] = uint8_t(indices >> (i * 8));
+	}
+
+	inline void encodeBC3(const uint8_t pixels[64], uint8_t* block)
+	{
+		encodeBC4(pixels, 3, block);
+		encodeBC1(pixels, block + 8);
+	}
+
+	inline void encodeBC5(const uint8_t pixels[64], uint8_t* block)
+	{
+		encodeBC4(pixels, 0, block);
+		encodeBC4(pixels, 1, block + 8);
+	}
+
+	/// Writes the low count bits of value at bit position, blocks are little endian bit streams
+	inline void writeBits(uint8_t* block, int& position, uint32_t value, int count)
+	{
+		for (int i = 0; i < count; i++, position++)
+			block[position / 8] |= uint8_t((value >> i & 1) << (position % 8));
+	}
+
+	/// Mode 6: one subset, RGBA endpoints of 7 bits plus a shared lowest bit each, 4 bit indices
+	inline void encodeBC7(const uint8_t pixels[64], uint8_t* block)
+	{
+		static const int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+		int endpoints[2][4] = {{255, 255, 255, 255}, {0, 0, 0, 0}};
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				endpoints[0][c] = std::min<int>(endpoints[0][c], pixels[i * 4 + c]);
+				endpoints[1][c] = std::max<int>(endpoints[1][c], pixels[i * 4 + c]);
+			}
+		}
+		alignEndpoints(pixels, 4, endpoints[0], endpoints[1]);
+
+		// quantize each endpoint with the p-bit that reproduces it best
+		int quantized[2][4], pBits[2], decoded[2][4];
+		for (int e = 0; e < 2; e++)
+		{
+			int bestError = 1 << 30;
+			for (int p = 0; p < 2; p++)
+			{
+				int values[4], error = 0;
+				for (int c = 0; c < 4; c++)
+				{
+					values[c] = std::clamp((endpoints[e][c] - p + 1) >> 1, 0, 127);
+					const int difference = endpoints[e][c] - (values[c] << 1 | p);
+					error += difference * difference;
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					pBits[e] = p;
+					std::copy(values, values + 4, quantized[e]);
+				}
+			}
+			for (int c = 0; c < 4; c++)
+				decoded[e][c] = quantized[e][c] << 1 | pBits[e];
+		}
+
+		int indices[16];
+		for (int i = 0; i < 16; i++)
+		{
+			int bestError = 1 << 30;
+			for (int j = 0; j < 16; j++)
+			{
+				int error = 0;
+				for (int c = 0; c < 4; c++)
+				{
+					const int value = ((64 - weights[j]) * decoded[0][c] + weights[j] * decoded[1][c] + 32) >> 6;
+					error += (pixels[i * 4 + c] - value) * (pixels[i * 4 + c] - value);
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					indices[i] = j;
+				}
+			}
+		}
+
+		// the first index is stored without its top bit, swapping the endpoints clears it
+		if (indices[0] >= 8)
+		{
+			std::swap(quantized[0], quantized[1]);
+			std::swap(pBits[0], pBits[1]);
+			for (int& index : indices)
+				index = 15 - index;
+		}
+
+		std::memset(block, 0, 16);
+		int position = 0;
+		writeBits(block, position, 1 << 6, 7);
+		for (int c = 0; c < 4; c++)
+		{
+			writeBits(block, position, quantized[0][c], 7);
+			writeBits(block, position, quantized[1][c], 7);
+		}
+		writeBits(block, position, pBits[0], 1);
+		writeBits(block, position, pBits[1], 1);
+		writeBits(block, position, indices[0], 3);
+		for (int i = 1; i < 16; i++)
+			writeBits(block, position, indices[i], 4);
+	}
+}
+
+/// Encodes one RGBA level, the rows of blocks are split across threads. Blocks past the edge repeat the last pixels
+inline std::vector<uint8_t> encodeLevel(const uint8_t* image, uint32_t width, uint32_t height, BlockFormat format)
+{
+	const uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	const uint32_t blockSize = getBlockSize(format);
+	std::vector<uint8_t> data(size_t(blocksX) * blocksY * blockSize);
+
+	parallelFor(blocksY, [&](uint32_t begin, uint32_t end) {
+		uint8_t pixels[64];
+		for (uint32_t by = begin; by < end; by++)
+		{
+			for (uint32_t bx = 0; bx < blocksX; bx++)
+			{
+				for (uint32_t i = 0; i < 16; i++)
+				{
+					const uint32_t x = std::min(bx * 4 + i % 4, width - 1);
+					const uint32_t y = std::min(by * 4 + i / 4, height - 1);
+					std::memcpy(pixels + i * 4, image + (size_t(y) * width + x) * 4, 4);
+				}
+				uint8_t* block = &data[(size_t(by) * blocksX + bx) * blockSize];
+				switch (format)
+				{
+				case BlockFormat::BC1:
+					bc::encodeBC1(pixels, block);
+					break;
+				case BlockFormat::BC3:
+					bc::encodeBC3(pixels, block);
+					break;
+				case BlockFormat::BC5:
+					bc::encodeBC5(pixels, block);
+					break;
+				case BlockFormat::BC7:
+					bc::encodeBC7(pixels, block);
+					break;
+				}
+			}
+		}
+	});
+	return data;
+}
+
+inline CompressedImage compressImage(const RgbaImage& image, BlockFormat format)
+{
+	CompressedImage compressed;
+	compressed.format = format;
+	compressed.width = image.width;
+	compressed.height = image.height;
+	MipOptions options;
+	options.filter = MipFilter::Kaiser;
+	options.colorSpace = format == BlockFormat::BC5 ? MipColorSpace::Normal : MipColorSpace::Srgb;
+	const MipChain chain = buildMipChain(image.pixels.data(), image.width, image.height, 4, options);
+	for (size_t i = 0; i < chain.levels.size(); i++)
+	{
+		const MipLevel& level = chain.levels[i];
+		const std::vector<uint8_t> data = encodeLevel(chain.getLevel(i), level.width, level.height, format);
+		compressed.levels.push_back({level.width, level.height, compressed.data.size(), data.size()});
+		compressed.data.insert(compressed.data.end(), data.begin(), data.end());
+	}
+	return compressed;
+}
+
+inline bool writeCompressedTexture(const std::string& sourcePath, const CompressedImage& image)
+{
+	CompressedTextureHeader header = {};
+	header.magic = CompressedTextureMagic;
+	header.version = CompressedTextureVersion;
+	getSourceStamp(sourcePath, header.sourceSize, header.sourceWriteTime);
+	header.format = image.format;
+	header.width = image.width;
+	header.height = image.height;
+	header.levelCount = uint32_t(image.levels.size());
+	header.dataSize = image.data.size();
+
+	// same as cooked models, loader workers may cook the same image at once
+	const std::string path = getCompressedPath(sourcePath, image.format);
+	const std::string temporaryPath = getTemporaryPath(path);
+	bool written;
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(image.levels.data()), sizeof(CompressedLevel) * image.levels.size());
+		file.write(reinterpret_cast<const char*>(image.data.data()), image.data.size());
+		written = bool(file);
+	}
+	std::error_code error;
+	if (written)
+		std::filesystem::rename(temporaryPath, path, error);
+	if (!written || error)
+		std::filesystem::remove(temporaryPath, error);
+	return written && !error;
+}
+
+/// Levels halve from the size in the header down to at most 1x1, each holds exactly the blocks of its size, and they
+/// follow each other through the whole data, so no upload reads past it
+inline bool hasValidLevels(const CompressedTextureHeader& header, const CompressedLevel* levels)
+{
+	if (header.width == 0 || header.height == 0 || header.levelCount == 0)
+		return false;
+	uint32_t width = header.width, height = header.height;
+	uint64_t offset = 0;
+	for (uint32_t i = 0; i < header.levelCount; i++)
+	{
+		const CompressedLevel& level = levels[i];
+		const uint64_t size = (uint64_t(width) + 3) / 4 * ((uint64_t(height) + 3) / 4) * getBlockSize(header.format);
+		if (level.width != width || level.height != height || level.offset != offset || level.size != size)
+			return false;
+		offset += size;
+		if (width == 1 && height == 1 && i + 1 < header.levelCount)
+			return false;
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+	return offset == header.dataSize;
+}
+
+/// A compressed texture is only used when it was cooked from the current source in the requested format
+inline bool readCompressedTexture(const std::string& sourcePath, BlockFormat format, CompressedImage& image)
+{
+	const MappedFile file(getCompressedPath(sourcePath, format));
+	CompressedTextureHeader header;
+	if (file.size() < sizeof(header))
+		return false;
+	std::memcpy(&header, file.data(), sizeof(header));
+	if (header.magic != CompressedTextureMagic || header.version != CompressedTextureVersion
+		|| header.format != format
+		|| file.size() != sizeof(header) + sizeof(CompressedLevel) * header.levelCount + header.dataSize)
+		return false;
+	if (std::filesystem::exists(sourcePath))
+	{
+		uint64_t size;
+		int64_t writeTime;
+		getSourceStamp(sourcePath, size, writeTime);
+		if (size != header.sourceSize || writeTime != header.sourceWriteTime)
+			return false;
+	}
+
+	const char* levels = file.data() + sizeof(header);
+	const char* data = levels + sizeof(CompressedLevel) * header.levelCount;
+	image.levels.resize(header.levelCount);
+	std::memcpy(image.levels.data(), levels, sizeof(CompressedLevel) * header.levelCount);
+	if (!hasValidLevels(header, image.levels.data()))
+	{
+		std::cout << "Cooked texture is corrupt: " << getCompressedPath(sourcePath, format) << std::endl;
+		image.levels.clear();
+		return false;
+	}
+	image.format = header.format;
+	image.width = header.width;
+	image.height = header.height;
+	image.data.assign(data, data + header.dataSize);
+	return true;
+}
+
+/// Reads the cooked texture, cooking it first when it is missing or stale. False when the source can't be decoded
+inline bool loadCompressedTexture(const std::string& sourcePath, BlockFormat format, CompressedImage& image)
+{
+	if (readCompressedTexture(sourcePath, format, image))
+		return true;
+
+	RgbaImage source;
+	int width, height, components;
+	unsigned char* pixels = stbi_load(sourcePath.c_str(), &width, &height, &components, 4);
+	if (!pixels)
+		return false;
+	source.width = uint32_t(width);
+	source.height = uint32_t(height);
+	source.pixels.assign(pixels, pixels + size_t(width) * height * 4);
+	stbi_image_free(pixels);
+
+	image = compressImage(source, format);
+	writeCompressedTexture(sourcePath, image);
+	return true;
+}
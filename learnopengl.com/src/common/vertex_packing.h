@@ -0,0 +1,159 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/// 12 byte vertex, packed from the 32 byte float one:
+///   position  3 x unorm16, relative to the bounds of the mesh
+///   normal    2 x snorm8, octahedral encoding
+///   texcoord  2 x half
+/// The layout of the rock vertex shader is the reference for decoding, see 10.3.asteroids_instanced/rock.vert
+struct PackedVertex
+{
+	uint16_t Position[3];
+	int8_t Normal[2];
+	uint16_t TexCoords[2];
+};
+static_assert(sizeof(PackedVertex) == 12, "PackedVertex must stay tightly packed");
+
+/// Largest error packing may introduce, beyond it the mesh keeps the float layout
+struct PackingTolerance
+{
+	float position = 1.f / 65535;      // relative to the largest extent of the bounds
+	float normalDegrees = 1.f;
+	float texCoord = 1.f / 2048;       // half a texel of a 1024 texture
+};
+
+struct PackingError
+{
+	float position = 0;
+	float normalDegrees = 0;
+	float texCoord = 0;
+};
+
+/// Normalized unorm16 positions map to these bounds, position = offset + scale * packed
+struct PackingBounds
+{
+	glm::vec3 offset{0.f};
+	glm::vec3 scale{1.f};
+
+	glm::mat4 getTransform() const
+	{
+		glm::mat4 transform(1.f);
+		transform[0][0] = scale.x;
+		transform[1][1] = scale.y;
+		transform[2][2] = scale.z;
+		transform[3] = glm::vec4(offset, 1.f);
+		return transform;
+	}
+};
+
+namespace packing
+{
+	inline glm::vec2 octEncode(glm::vec3 normal)
+	{
+		const float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+		if (sum == 0)
+			return glm::vec2(0.f); // decodes to +Z
+		normal /= sum;
+		glm::vec2 result(normal.x, normal.y);
+		if (normal.z < 0)
+		{
+			result.x = (1 - std::abs(normal.y)) * (normal.x >= 0 ? 1.f : -1.f);
+			result.y = (1 - std::abs(normal.x)) * (normal.y >= 0 ? 1.f : -1.f);
+		}
+		return result;
+	}
+
+	inline glm::vec3 octDecode(glm::vec2 encoded)
+	{
+		glm::vec3 normal(encoded.x, encoded.y, 1 - std::abs(encoded.x) - std::abs(encoded.y));
+		const float t = std::max(-normal.z, 0.f);
+		normal.x += normal.x >= 0 ? -t : t;
+		normal.y += normal.y >= 0 ? -t : t;
+		return glm::normalize(normal);
+	}
+
+	inline float unpackSnorm8(int8_t value)
+	{
+		return std::max(value / 127.f, -1.f);
+	}
+
+	/// The snorm8 code closest in angle, rounding each component on its own can be off by a whole step
+	inline void packNormal(const glm::vec3& normal, int8_t packed[2])
+	{
+		const glm::vec2 encoded = octEncode(normal);
+		const float x = glm::clamp(encoded.x, -1.f, 1.f) * 127, y = glm::clamp(encoded.y, -1.f, 1.f) * 127;
+		float bestCos = -2;
+		for (float i : {std::floor(x), std::ceil(x)})
+		{
+			for (float j : {std::floor(y), std::ceil(y)})
+			{
+				const float cos = glm::dot(octDecode(glm::vec2(i, j) / 127.f), normal);
+				if (cos > bestCos)
+				{
+					bestCos = cos;
+					packed[0] = int8_t(i);
+					packed[1] = int8_t(j);
+				}
+			}
+		}
+	}
+
+	inline glm::vec3 unpackNormal(const int8_t packed[2])
+	{
+		return octDecode(glm::vec2(unpackSnorm8(packed[0]), unpackSnorm8(packed[1])));
+	}
+}
+
+/// Packs the vertices and measures the error by decoding them again, false when it is above the tolerance.
+/// VertexType has the Position, Normal and TexCoords members of Vertex
+template <typename VertexType>
+bool packVertices(const std::vector<VertexType>& vertices, std::vector<PackedVertex>& packed, PackingBounds& bounds,
+                  PackingError& error, const PackingTolerance& tolerance = {})
+{
+	glm::vec3 minimum(INFINITY), maximum(-INFINITY);
+	for (const VertexType& vertex : vertices)
+	{
+		minimum = glm::min(minimum, vertex.Position);
+		maximum = glm::max(maximum, vertex.Position);
+	}
+	bounds.offset = vertices.empty() ? glm::vec3(0.f) : minimum;
+	bounds.scale = vertices.empty() ? glm::vec3(1.f) : glm::max(maximum - minimum, glm::vec3(1e-20f));
+	const float extent = std::max({bounds.scale.x, bounds.scale.y, bounds.scale.z});
+
+	packed.resize(vertices.size());
+	error = {};
+	float minimumCos = 1;
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const VertexType& source = vertices[i];
+		PackedVertex& vertex = packed[i];
+		const glm::vec3 relative = (source.Position - bounds.offset) / bounds.scale;
+		for (int k = 0; k < 3; k++)
+			vertex.Position[k] = uint16_t(std::lround(glm::clamp(relative[k], 0.f, 1.f) * 65535));
+		packing::packNormal(source.Normal, vertex.Normal);
+		vertex.TexCoords[0] = glm::packHalf1x16(source.TexCoords.x);
+		vertex.TexCoords[1] = glm::packHalf1x16(source.TexCoords.y);
+
+		const glm::vec3 position = bounds.offset
+			+ bounds.scale * glm::vec3(vertex.Position[0], vertex.Position[1], vertex.Position[2]) / 65535.f;
+		const glm::vec3 difference = glm::abs(position - source.Position);
+		error.position = std::max({error.position, difference.x / extent, difference.y / extent,
+		                           difference.z / extent});
+		const float length = glm::length(source.Normal);
+		if (length > 0)
+			minimumCos = std::min(minimumCos, glm::dot(packing::unpackNormal(vertex.Normal), source.Normal / length));
+		error.texCoord = std::max({error.texCoord,
+		                           std::abs(glm::unpackHalf1x16(vertex.TexCoords[0]) - source.TexCoords.x),
+		                           std::abs(glm::unpackHalf1x16(vertex.TexCoords[1]) - source.TexCoords.y)});
+	}
+	error.normalDegrees = glm::degrees(std::acos(glm::clamp(minimumCos, -1.f, 1.f)));
+
+	// NaN compares false, so a broken vertex fails too
+	return error.position <= tolerance.position && error.normalDegrees <= tolerance.normalDegrees
+		&& error.texCoord <= tolerance.texCoord;
+}
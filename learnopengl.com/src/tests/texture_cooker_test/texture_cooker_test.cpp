@@ -0,0 +1,340 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include <texture_cooker.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+// Round trip of the block encoders of texture_cooker.h: known 4x4 blocks are encoded, decoded again with the decoders
+// below, written from the format specifications independently of the encoders, and compared with the source pixels.
+// Runs without a GPU, the exit code is the number of failed checks
+
+namespace
+{
+	int failures = 0;
+
+	void check(bool condition, const std::string& name)
+	{
+		if (!condition)
+		{
+			std::cout << "FAILED: " << name << std::endl;
+			failures++;
+		}
+	}
+
+	uint32_t readBits(const uint8_t* block, int& position, int count)
+	{
+		uint32_t value = 0;
+		for (int i = 0; i < count; i++, position++)
+			value |= uint32_t(block[position / 8] >> (position % 8) & 1) << i;
+		return value;
+	}
+
+	void decodeBC1(const uint8_t* block, uint8_t pixels[64])
+	{
+		const uint16_t color0 = uint16_t(block[0] | block[1] << 8), color1 = uint16_t(block[2] | block[3] << 8);
+		int palette[4][3];
+		bc::fromRgb565(color0, palette[0]);
+		bc::fromRgb565(color1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			if (color0 > color1)
+			{
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+			else
+			{
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+		}
+		const uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | uint32_t(block[7]) << 24;
+		for (int i = 0; i < 16; i++)
+		{
+			const int index = indices >> (i * 2) & 3;
+			for (int c = 0; c < 3; c++)
+				pixels[i * 4 + c] = uint8_t(palette[index][c]);
+			pixels[i * 4 + 3] = 255;
+		}
+	}
+
+	void decodeBC4(const uint8_t* block, int channel, uint8_t pixels[64])
+	{
+		const int value0 = block[0], value1 = block[1];
+		int palette[8] = {value0, value1};
+		if (value0 > value1)
+		{
+			for (int i = 2; i < 8; i++)
+				palette[i] = ((8 - i) * value0 + (i - 1) * value1) / 7;
+		}
+		else
+		{
+			for (int i = 2; i < 6; i++)
+				palette[i] = ((6 - i) * value0 + (i - 1) * value1) / 5;
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+		int position = 16;
+		for (int i = 0; i < 16; i++)
+			pixels[i * 4 + channel] = uint8_t(palette[readBits(block, position, 3)]);
+	}
+
+	/// Mode 6 only, false for any other mode
+	bool decodeBC7(const uint8_t* block, uint8_t pixels[64], int endpoints[2][4])
+	{
+		static const int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+		int position = 0;
+		if (readBits(block, position, 7) != 1 << 6)
+			return false;
+		for (int c = 0; c < 4; c++)
+		{
+			endpoints[0][c] = int(readBits(block, position, 7)) << 1;
+			endpoints[1][c] = int(readBits(block, position, 7)) << 1;
+		}
+		const int pBit0 = int(readBits(block, position, 1)), pBit1 = int(readBits(block, position, 1));
+		for (int c = 0; c < 4; c++)
+		{
+			endpoints[0][c] |= pBit0;
+			endpoints[1][c] |= pBit1;
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			const int weight = weights[readBits(block, position, i == 0 ? 3 : 4)];
+			for (int c = 0; c < 4; c++)
+				pixels[i * 4 + c] = uint8_t(((64 - weight) * endpoints[0][c] + weight * endpoints[1][c] + 32) >> 6);
+		}
+		return true;
+	}
+
+	/// Largest difference of any pixel in the channels [first, first + count)
+	int getMaxError(const uint8_t a[64], const uint8_t b[64], int first, int count)
+	{
+		int error = 0;
+		for (int i = 0; i < 16; i++)
+			for (int c = first; c < first + count; c++)
+				error = std::max(error, std::abs(a[i * 4 + c] - b[i * 4 + c]));
+		return error;
+	}
+
+	double getRmsError(const uint8_t a[64], const uint8_t b[64], int first, int count)
+	{
+		double sum = 0;
+		for (int i = 0; i < 16; i++)
+			for (int c = first; c < first + count; c++)
+				sum += double(a[i * 4 + c] - b[i * 4 + c]) * (a[i * 4 + c] - b[i * 4 + c]);
+		return std::sqrt(sum / (16 * count));
+	}
+
+	void fillSolid(uint8_t pixels[64], uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			pixels[i * 4 + 0] = r;
+			pixels[i * 4 + 1] = g;
+			pixels[i * 4 + 2] = b;
+			pixels[i * 4 + 3] = a;
+		}
+	}
+
+	/// Diagonal ramp from the first color in the top left to the second in the bottom right
+	void fillGradient(uint8_t pixels[64], const int from[4], const int to[4])
+	{
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < 4; c++)
+				pixels[i * 4 + c] = uint8_t(from[c] + (to[c] - from[c]) * (i % 4 + i / 4) / 6);
+	}
+
+	void testSingleColor()
+	{
+		const uint8_t colors[][4] = {{0, 0, 0, 255}, {255, 255, 255, 255}, {200, 100, 50, 128}, {17, 230, 91, 3}};
+		for (const uint8_t* color : colors)
+		{
+			uint8_t pixels[64], decoded[64], block[16];
+			fillSolid(pixels, color[0], color[1], color[2], color[3]);
+
+			// RGB565 is off by at most half a step, 4 in red and blue and 2 in green
+			bc::encodeBC1(pixels, block);
+			decodeBC1(block, decoded);
+			check(getMaxError(pixels, decoded, 0, 1) <= 4 && getMaxError(pixels, decoded, 1, 1) <= 2
+			          && getMaxError(pixels, decoded, 2, 1) <= 4,
+			      "BC1 single color");
+
+			bc::encodeBC3(pixels, block);
+			decodeBC1(block + 8, decoded);
+			decodeBC4(block, 3, decoded);
+			check(getMaxError(pixels, decoded, 3, 1) == 0, "BC3 single alpha is exact");
+
+			bc::encodeBC5(pixels, block);
+			decodeBC4(block, 0, decoded);
+			decodeBC4(block + 8, 1, decoded);
+			check(getMaxError(pixels, decoded, 0, 2) == 0, "BC5 single color is exact");
+
+			// seven bits and a shared p-bit, a channel whose lowest bit differs from the others is off by one
+			int endpoints[2][4];
+			bc::encodeBC7(pixels, block);
+			check(decodeBC7(block, decoded, endpoints), "BC7 single color is mode 6");
+			check(getMaxError(pixels, decoded, 0, 4) <= 1, "BC7 single color");
+		}
+	}
+
+	/// The second ramp has channels falling while others rise, the endpoints must follow that diagonal of the bounds
+	void testGradient()
+	{
+		const int ramps[][2][4] = {{{0, 0, 0, 0}, {255, 255, 255, 255}},
+		                           {{30, 200, 90, 255}, {220, 40, 160, 0}},
+		                           {{120, 120, 120, 60}, {136, 128, 120, 70}}};
+		for (const auto& ramp : ramps)
+		{
+			uint8_t pixels[64], decoded[64], block[16];
+			fillGradient(pixels, ramp[0], ramp[1]);
+
+			bc::encodeBC1(pixels, block);
+			decodeBC1(block, decoded);
+			// seven steps on four palette entries
+			check(getRmsError(pixels, decoded, 0, 3) < 28.0, "BC1 gradient");
+
+			bc::encodeBC3(pixels, block);
+			decodeBC4(block, 3, decoded);
+			check(getMaxError(pixels, decoded, 3, 1) <= 19, "BC3 gradient alpha");
+
+			bc::encodeBC5(pixels, block);
+			decodeBC4(block, 0, decoded);
+			decodeBC4(block + 8, 1, decoded);
+			check(getMaxError(pixels, decoded, 0, 2) <= 19, "BC5 gradient");
+
+			int endpoints[2][4];
+			bc::encodeBC7(pixels, block);
+			decodeBC7(block, decoded, endpoints);
+			check(getRmsError(pixels, decoded, 0, 4) < 6.0, "BC7 gradient");
+		}
+	}
+
+	/// The first index of a BC7 block is stored without its top bit, so a block whose first pixel is closest to the
+	/// second endpoint must come out with the endpoints swapped and still decode to the source
+	void testAnchorSwap()
+	{
+		uint8_t pixels[64], decoded[64], block[16];
+		const int from[4] = {250, 240, 230, 255}, to[4] = {10, 20, 30, 40};
+		fillGradient(pixels, from, to);
+
+		int endpoints[2][4];
+		bc::encodeBC7(pixels, block);
+		check(decodeBC7(block, decoded, endpoints), "BC7 anchor swap is mode 6");
+		check(endpoints[0][0] > endpoints[1][0], "BC7 anchor swap puts the bright endpoint first");
+		check(getRmsError(pixels, decoded, 0, 4) < 6.0, "BC7 anchor swap");
+
+		// and the same pixels in the other order need no swap
+		const int reversedFrom[4] = {10, 20, 30, 40}, reversedTo[4] = {250, 240, 230, 255};
+		fillGradient(pixels, reversedFrom, reversedTo);
+		bc::encodeBC7(pixels, block);
+		decodeBC7(block, decoded, endpoints);
+		check(endpoints[0][0] < endpoints[1][0], "BC7 without anchor swap keeps the dark endpoint first");
+		check(getRmsError(pixels, decoded, 0, 4) < 6.0, "BC7 without anchor swap");
+	}
+
+	/// Noise is the worst case of a single subset, the bound only catches a broken encoder
+	void testNoise()
+	{
+		std::mt19937 random(1);
+		std::uniform_int_distribution<int> byte(0, 255);
+		for (int n = 0; n < 256; n++)
+		{
+			uint8_t pixels[64], decoded[64], block[16];
+			for (uint8_t& value : pixels)
+				value = uint8_t(byte(random));
+
+			bc::encodeBC1(pixels, block);
+			decodeBC1(block, decoded);
+			check(getRmsError(pixels, decoded, 0, 3) < 80.0, "BC1 noise");
+
+			int endpoints[2][4];
+			bc::encodeBC7(pixels, block);
+			check(decodeBC7(block, decoded, endpoints), "BC7 noise is mode 6");
+			check(getRmsError(pixels, decoded, 0, 4) < 80.0, "BC7 noise");
+		}
+	}
+
+	/// Blocks past the right and bottom edges repeat the last column and row
+	void testPartialBlocks()
+	{
+		const uint32_t width = 5, height = 3;
+		std::vector<uint8_t> image(width * height * 4);
+		for (uint32_t i = 0; i < width * height; i++)
+		{
+			image[i * 4 + 0] = uint8_t(i * 16);
+			image[i * 4 + 1] = 64;
+			image[i * 4 + 2] = 128;
+			image[i * 4 + 3] = 255;
+		}
+		const std::vector<uint8_t> data = encodeLevel(image.data(), width, height, BlockFormat::BC7);
+		check(data.size() == 2 * 16, "BC7 level of 5x3 is two blocks");
+
+		uint8_t decoded[64];
+		int endpoints[2][4];
+		decodeBC7(data.data() + 16, decoded, endpoints);
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			const uint32_t source = std::min(i / 4, height - 1) * width + width - 1;
+			check(std::abs(decoded[i * 4] - image[source * 4]) <= 6, "BC7 edge block repeats the last pixels");
+		}
+	}
+
+	/// A level table read from a cooked file must describe the chain the cooker writes, anything else would make the
+	/// upload read past the data
+	void testLevelValidation()
+	{
+		RgbaImage image;
+		image.width = 13;
+		image.height = 6;
+		image.pixels.assign(image.width * image.height * 4, 128);
+		const CompressedImage compressed = compressImage(image, BlockFormat::BC1);
+
+		CompressedTextureHeader header = {};
+		header.format = compressed.format;
+		header.width = compressed.width;
+		header.height = compressed.height;
+		header.levelCount = uint32_t(compressed.levels.size());
+		header.dataSize = compressed.data.size();
+		check(header.levelCount == 4, "13x6 has four levels");
+		check(hasValidLevels(header, compressed.levels.data()), "cooked levels are valid");
+
+		std::vector<CompressedLevel> levels = compressed.levels;
+		levels[1].size += 8;
+		check(!hasValidLevels(header, levels.data()), "level larger than its blocks");
+		levels = compressed.levels;
+		levels[2].offset = header.dataSize;
+		check(!hasValidLevels(header, levels.data()), "level past the data");
+		levels = compressed.levels;
+		levels[3].width = 2;
+		check(!hasValidLevels(header, levels.data()), "level of the wrong size");
+		header.dataSize += 8;
+		check(!hasValidLevels(header, compressed.levels.data()), "data longer than the levels");
+		header.dataSize -= 8;
+		header.levelCount = 2;
+		check(!hasValidLevels(header, compressed.levels.data()), "data left after the last level");
+		header.dataSize = compressed.levels[2].offset;
+		check(hasValidLevels(header, compressed.levels.data()), "a chain may stop early");
+		header.levelCount = 5;
+		levels = compressed.levels;
+		levels.push_back({1, 1, header.dataSize, 8});
+		header.dataSize = compressed.data.size() + 8;
+		check(!hasValidLevels(header, levels.data()), "level after 1x1");
+	}
+}
+
+int main()
+{
+	testSingleColor();
+	testGradient();
+	testAnchorSwap();
+	testNoise();
+	testPartialBlocks();
+	testLevelValidation();
+	if (failures == 0)
+		std::cout << "All texture cooker tests passed" << std::endl;
+	return failures;
+}